@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* Audio output benchmark.
+ *
+ * Loads an audio plugin (libspop_audio_<name>) just like spopd does, and feeds
+ * it with synthetic audio the way libspotify does: from a single thread, as
+ * fast as the plugin accepts it, in chunks of variable size, with the frames
+ * that were not accepted delivered again a bit later. Every few seconds of
+ * audio there is a discontinuity (0 frames, as after a seek), a short pause, or
+ * a sample rate change.
+ *
+ * At the end, it prints the CPU time used per second of audio, the ratio of
+ * frames accepted by the plugin, the stutters it reported, and the latency
+ * (frames accepted but not audible yet).
+ *
+ * The configuration file is read as usual (or from $SPOPD_CONFIG) to find the
+ * plugins and their options.
+ *
+ * Usage: bench_audio <plugin> [seconds of audio]
+ */
+
+#include <glib.h>
+#include <libspotify/api.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "plugin.h"
+
+#define CHANNELS     2
+#define MAX_FRAMES   8192
+
+/* Events, in seconds of audio */
+#define FLUSH_EVERY  5
+#define PAUSE_EVERY  7
+#define RATE_EVERY   11
+#define PAUSE_LENGTH (200 * G_TIME_SPAN_MILLISECOND)
+
+/* libspotify waits a bit before delivering again what was not accepted */
+#define RETRY_DELAY  (5 * G_TIME_SPAN_MILLISECOND)
+#define STATS_EVERY  (50 * G_TIME_SPAN_MILLISECOND)
+
+static int16_t g_src[MAX_FRAMES * CHANNELS];
+
+static gdouble cpu_time() {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / (gdouble) G_USEC_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+    audio_output out;
+    sp_audioformat format;
+    sp_audio_buffer_stats stats;
+    int seconds;
+    guint64 offered = 0, accepted = 0, played = 0, events = 0;
+    guint64 stutters = 0, nb_latency = 0;
+    gdouble sum_latency = 0, max_latency = 0, cpu;
+    gint64 start, last_stats = 0;
+    int i, nb = 0, pos = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <plugin> [seconds of audio]\n", argv[0]);
+        return 1;
+    }
+    seconds = (argc > 2) ? atoi(argv[2]) : 30;
+
+    g_set_prgname("spop");
+    if (!plugin_audio_load(argv[1], &out))
+        return 1;
+
+    /* 440 Hz sine (at 44.1 kHz) */
+    for (i=0; i < MAX_FRAMES; i++)
+        g_src[CHANNELS*i] = g_src[CHANNELS*i + 1] = (int16_t) (16000 * sin(2 * M_PI * 440 * i / 44100.0));
+
+    format.sample_type = SP_SAMPLETYPE_INT16_NATIVE_ENDIAN;
+    format.sample_rate = 44100;
+    format.channels = CHANNELS;
+    out.format.sample_rate = 0;
+
+    printf("%s audio plugin (version %d), %d s of audio\n", out.name, out.version, seconds);
+
+    cpu = cpu_time();
+    start = g_get_monotonic_time();
+
+    while (played < (guint64) seconds * G_USEC_PER_SEC) {
+        gint64 now = g_get_monotonic_time();
+        int ret;
+
+        /* Periodic events, between two chunks */
+        if ((nb == 0) && (played / G_USEC_PER_SEC > events)) {
+            events += 1;
+            if (events % RATE_EVERY == 0) {
+                format.sample_rate = (format.sample_rate == 44100) ? 48000 : 44100;
+                audio_output_deliver(&out, &format, NULL, 0);
+            }
+            else if (events % PAUSE_EVERY == 0) {
+                audio_output_pause(&out);
+                g_usleep(PAUSE_LENGTH);
+                audio_output_resume(&out);
+            }
+            else if (events % FLUSH_EVERY == 0)
+                audio_output_deliver(&out, &format, NULL, 0);
+        }
+
+        /* New chunk of variable size, or the rest of the previous one */
+        if (nb == 0) {
+            nb = g_random_int_range(MAX_FRAMES / 8, MAX_FRAMES + 1);
+            pos = g_random_int_range(0, MAX_FRAMES - nb + 1);
+        }
+        offered += nb;
+        ret = audio_output_deliver(&out, &format, g_src + pos * CHANNELS, nb);
+        accepted += ret;
+        played += (guint64) ret * G_USEC_PER_SEC / format.sample_rate;
+        pos += ret;
+        nb -= ret;
+        if (nb > 0)
+            g_usleep(RETRY_DELAY);
+
+        /* libspotify asks for the buffer stats every now and then */
+        if (now - last_stats >= STATS_EVERY) {
+            gdouble latency = 1000.0 * audio_output_latency(&out) / format.sample_rate;
+
+            if (out.buffer_stats) {
+                out.buffer_stats(NULL, &stats);
+                stutters += stats.stutter;
+            }
+            sum_latency += latency;
+            nb_latency += 1;
+            max_latency = MAX(max_latency, latency);
+            last_stats = now;
+        }
+    }
+
+    /* Let the plugin play what it has buffered */
+    audio_output_drain(&out);
+    while ((audio_output_latency(&out) > 0) && (g_get_monotonic_time() - start < (seconds + 10) * G_USEC_PER_SEC))
+        g_usleep(STATS_EVERY);
+    if (out.buffer_stats) {
+        out.buffer_stats(NULL, &stats);
+        stutters += stats.stutter;
+    }
+    audio_output_close(&out);
+
+    cpu = cpu_time() - cpu;
+    printf("  wall time:        %8.2f s\n", (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC);
+    printf("  CPU per audio s:  %8.3f ms\n", 1000.0 * cpu / seconds);
+    printf("  accepted frames:  %8.1f%% (%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT ")\n",
+           offered ? 100.0 * accepted / offered : 0.0, accepted, offered);
+    printf("  stutters:         %8" G_GUINT64_FORMAT "\n", stutters);
+    printf("  latency:          %8.1f ms average, %.1f ms max\n",
+           nb_latency ? sum_latency / nb_latency : 0.0, max_latency);
+
+    return 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* DSP kernels micro-benchmark.
+ *
+ * Runs each implementation supported by the CPU on 10 seconds of synthetic
+ * 44.1 kHz audio, checks that it gives the same result as the scalar version
+ * (give or take one rounding step, except for the conversion), and prints its
+ * throughput.
+ *
+ * Usage: bench_dsp [iterations] [channels]
+ */
+
+#include <glib.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "resample.h"
+
+#define RATE   44100
+#define FRAMES (10 * RATE)
+#define OUT_RATE 48000
+
+static const gchar* g_impls[] = { "scalar", "sse2", "avx2" };
+
+static void fill_random(int16_t* buf, size_t len) {
+    size_t i;
+    for (i=0; i < len; i++)
+        buf[i] = (int16_t) g_random_int_range(-32768, 32768);
+}
+
+/* Peaking EQ section (same formulas as the eq plugin) */
+static void make_peak(dsp_biquad* s, double freq, double gain, double q) {
+    double a = pow(10., gain / 40.);
+    double w0 = 2. * G_PI * freq / RATE;
+    double alpha = sin(w0) / (2. * q);
+    double a0 = 1. + alpha / a;
+
+    s->b0 = (1. + alpha * a) / a0;
+    s->b1 = (-2. * cos(w0)) / a0;
+    s->b2 = (1. - alpha * a) / a0;
+    s->a1 = (-2. * cos(w0)) / a0;
+    s->a2 = (1. - alpha / a) / a0;
+}
+
+/* Largest difference between two buffers */
+static int max_diff(const int16_t* a, const int16_t* b, size_t len) {
+    size_t i;
+    int d, max = 0;
+    for (i=0; i < len; i++) {
+        d = abs(a[i] - b[i]);
+        if (d > max)
+            max = d;
+    }
+    return max;
+}
+
+int main(int argc, char** argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 50;
+    int channels = (argc > 2) ? atoi(argv[2]) : 2;
+    size_t len = FRAMES * channels;
+    int16_t* out = g_new(int16_t, len);
+    int16_t* in = g_new(int16_t, len);
+    int16_t* ref = g_new(int16_t, len);
+    int16_t* dst = g_new(int16_t, len);
+    float step = 1.f / FRAMES;
+    gdouble ref_time = 0;
+    int i, j;
+
+    fill_random(out, len);
+    fill_random(in, len);
+
+    /* Reference result. The odd length makes sure the remainder paths are
+       exercised too. */
+    dsp_set_impl("scalar");
+    memcpy(ref, out, len * sizeof(int16_t));
+    dsp_crossfade_s16(ref, in, FRAMES - 3, channels, 0.f, step);
+
+    printf("crossfade_s16, %d channel(s), %d x %d frames\n", channels, iterations, FRAMES);
+    for (i=0; i < G_N_ELEMENTS(g_impls); i++) {
+        gint64 start;
+        gdouble elapsed;
+        int diff;
+
+        if (!dsp_set_impl(g_impls[i])) {
+            printf("  %-8s not supported\n", g_impls[i]);
+            continue;
+        }
+
+        memcpy(dst, out, len * sizeof(int16_t));
+        dsp_crossfade_s16(dst, in, FRAMES - 3, channels, 0.f, step);
+        diff = max_diff(dst, ref, len);
+
+        start = g_get_monotonic_time();
+        for (j=0; j < iterations; j++) {
+            memcpy(dst, out, len * sizeof(int16_t));
+            dsp_crossfade_s16(dst, in, FRAMES, channels, 0.f, step);
+        }
+        elapsed = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+        if (i == 0)
+            ref_time = elapsed;
+
+        printf("  %-8s %8.1f Msamples/s  %6.0fx real time  speedup %.2fx  max diff %d%s\n",
+               g_impls[i], iterations * len / elapsed / 1e6,
+               iterations * (gdouble) FRAMES / RATE / elapsed,
+               ref_time / elapsed, diff, (diff > 1) ? "  MISMATCH" : "");
+    }
+
+    /* Same thing for the gain ramp (the output volume) */
+    dsp_set_impl("scalar");
+    dsp_gain_s16(ref, in, FRAMES - 3, channels, 1.f, -step);
+
+    printf("gain_s16, %d channel(s), %d x %d frames\n", channels, iterations, FRAMES);
+    for (i=0; i < G_N_ELEMENTS(g_impls); i++) {
+        gint64 start;
+        gdouble elapsed;
+        int diff;
+
+        if (!dsp_set_impl(g_impls[i])) {
+            printf("  %-8s not supported\n", g_impls[i]);
+            continue;
+        }
+
+        memcpy(dst, ref, len * sizeof(int16_t));
+        dsp_gain_s16(dst, in, FRAMES - 3, channels, 1.f, -step);
+        diff = max_diff(dst, ref, len);
+
+        start = g_get_monotonic_time();
+        for (j=0; j < iterations; j++)
+            dsp_gain_s16(dst, in, FRAMES, channels, 1.f, -step);
+        elapsed = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+        if (i == 0)
+            ref_time = elapsed;
+
+        printf("  %-8s %8.1f Msamples/s  %6.0fx real time  speedup %.2fx  max diff %d%s\n",
+               g_impls[i], iterations * len / elapsed / 1e6,
+               iterations * (gdouble) FRAMES / RATE / elapsed,
+               ref_time / elapsed, diff, (diff > 1) ? "  MISMATCH" : "");
+    }
+
+    /* Same thing for the 16 to 32 bits conversion */
+    {
+        int32_t* ref32 = g_new(int32_t, len);
+        int32_t* dst32 = g_new(int32_t, len);
+
+        dsp_set_impl("scalar");
+        dsp_s16_to_s32(ref32, in, len - 3);
+
+        printf("s16_to_s32, %d x %zu samples\n", iterations, len);
+        for (i=0; i < G_N_ELEMENTS(g_impls); i++) {
+            gint64 start;
+            gdouble elapsed;
+            gboolean same;
+
+            if (!dsp_set_impl(g_impls[i])) {
+                printf("  %-8s not supported\n", g_impls[i]);
+                continue;
+            }
+
+            memset(dst32, 0, len * sizeof(int32_t));
+            dsp_s16_to_s32(dst32, in, len - 3);
+            same = (memcmp(dst32, ref32, (len - 3) * sizeof(int32_t)) == 0);
+
+            start = g_get_monotonic_time();
+            for (j=0; j < iterations; j++)
+                dsp_s16_to_s32(dst32, in, len);
+            elapsed = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+            if (i == 0)
+                ref_time = elapsed;
+
+            printf("  %-8s %8.1f Msamples/s  speedup %.2fx%s\n",
+                   g_impls[i], iterations * len / elapsed / 1e6,
+                   ref_time / elapsed, same ? "" : "  MISMATCH");
+        }
+
+        g_free(ref32);
+        g_free(dst32);
+    }
+
+    /* Same thing for the biquads (the equalizer), with 5 peaking sections */
+    {
+        dsp_biquad sections[5];
+        double* state = g_new0(double, 2 * G_N_ELEMENTS(sections) * channels);
+
+        for (i=0; i < G_N_ELEMENTS(sections); i++)
+            make_peak(&sections[i], 60. * pow(4., i), (i % 2) ? -3. : 3., 1.);
+
+        dsp_set_impl("scalar");
+        memcpy(ref, in, len * sizeof(int16_t));
+        dsp_biquad_s16(ref, FRAMES - 3, channels, sections, G_N_ELEMENTS(sections), state);
+
+        printf("biquad_s16, %d channel(s), %d x %d frames\n", channels, iterations, FRAMES);
+        for (i=0; i < G_N_ELEMENTS(g_impls); i++) {
+            gint64 start;
+            gdouble elapsed;
+            int diff;
+
+            if (!dsp_set_impl(g_impls[i])) {
+                printf("  %-8s not supported\n", g_impls[i]);
+                continue;
+            }
+
+            memset(state, 0, 2 * G_N_ELEMENTS(sections) * channels * sizeof(double));
+            memcpy(dst, in, len * sizeof(int16_t));
+            dsp_biquad_s16(dst, FRAMES - 3, channels, sections, G_N_ELEMENTS(sections), state);
+            diff = max_diff(dst, ref, len);
+
+            start = g_get_monotonic_time();
+            for (j=0; j < iterations; j++)
+                dsp_biquad_s16(dst, FRAMES, channels, sections, G_N_ELEMENTS(sections), state);
+            elapsed = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+            if (i == 0)
+                ref_time = elapsed;
+
+            printf("  %-8s %8.1f Msamples/s  %6.0fx real time  speedup %.2fx  max diff %d%s\n",
+                   g_impls[i], iterations * len / elapsed / 1e6,
+                   iterations * (gdouble) FRAMES / RATE / elapsed,
+                   ref_time / elapsed, diff, (diff > 1) ? "  MISMATCH" : "");
+        }
+
+        g_free(state);
+    }
+
+    /* And for the resampler, which is mostly made of dot products. It is much
+       slower than the other kernels, hence fewer iterations. */
+    {
+        int rs_iterations = MAX(iterations / 10, 1);
+        resampler* rs = resampler_new(RATE, OUT_RATE, channels);
+        size_t max_out = resampler_max_output(rs, FRAMES) * channels;
+        int16_t* ref_rs = g_new(int16_t, max_out);
+        int16_t* dst_rs = g_new(int16_t, max_out);
+        size_t ref_len;
+
+        dsp_set_impl("scalar");
+        ref_len = resampler_process(rs, in, FRAMES, ref_rs) * channels;
+        resampler_free(rs);
+
+        printf("resample %d -> %d Hz, %d x %d frames\n", RATE, OUT_RATE, rs_iterations, FRAMES);
+        for (i=0; i < G_N_ELEMENTS(g_impls); i++) {
+            gint64 start;
+            gdouble elapsed;
+            int diff;
+
+            if (!dsp_set_impl(g_impls[i])) {
+                printf("  %-8s not supported\n", g_impls[i]);
+                continue;
+            }
+
+            rs = resampler_new(RATE, OUT_RATE, channels);
+            resampler_process(rs, in, FRAMES, dst_rs);
+            diff = max_diff(dst_rs, ref_rs, ref_len);
+
+            start = g_get_monotonic_time();
+            for (j=0; j < rs_iterations; j++)
+                resampler_process(rs, in, FRAMES, dst_rs);
+            elapsed = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+            resampler_free(rs);
+            if (i == 0)
+                ref_time = elapsed;
+
+            printf("  %-8s %8.1f Msamples/s  %6.0fx real time  speedup %.2fx  max diff %d%s\n",
+                   g_impls[i], rs_iterations * len / elapsed / 1e6,
+                   rs_iterations * (gdouble) FRAMES / RATE / elapsed,
+                   ref_time / elapsed, diff, (diff > 1) ? "  MISMATCH" : "");
+        }
+
+        g_free(ref_rs);
+        g_free(dst_rs);
+    }
+
+    g_free(out);
+    g_free(in);
+    g_free(ref);
+    g_free(dst);
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* JSON output micro-benchmark.
+ *
+ * Produces the answer to "ls" for a playlist of 50000 tracks (by default),
+ * the way spopd used to (JsonBuilder tree, JsonGenerator, then g_strconcat()
+ * to add the final newline), and with the streaming json_writer. Both outputs
+ * must be identical.
+ *
+ * Usage: bench_json [tracks] [iterations]
+ */
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+typedef struct {
+    gchar*   artist;
+    gchar*   title;
+    gchar*   album;
+    gchar*   uri;
+    guint    duration;
+    int      popularity;
+    gboolean available;
+    gboolean starred;
+} fake_track;
+
+static fake_track* make_tracks(int n) {
+    fake_track* tracks = g_new(fake_track, n);
+    int i;
+
+    for (i=0; i < n; i++) {
+        tracks[i].artist = g_strdup_printf("Artist %d", i % 997);
+        tracks[i].title = g_strdup_printf("Track \"%d\" (remastered)", i);
+        tracks[i].album = g_strdup_printf("Album %d: Live in Montréal", i % 4999);
+        tracks[i].uri = g_strdup_printf("spotify:track:%022x", i * 2654435761u);
+        tracks[i].duration = 120000 + (i * 7919) % 240000;
+        tracks[i].popularity = i % 100;
+        tracks[i].available = (i % 13) != 0;
+        tracks[i].starred = (i % 7) == 0;
+    }
+
+    return tracks;
+}
+
+static gchar* with_builder(const fake_track* tracks, int n) {
+    JsonBuilder* jb = json_builder_new();
+    JsonGenerator* gen;
+    gchar* str;
+    gchar* strn;
+    int i;
+
+    json_builder_begin_object(jb);
+    json_builder_set_member_name(jb, "name");
+    json_builder_add_string_value(jb, "Starred");
+    json_builder_set_member_name(jb, "tracks");
+    json_builder_begin_array(jb);
+    for (i=0; i < n; i++) {
+        json_builder_begin_object(jb);
+        json_builder_set_member_name(jb, "artist");
+        json_builder_add_string_value(jb, tracks[i].artist);
+        json_builder_set_member_name(jb, "title");
+        json_builder_add_string_value(jb, tracks[i].title);
+        json_builder_set_member_name(jb, "album");
+        json_builder_add_string_value(jb, tracks[i].album);
+        json_builder_set_member_name(jb, "duration");
+        json_builder_add_int_value(jb, tracks[i].duration);
+        json_builder_set_member_name(jb, "uri");
+        json_builder_add_string_value(jb, tracks[i].uri);
+        json_builder_set_member_name(jb, "available");
+        json_builder_add_boolean_value(jb, tracks[i].available);
+        json_builder_set_member_name(jb, "popularity");
+        json_builder_add_int_value(jb, tracks[i].popularity);
+        json_builder_set_member_name(jb, "starred");
+        json_builder_add_boolean_value(jb, tracks[i].starred);
+        json_builder_set_member_name(jb, "index");
+        json_builder_add_int_value(jb, i+1);
+        json_builder_end_object(jb);
+    }
+    json_builder_end_array(jb);
+    json_builder_end_object(jb);
+
+    gen = json_generator_new();
+    json_generator_set_root(gen, json_builder_get_root(jb));
+    str = json_generator_to_data(gen, NULL);
+    g_object_unref(gen);
+    g_object_unref(jb);
+
+    strn = g_strconcat(str, "\n", NULL);
+    g_free(str);
+    return strn;
+}
+
+static GString* with_writer(const fake_track* tracks, int n) {
+    json_writer* jw = json_writer_new(FALSE);
+    GString* str;
+    int i;
+
+    json_writer_begin_object(jw);
+    json_writer_set_member_name(jw, "name");
+    json_writer_add_string_value(jw, "Starred");
+    json_writer_set_member_name(jw, "tracks");
+    json_writer_begin_array(jw);
+    for (i=0; i < n; i++) {
+        json_writer_begin_object(jw);
+        json_writer_set_member_name(jw, "artist");
+        json_writer_add_string_value(jw, tracks[i].artist);
+        json_writer_set_member_name(jw, "title");
+        json_writer_add_string_value(jw, tracks[i].title);
+        json_writer_set_member_name(jw, "album");
+        json_writer_add_string_value(jw, tracks[i].album);
+        json_writer_set_member_name(jw, "duration");
+        json_writer_add_int_value(jw, tracks[i].duration);
+        json_writer_set_member_name(jw, "uri");
+        json_writer_add_string_value(jw, tracks[i].uri);
+        json_writer_set_member_name(jw, "available");
+        json_writer_add_boolean_value(jw, tracks[i].available);
+        json_writer_set_member_name(jw, "popularity");
+        json_writer_add_int_value(jw, tracks[i].popularity);
+        json_writer_set_member_name(jw, "starred");
+        json_writer_add_boolean_value(jw, tracks[i].starred);
+        json_writer_set_member_name(jw, "index");
+        json_writer_add_int_value(jw, i+1);
+        json_writer_end_object(jw);
+    }
+    json_writer_end_array(jw);
+    json_writer_end_object(jw);
+
+    str = json_writer_free(jw, FALSE);
+    g_string_append_c(str, '\n');
+    return str;
+}
+
+int main(int argc, char** argv) {
+    int n = 50000;
+    int iterations = 20;
+    fake_track* tracks;
+    gchar* ref;
+    GString* str;
+    gint64 start, t_builder, t_writer;
+    gsize size;
+    int i;
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (argc > 2)
+        iterations = atoi(argv[2]);
+
+    tracks = make_tracks(n);
+
+    /* Check that both produce the same thing */
+    ref = with_builder(tracks, n);
+    str = with_writer(tracks, n);
+    size = str->len;
+    if (strcmp(ref, str->str) != 0)
+        printf("Warning: the outputs are different!\n");
+    g_free(ref);
+    g_string_free(str, TRUE);
+
+    start = g_get_monotonic_time();
+    for (i=0; i < iterations; i++)
+        g_free(with_builder(tracks, n));
+    t_builder = (g_get_monotonic_time() - start) / iterations;
+
+    start = g_get_monotonic_time();
+    for (i=0; i < iterations; i++)
+        g_string_free(with_writer(tracks, n), TRUE);
+    t_writer = (g_get_monotonic_time() - start) / iterations;
+
+    printf("%d tracks, %" G_GSIZE_FORMAT " bytes of JSON\n", n, size);
+    printf("JsonBuilder + JsonGenerator: %8.2f ms  %7.1f MB/s\n", t_builder / 1000., (gdouble) size / t_builder);
+    printf("json_writer:                 %8.2f ms  %7.1f MB/s\n", t_writer / 1000., (gdouble) size / t_writer);
+    printf("Speedup: %.1fx\n", (gdouble) t_builder / t_writer);
+
+    for (i=0; i < n; i++) {
+        g_free(tracks[i].artist);
+        g_free(tracks[i].title);
+        g_free(tracks[i].album);
+        g_free(tracks[i].uri);
+    }
+    g_free(tracks);
+
+    return 0;
+}
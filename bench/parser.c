@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* Command parser micro-benchmark.
+ *
+ * Parses typical command lines (the ones status bars and notification scripts
+ * send all the time) with g_shell_parse_argv(), which is what spopd used to
+ * do, and with split_command(), which works in place. Then looks the commands
+ * up by name and number of arguments, with a linear scan and with a hash
+ * table.
+ *
+ * Usage: bench_parser [iterations]
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#define MAX_ARGS 4
+
+static const gchar* g_lines[] = {
+    "status",
+    "idle",
+    "ls",
+    "ls 12",
+    "ls 12 150 50",
+    "play 3 12",
+    "qrm 4 10",
+    "uinfo spotify:track:6rqhFgbbKwnb9MLmUQDhG6",
+    "search \"daft punk\"",
+    "search 'random access memories'",
+    "volume 42",
+    "stats",
+    "next",
+    NULL
+};
+
+/* Names and number of arguments of the commands, in the same order as
+   g_commands in src/interface.c */
+typedef struct {
+    const gchar* name;
+    gint         nb_args;
+} command_key;
+static const command_key g_commands[] = {
+    {"help", 0}, {"ls", 0}, {"ls", 1}, {"ls", 3}, {"status", 0}, {"stats", 0}, {"notify", 0},
+    {"repeat", 0}, {"shuffle", 0}, {"volume", 1}, {"output", 0}, {"output", 1},
+    {"qls", 0}, {"qls", 2}, {"qclear", 0}, {"qrm", 1}, {"qrm", 2}, {"play", 1}, {"play", 2},
+    {"add", 1}, {"add", 2}, {"play", 0}, {"toggle", 0}, {"stop", 0}, {"seek", 1},
+    {"next", 0}, {"prev", 0}, {"goto", 1}, {"offline-status", 0}, {"offline-toggle", 1},
+    {"image", 0}, {"uinfo", 1}, {"uadd", 1}, {"uplay", 1}, {"uimage", 1}, {"uimage", 2},
+    {"star", 0}, {"ustar", 2}, {"search", 1}, {"search", 3}, {"bye", 0}, {"quit", 0},
+    {"idle", 0},
+    {NULL, 0}
+};
+
+static guint command_key_hash(gconstpointer key) {
+    const command_key* ck = key;
+    return g_str_hash(ck->name) * 31 + ck->nb_args;
+}
+
+static gboolean command_key_equal(gconstpointer a, gconstpointer b) {
+    const command_key* ca = a;
+    const command_key* cb = b;
+    return (ca->nb_args == cb->nb_args) && (strcmp(ca->name, cb->name) == 0);
+}
+
+static const command_key* find_linear(const gchar* name, gint nb_args) {
+    int i;
+    for (i=0; g_commands[i].name != NULL; i++) {
+        if ((strcmp(g_commands[i].name, name) == 0) && (g_commands[i].nb_args == nb_args))
+            return &(g_commands[i]);
+    }
+    return NULL;
+}
+
+static void report(const gchar* name, guint64 count, gint64 elapsed) {
+    printf("%-28s %10.1f ns/command  %8.2f Mcommands/s\n", name,
+           (1000. * elapsed) / count, (gdouble) count / elapsed);
+}
+
+int main(int argc, char** argv) {
+    guint iterations = 200000;
+    guint64 count = 0, found = 0;
+    gint64 start, elapsed;
+    GHashTable* table;
+    gchar buf[256];
+    guint it;
+    int i, j;
+
+    if (argc > 1)
+        iterations = strtoul(argv[1], NULL, 0);
+
+    table = g_hash_table_new(command_key_hash, command_key_equal);
+    for (i=0; g_commands[i].name != NULL; i++)
+        g_hash_table_insert(table, (gpointer) &(g_commands[i]), (gpointer) &(g_commands[i]));
+
+    /* g_shell_parse_argv(), then copy to the stack like spopd did */
+    start = g_get_monotonic_time();
+    for (it=0; it < iterations; it++) {
+        for (i=0; g_lines[i] != NULL; i++) {
+            gchar** args_;
+            gchar** args;
+            gint nb;
+
+            g_strlcpy(buf, g_lines[i], sizeof(buf));
+            if (!g_shell_parse_argv(g_strstrip(buf), &nb, &args_, NULL))
+                g_error("Can't parse %s", g_lines[i]);
+            args = g_newa(gchar*, nb);
+            for (j=0; j < nb; j++) {
+                args[j] = g_newa(gchar, strlen(args_[j])+1);
+                strcpy(args[j], args_[j]);
+            }
+            g_strfreev(args_);
+            found += (find_linear(args[0], nb-1) != NULL);
+            count += 1;
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+    report("g_shell_parse_argv + scan", count, elapsed);
+
+    /* In place, then hash table */
+    count = 0;
+    start = g_get_monotonic_time();
+    for (it=0; it < iterations; it++) {
+        for (i=0; g_lines[i] != NULL; i++) {
+            gchar* args[MAX_ARGS];
+            command_key key;
+            gint nb;
+
+            g_strlcpy(buf, g_lines[i], sizeof(buf));
+            nb = split_command(buf, args, MAX_ARGS);
+            if (nb <= 0)
+                g_error("Can't parse %s", g_lines[i]);
+            key.name = args[0];
+            key.nb_args = nb-1;
+            found += (g_hash_table_lookup(table, &key) != NULL);
+            count += 1;
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+    report("split_command + hash table", count, elapsed);
+
+    /* Each part separately */
+    count = 0;
+    start = g_get_monotonic_time();
+    for (it=0; it < iterations; it++) {
+        for (i=0; g_lines[i] != NULL; i++) {
+            gchar* args[MAX_ARGS];
+            g_strlcpy(buf, g_lines[i], sizeof(buf));
+            found += split_command(buf, args, MAX_ARGS);
+            count += 1;
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+    report("split_command only", count, elapsed);
+
+    count = 0;
+    start = g_get_monotonic_time();
+    for (it=0; it < iterations; it++) {
+        for (i=0; g_commands[i].name != NULL; i++) {
+            found += (find_linear(g_commands[i].name, g_commands[i].nb_args) != NULL);
+            count += 1;
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+    report("linear scan only", count, elapsed);
+
+    count = 0;
+    start = g_get_monotonic_time();
+    for (it=0; it < iterations; it++) {
+        for (i=0; g_commands[i].name != NULL; i++) {
+            found += (g_hash_table_lookup(table, &(g_commands[i])) != NULL);
+            count += 1;
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+    report("hash table only", count, elapsed);
+
+    /* Keep the compiler from optimizing everything away */
+    if (found == 0)
+        printf("Nothing found?!\n");
+
+    g_hash_table_destroy(table);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* Protocol benchmark.
+ *
+ * Connects to a running spopd and sends the same command many times over a
+ * single connection, first one at a time (waiting for each answer before
+ * sending the next command), then pipelined (all the commands are sent at
+ * once by a writer thread while the answers are read). It prints the number of
+ * commands per second in both cases.
+ *
+ * Each answer is expected on a single line, so pretty_json must be disabled.
+ *
+ * Usage: bench_protocol [count] [command] [host] [port]
+ */
+
+#include <glib.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define READ_SIZE 65536
+
+typedef struct {
+    int sock;
+    const gchar* line;
+    gsize line_len;
+    int count;
+} writer_data;
+
+static int connect_to(const gchar* host, const gchar* port) {
+    struct addrinfo hints;
+    struct addrinfo* res;
+    struct addrinfo* rp;
+    int sock = -1, ret;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0)
+        g_error("Can't get address info: %s", gai_strerror(ret));
+
+    for (rp = res; rp != NULL; rp = rp->ai_next) {
+        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock < 0)
+            continue;
+        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0)
+            break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+
+    if (sock < 0)
+        g_error("Can't connect to %s:%s", host, port);
+    return sock;
+}
+
+static void write_all(int sock, const gchar* data, gsize len) {
+    while (len > 0) {
+        ssize_t n = write(sock, data, len);
+        if (n <= 0)
+            g_error("Can't write to socket");
+        data += n;
+        len -= n;
+    }
+}
+
+/* Read until count more lines were received */
+static void read_lines(int sock, int count) {
+    static gchar buf[READ_SIZE];
+    ssize_t n;
+    gchar* p;
+
+    while (count > 0) {
+        n = read(sock, buf, sizeof(buf));
+        if (n <= 0)
+            g_error("Connection closed by spopd");
+        for (p = buf; (p = memchr(p, '\n', buf + n - p)) != NULL; p++)
+            count -= 1;
+    }
+}
+
+static gpointer writer(gpointer data) {
+    writer_data* wd = data;
+    int i;
+
+    for (i=0; i < wd->count; i++)
+        write_all(wd->sock, wd->line, wd->line_len);
+    return NULL;
+}
+
+static void report(const gchar* mode, int count, gint64 elapsed) {
+    printf("%-10s %8d commands in %8.1f ms: %10.0f commands/s\n", mode, count,
+           elapsed / 1000., count * (gdouble) G_USEC_PER_SEC / MAX(elapsed, 1));
+}
+
+int main(int argc, char** argv) {
+    writer_data wd;
+    GThread* thread;
+    gint64 start;
+    gchar* line;
+    int count, i;
+
+    count = (argc > 1) ? atoi(argv[1]) : 10000;
+    line = g_strdup_printf("%s\n", (argc > 2) ? argv[2] : "status");
+
+    wd.sock = connect_to((argc > 3) ? argv[3] : "127.0.0.1", (argc > 4) ? argv[4] : "6602");
+    wd.line = line;
+    wd.line_len = strlen(line);
+    wd.count = count;
+
+    /* Greetings */
+    read_lines(wd.sock, 1);
+
+    start = g_get_monotonic_time();
+    for (i=0; i < count; i++) {
+        write_all(wd.sock, line, wd.line_len);
+        read_lines(wd.sock, 1);
+    }
+    report("sequential", count, g_get_monotonic_time() - start);
+
+    start = g_get_monotonic_time();
+    thread = g_thread_new("writer", writer, &wd);
+    read_lines(wd.sock, count);
+    report("pipelined", count, g_get_monotonic_time() - start);
+    g_thread_join(thread);
+
+    write_all(wd.sock, "bye\n", 4);
+    close(wd.sock);
+    g_free(line);
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* Ring buffer micro-benchmark.
+ *
+ * A producer thread pushes synthetic 16-bit stereo frames in chunks of the
+ * same size as the ones libspotify delivers, and a consumer thread drains them
+ * in chunks of at most 8 KiB, just like the ao player thread. The consumer can
+ * be paced to a given sample rate to see how many wakeups happen in real-time
+ * conditions.
+ *
+ * Usage: bench_ringbuf [seconds] [consumer rate in frames/s, 0 = unlimited]
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ringbuf.h"
+
+#define FRAME_SIZE 4
+#define CHUNK_MAX  8192
+#define RING_SIZE  (8192 * 16)
+
+static ringbuf* g_ring;
+static gint g_stop = FALSE;
+static guint64 g_consumed = 0;
+static guint64 g_starved = 0;
+static int g_rate = 0;
+
+static gpointer consumer(gpointer data) {
+    gint64 start = g_get_monotonic_time();
+
+    while (!g_atomic_int_get(&g_stop)) {
+        gpointer ptr;
+        gsize size = ringbuf_peek(g_ring, &ptr);
+
+        if (size == 0) {
+            g_starved += 1;
+            ringbuf_wait(g_ring, g_get_monotonic_time() + G_TIME_SPAN_SECOND / 10);
+            continue;
+        }
+
+        size = MIN(size, CHUNK_MAX);
+        size -= size % FRAME_SIZE;
+        ringbuf_consume(g_ring, size);
+        g_consumed += size;
+
+        if (g_rate > 0) {
+            /* Behave like a sound card: sleep until these frames are played */
+            gint64 played_at = start + (g_consumed / FRAME_SIZE) * G_USEC_PER_SEC / g_rate;
+            gint64 now = g_get_monotonic_time();
+            if (played_at > now)
+                g_usleep(played_at - now);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int seconds = (argc > 1) ? atoi(argv[1]) : 5;
+    gint16 frames[2048 * 2];
+    guint64 produced = 0;
+    guint64 full = 0;
+    GThread* thread;
+    gint64 start, end;
+    gdouble elapsed;
+    int i;
+
+    g_rate = (argc > 2) ? atoi(argv[2]) : 0;
+    g_ring = ringbuf_new(RING_SIZE);
+
+    for (i=0; i < G_N_ELEMENTS(frames); i++)
+        frames[i] = (gint16) g_random_int_range(-32768, 32768);
+
+    thread = g_thread_new("consumer", consumer, NULL);
+
+    start = g_get_monotonic_time();
+    end = start + seconds * G_TIME_SPAN_SECOND;
+    while (g_get_monotonic_time() < end) {
+        /* libspotify delivers between 1024 and 2048 frames at a time */
+        gsize nb = g_random_int_range(1024, 2049);
+        gsize space = ringbuf_space(g_ring) / FRAME_SIZE;
+
+        nb = MIN(nb, space);
+        if (nb == 0) {
+            /* Buffer full: libspotify would try again a bit later */
+            full += 1;
+            g_usleep(1000);
+            continue;
+        }
+        produced += ringbuf_write(g_ring, frames, nb * FRAME_SIZE);
+    }
+    g_atomic_int_set(&g_stop, TRUE);
+    ringbuf_wake(g_ring);
+    g_thread_join(thread);
+    elapsed = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+
+    printf("duration:        %.2f s\n", elapsed);
+    printf("consumer rate:   %s\n", g_rate > 0 ? "paced" : "unlimited");
+    printf("produced:        %" G_GUINT64_FORMAT " bytes\n", produced);
+    printf("consumed:        %" G_GUINT64_FORMAT " bytes\n", g_consumed);
+    printf("throughput:      %.1f MiB/s (%.0f frames/s, %.1fx real time at 44.1 kHz)\n",
+           g_consumed / elapsed / (1024 * 1024), g_consumed / FRAME_SIZE / elapsed,
+           g_consumed / FRAME_SIZE / elapsed / 44100.);
+    printf("producer stalls: %" G_GUINT64_FORMAT " (buffer full)\n", full);
+    printf("consumer starved: %" G_GUINT64_FORMAT " times\n", g_starved);
+    printf("wakeups:         %u (%.1f/s)\n", ringbuf_wakeups(g_ring), ringbuf_wakeups(g_ring) / elapsed);
+
+    ringbuf_free(g_ring);
+    return 0;
+}
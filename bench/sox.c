@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* SoX effects chain benchmark.
+ *
+ * Builds the same kind of chain as the sox plugin (spop input, user effects,
+ * output) with the "null" output device, feeds it with synthetic 44.1 kHz
+ * stereo audio as fast as possible, and prints how many samples per second go
+ * through the chain with each implementation of the input conversion.
+ *
+ * Usage: bench_sox [seconds of audio] [effect]...
+ * For instance: bench_sox 600 "gain -3" "equalizer 1000 1q 3" "reverb"
+ */
+
+#include <glib.h>
+#include <sox.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dsp.h"
+
+#define RATE        44100
+#define CHANNELS    2
+#define SRC_SAMPLES (RATE * CHANNELS)
+
+static const gchar* g_impls[] = { "scalar", "sse2", "avx2" };
+
+static int16_t g_src[SRC_SAMPLES];
+static guint64 g_left;
+
+/* Same as the sox plugin input, without the buffer */
+static int input_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp) {
+    size_t n = MIN(*osamp, SRC_SAMPLES);
+
+    n = MIN(n, g_left);
+    n -= n % CHANNELS;
+    if (n == 0) {
+        *osamp = 0;
+        return SOX_EOF;
+    }
+
+    dsp_s16_to_s32(obuf, g_src, n);
+    g_left -= n;
+    *osamp = n;
+
+    return SOX_SUCCESS;
+}
+static sox_effect_handler_t g_input = { "spop_input", NULL, SOX_EFF_MCHAN, NULL, NULL, NULL,
+                                        input_drain, NULL, NULL, 0 };
+
+static void add_effect(sox_effects_chain_t* chain, sox_format_t* out, const sox_effect_handler_t* effhp,
+                       int argc, char** argv) {
+    sox_effect_t* effp = sox_create_effect(effhp);
+
+    if (sox_effect_options(effp, argc, argv) != SOX_SUCCESS)
+        g_error("Can't parse options for effect %s", effhp->name);
+    if (sox_add_effect(chain, effp, &out->signal, &out->signal) != SOX_SUCCESS)
+        g_error("Could not add effect %s to effects chain", effhp->name);
+    g_free(effp);
+}
+
+static gdouble run_chain(guint64 samples, int nb_effects, char** effects) {
+    sox_signalinfo_t si;
+    sox_encodinginfo_t ei;
+    sox_format_t* out;
+    sox_effects_chain_t* chain;
+    char* args[1];
+    gint64 start;
+    int i;
+
+    si.rate = RATE;
+    si.channels = CHANNELS;
+    si.precision = 16;
+    si.length = SOX_IGNORE_LENGTH;
+    si.mult = NULL;
+    sox_init_encodinginfo(&ei);
+
+    out = sox_open_write("", &si, NULL, "null", NULL, NULL);
+    if (!out)
+        g_error("Can't open SoX null output");
+    chain = sox_create_effects_chain(&ei, &out->encoding);
+
+    add_effect(chain, out, &g_input, 0, args);
+    for (i=0; i < nb_effects; i++) {
+        gint argc;
+        gchar** argv;
+        GError* err = NULL;
+        const sox_effect_handler_t* effhp;
+
+        if (!g_shell_parse_argv(effects[i], &argc, &argv, &err))
+            g_error("Can't parse SoX effect \"%s\": %s", effects[i], err->message);
+        effhp = sox_find_effect(argv[0]);
+        if (!effhp)
+            g_error("Unknown effect: %s", argv[0]);
+        add_effect(chain, out, effhp, argc-1, &argv[1]);
+        g_strfreev(argv);
+    }
+    args[0] = (char*) out;
+    add_effect(chain, out, sox_find_effect("output"), 1, args);
+
+    g_left = samples;
+    start = g_get_monotonic_time();
+    sox_flow_effects(chain, NULL, NULL);
+
+    sox_delete_effects_chain(chain);
+    sox_close(out);
+
+    return (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+    int seconds = (argc > 1) ? atoi(argv[1]) : 300;
+    guint64 samples = (guint64) seconds * RATE * CHANNELS;
+    gdouble ref_time = 0;
+    int i;
+
+    if (sox_init() != SOX_SUCCESS)
+        g_error("Can't initialize SoX");
+
+    for (i=0; i < SRC_SAMPLES; i++)
+        g_src[i] = (int16_t) g_random_int_range(-32768, 32768);
+
+    printf("%d s of audio through %d effect(s)\n", seconds, MAX(argc - 2, 0));
+    for (i=0; i < G_N_ELEMENTS(g_impls); i++) {
+        gdouble elapsed;
+
+        if (!dsp_set_impl(g_impls[i])) {
+            printf("  %-8s not supported\n", g_impls[i]);
+            continue;
+        }
+
+        elapsed = run_chain(samples, MAX(argc - 2, 0), argv + 2);
+        if (i == 0)
+            ref_time = elapsed;
+
+        printf("  %-8s %8.1f Msamples/s  %6.0fx real time  speedup %.2fx\n",
+               g_impls[i], samples / elapsed / 1e6, seconds / elapsed, ref_time / elapsed);
+    }
+
+    sox_quit();
+    return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "audio.h"
+#include "config.h"
+
+/* There is no player thread and no intermediate buffer: audio_write() copies
+   the frames straight into ALSA's ring buffer with the mmap API, and the ring
+   buffer is the only place where audio is queued. Since the PCM is used both
+   from libspotify's thread and from the main thread, all the calls are done
+   with a lock held. */
+static GMutex g_alsa_mutex;
+static snd_pcm_t* g_pcm = NULL;
+static sp_audioformat g_alsa_format;
+static size_t g_frame_size = 0;
+
+static snd_pcm_uframes_t g_buffer_size = 0;
+static snd_pcm_uframes_t g_period_size = 0;
+static gboolean g_can_pause = FALSE;
+
+static gboolean g_paused = FALSE;
+static gboolean g_draining = FALSE;
+static guint g_stutters = 0;
+static guint g_underruns = 0;
+
+/* "Private" functions, used to set up the PCM */
+static void alsa_open() {
+    const gchar* device;
+    int err;
+
+    device = config_get_string_opt_group("alsa", "device", "default");
+
+    g_debug("Opening ALSA device %s", device);
+    err = snd_pcm_open(&g_pcm, device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if (err < 0)
+        g_error("Can't open ALSA device %s: %s", device, snd_strerror(err));
+}
+
+static void alsa_close() {
+    g_debug("Closing ALSA device");
+    snd_pcm_drop(g_pcm);
+    snd_pcm_close(g_pcm);
+    g_pcm = NULL;
+    g_alsa_format.sample_rate = 0;
+}
+
+/* Set the PCM parameters using "format" from libspotify */
+static void alsa_setup(const sp_audioformat* format) {
+    snd_pcm_hw_params_t* hw;
+    snd_pcm_sw_params_t* sw;
+    unsigned int buffer_time, period_time;
+    int err;
+
+    if (format->sample_type != SP_SAMPLETYPE_INT16_NATIVE_ENDIAN)
+        g_error("Unknown sample type");
+
+    buffer_time = 1000 * config_get_int_opt_group("alsa", "buffer_time", 500);
+    period_time = 1000 * config_get_int_opt_group("alsa", "period_time", 50);
+
+    /* Hardware parameters */
+    snd_pcm_hw_params_alloca(&hw);
+    if ((err = snd_pcm_hw_params_any(g_pcm, hw)) < 0)
+        g_error("Can't get ALSA hardware parameters: %s", snd_strerror(err));
+    if ((err = snd_pcm_hw_params_set_access(g_pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0)
+        g_error("ALSA device does not support mmap access: %s", snd_strerror(err));
+    if ((err = snd_pcm_hw_params_set_format(g_pcm, hw, SND_PCM_FORMAT_S16)) < 0)
+        g_error("Can't set ALSA sample format: %s", snd_strerror(err));
+    if ((err = snd_pcm_hw_params_set_channels(g_pcm, hw, format->channels)) < 0)
+        g_error("Can't set ALSA channels to %d: %s", format->channels, snd_strerror(err));
+    if ((err = snd_pcm_hw_params_set_rate(g_pcm, hw, format->sample_rate, 0)) < 0)
+        g_error("Can't set ALSA sample rate to %d (try a \"plug\" device): %s",
+                format->sample_rate, snd_strerror(err));
+    if ((err = snd_pcm_hw_params_set_buffer_time_near(g_pcm, hw, &buffer_time, NULL)) < 0)
+        g_error("Can't set ALSA buffer time: %s", snd_strerror(err));
+    if ((err = snd_pcm_hw_params_set_period_time_near(g_pcm, hw, &period_time, NULL)) < 0)
+        g_error("Can't set ALSA period time: %s", snd_strerror(err));
+    if ((err = snd_pcm_hw_params(g_pcm, hw)) < 0)
+        g_error("Can't set ALSA hardware parameters: %s", snd_strerror(err));
+
+    snd_pcm_hw_params_get_buffer_size(hw, &g_buffer_size);
+    snd_pcm_hw_params_get_period_size(hw, &g_period_size, NULL);
+    g_can_pause = snd_pcm_hw_params_can_pause(hw);
+
+    /* Software parameters: playback is started explicitly (see
+       alsa_maybe_start()) */
+    snd_pcm_sw_params_alloca(&sw);
+    if ((err = snd_pcm_sw_params_current(g_pcm, sw)) < 0)
+        g_error("Can't get ALSA software parameters: %s", snd_strerror(err));
+    snd_pcm_sw_params_set_start_threshold(g_pcm, sw, g_buffer_size);
+    snd_pcm_sw_params_set_avail_min(g_pcm, sw, g_period_size);
+    if ((err = snd_pcm_sw_params(g_pcm, sw)) < 0)
+        g_error("Can't set ALSA software parameters: %s", snd_strerror(err));
+
+    g_alsa_format = *format;
+    g_frame_size = sizeof(int16_t) * format->channels;
+
+    g_debug("ALSA: buffer: %lu frames, period: %lu frames, %s pause",
+            (unsigned long) g_buffer_size, (unsigned long) g_period_size,
+            g_can_pause ? "hardware" : "no");
+}
+
+/* Recover from an error returned by the PCM. An underrun at the end of a track
+   is expected and is not counted as a stutter. Returns a negative value if the
+   PCM could not be recovered. */
+static int alsa_recover(int err) {
+    if (err == -EPIPE) {
+        if (!g_draining) {
+            g_atomic_int_inc(&g_stutters);
+            g_underruns += 1;
+        }
+        g_draining = FALSE;
+    }
+
+    err = snd_pcm_recover(g_pcm, err, 1);
+    if (err < 0)
+        g_warning("Can't recover from ALSA error: %s", snd_strerror(err));
+    return err;
+}
+
+/* Start playing once half of the ring buffer is filled, or as soon as there is
+   something to play when draining */
+static void alsa_maybe_start() {
+    snd_pcm_sframes_t avail;
+    snd_pcm_uframes_t filled;
+
+    if (snd_pcm_state(g_pcm) != SND_PCM_STATE_PREPARED)
+        return;
+
+    avail = snd_pcm_avail_update(g_pcm);
+    if (avail < 0)
+        return;
+    filled = g_buffer_size - avail;
+    if ((filled > 0) && (g_draining || (filled >= g_buffer_size / 2)))
+        snd_pcm_start(g_pcm);
+}
+
+/* Number of frames in the ring buffer that have not been played yet */
+static int alsa_delay() {
+    snd_pcm_sframes_t delay;
+
+    if (!g_pcm)
+        return 0;
+    if (snd_pcm_state(g_pcm) == SND_PCM_STATE_XRUN)
+        return 0;
+    if (snd_pcm_delay(g_pcm, &delay) < 0)
+        return 0;
+    return MAX(delay, 0);
+}
+
+/* "Public" functions, called from the core (see audio.h) */
+G_MODULE_EXPORT void audio_open(const sp_audioformat* format) {
+    g_mutex_lock(&g_alsa_mutex);
+
+    if (g_pcm && ((g_alsa_format.sample_rate != format->sample_rate) ||
+                  (g_alsa_format.channels != format->channels)))
+        alsa_close();
+    if (!g_pcm) {
+        alsa_open();
+        alsa_setup(format);
+    }
+    g_paused = FALSE;
+
+    g_mutex_unlock(&g_alsa_mutex);
+}
+
+G_MODULE_EXPORT int audio_write(const void* frames, int num_frames) {
+    const guint8* src = frames;
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t offset, nb;
+    snd_pcm_sframes_t avail, ret;
+    int written = 0;
+
+    g_mutex_lock(&g_alsa_mutex);
+
+    if (!g_pcm || g_paused) {
+        g_mutex_unlock(&g_alsa_mutex);
+        return 0;
+    }
+    g_draining = FALSE;
+
+    while (written < num_frames) {
+        avail = snd_pcm_avail_update(g_pcm);
+        if (avail < 0) {
+            if (alsa_recover(avail) < 0)
+                break;
+            continue;
+        }
+        if (avail == 0)
+            break;
+
+        /* Get a pointer into the ring buffer, which may be less than what is
+           available if it wraps around */
+        nb = MIN((snd_pcm_uframes_t) avail, (snd_pcm_uframes_t) (num_frames - written));
+        ret = snd_pcm_mmap_begin(g_pcm, &areas, &offset, &nb);
+        if (ret < 0) {
+            if (alsa_recover(ret) < 0)
+                break;
+            continue;
+        }
+
+        /* Interleaved access: all the channels share the first area */
+        memcpy((guint8*) areas[0].addr + (areas[0].first + offset * areas[0].step) / 8,
+               src + written * g_frame_size, nb * g_frame_size);
+
+        ret = snd_pcm_mmap_commit(g_pcm, offset, nb);
+        if ((ret >= 0) && ((snd_pcm_uframes_t) ret != nb))
+            ret = -EPIPE;
+        if (ret < 0) {
+            if (alsa_recover(ret) < 0)
+                break;
+            continue;
+        }
+        written += nb;
+    }
+
+    alsa_maybe_start();
+    g_mutex_unlock(&g_alsa_mutex);
+
+    return written;
+}
+
+G_MODULE_EXPORT void audio_pause(void) {
+    g_mutex_lock(&g_alsa_mutex);
+    if (g_pcm && !g_paused) {
+        if (g_can_pause && (snd_pcm_state(g_pcm) == SND_PCM_STATE_RUNNING))
+            snd_pcm_pause(g_pcm, 1);
+        else if (!g_can_pause) {
+            /* Better lose the buffered frames than keep on playing */
+            snd_pcm_drop(g_pcm);
+            snd_pcm_prepare(g_pcm);
+        }
+        g_paused = TRUE;
+    }
+    g_mutex_unlock(&g_alsa_mutex);
+}
+
+G_MODULE_EXPORT void audio_resume(void) {
+    g_mutex_lock(&g_alsa_mutex);
+    if (g_pcm && g_paused) {
+        if (snd_pcm_state(g_pcm) == SND_PCM_STATE_PAUSED)
+            snd_pcm_pause(g_pcm, 0);
+        g_paused = FALSE;
+    }
+    g_mutex_unlock(&g_alsa_mutex);
+}
+
+G_MODULE_EXPORT void audio_flush(void) {
+    g_mutex_lock(&g_alsa_mutex);
+    if (g_pcm) {
+        snd_pcm_drop(g_pcm);
+        snd_pcm_prepare(g_pcm);
+        g_draining = FALSE;
+    }
+    g_mutex_unlock(&g_alsa_mutex);
+}
+
+G_MODULE_EXPORT void audio_drain(void) {
+    /* Don't use snd_pcm_drain(): it blocks, and stops the PCM, while the next
+       track may follow right away */
+    g_mutex_lock(&g_alsa_mutex);
+    if (g_pcm) {
+        g_draining = TRUE;
+        alsa_maybe_start();
+    }
+    g_mutex_unlock(&g_alsa_mutex);
+}
+
+G_MODULE_EXPORT int audio_latency(void) {
+    int delay;
+
+    g_mutex_lock(&g_alsa_mutex);
+    delay = alsa_delay();
+    g_mutex_unlock(&g_alsa_mutex);
+
+    return delay;
+}
+
+G_MODULE_EXPORT void audio_close(void) {
+    g_mutex_lock(&g_alsa_mutex);
+    if (g_pcm)
+        alsa_close();
+    g_paused = FALSE;
+    g_draining = FALSE;
+    g_mutex_unlock(&g_alsa_mutex);
+}
+
+/* "Public" function, called from a libspotify callback */
+G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    g_mutex_lock(&g_alsa_mutex);
+    stats->samples = alsa_delay();
+    g_mutex_unlock(&g_alsa_mutex);
+    stats->stutter = g_atomic_int_and(&g_stutters, 0);
+
+    if (stats->stutter > 0)
+        g_debug("alsa stats: samples: %d; stutter: %d (%u underruns so far)",
+                stats->samples, stats->stutter, g_underruns);
+}
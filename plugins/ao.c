@@ -33,28 +33,17 @@
 
 #include "spop.h"
 #include "audio.h"
+#include "audio_buffer.h"
 
 #define BUFSIZE  8192
-#define BUFNB    16
-
-typedef struct {
-    size_t size;
-    char* buf;
-} lao_buf;
 
 static gboolean g_ao_init = FALSE;
 static int g_ao_driver = -1;
 static ao_device* g_ao_dev = NULL;
 static ao_option* g_ao_options = NULL;
-static size_t g_ao_frame_size;
-
-static gboolean g_playing = FALSE;
-static int g_stutters = 0;
+static sp_audioformat g_ao_format;
 
-static GQueue* g_free_bufs = NULL;
-static GQueue* g_full_bufs = NULL;
-static GMutex g_buf_mutex;
-static GCond g_play_cond;
+static audio_buffer* g_buf = NULL;
 
 /* Prototypes for private functions */
 static void lao_setup(const sp_audioformat* format);
@@ -78,43 +67,38 @@ static const char* lao_strerror(void) {
     }
 }
 
-/* Audio player thread */
+/* Audio player thread. The libao device is only used from here. */
 static void* lao_player(gpointer data) {
-    while (!g_ao_dev) {
-        /* Device not ready: wait */
-        usleep(10000);
-    }
-
-    g_mutex_lock(&g_buf_mutex);
-
     while (TRUE) {
-        lao_buf* buf = g_queue_pop_head(g_full_bufs);
-
-        if (buf) {
-            /* There is something to play */
-            g_mutex_unlock(&g_buf_mutex);
+        gpointer ptr;
+        gsize size = audio_buffer_peek(g_buf, &ptr, BUFSIZE);
+
+        if (size > 0) {
+            /* There is something to play: (re)open the device if needed... */
+            if (g_ao_dev &&
+                ((g_ao_format.sample_rate != g_buf->format.sample_rate) ||
+                 (g_ao_format.channels != g_buf->format.channels)))
+                lao_close();
+            if (!g_ao_dev)
+                lao_setup(&g_buf->format);
 
-            if (!ao_play(g_ao_dev, buf->buf, buf->size))
+            /* ...and send it to libao straight from the buffer */
+            if (!ao_play(g_ao_dev, ptr, size))
                 g_error("Error while playing sound with libao");
-
-            g_mutex_lock(&g_buf_mutex);
-            g_queue_push_tail(g_free_bufs, buf);
+            audio_buffer_consume(g_buf, size);
         }
         else {
-            /* Nothing to play */
-            if (g_playing)
-                g_stutters += 1;
-
-            /* Wait for new data to be available. If nothing happens in a few
-               seconds, playback may have stopped for good. In that case it
-               makes sense to close the device. */
+            /* Nothing to play: wait for new data to be available. If nothing
+               happens in a few seconds (and playback is not just paused),
+               playback may have stopped for good. In that case it makes sense
+               to close the device. */
             gint64 wait_end = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
-            if (!g_cond_wait_until(&g_play_cond, &g_buf_mutex, wait_end)) {
+            if (!audio_buffer_wait(g_buf, wait_end) && !audio_buffer_paused(g_buf)) {
                 /* Timeout: better reset the device */
                 lao_close();
 
                 /* Now wait until we're ready to play again */
-                g_cond_wait(&g_play_cond, &g_buf_mutex);
+                audio_buffer_wait(g_buf, -1);
             }
         }
     }
@@ -126,52 +110,18 @@ static void* lao_player(gpointer data) {
 static void lao_setup(const sp_audioformat* format) {
     ao_sample_format lao_fmt;
 
-    if (!g_ao_init) {
-        GError* err = NULL;
-        lao_buf* bufs = NULL;
-        int i;
-
-        ao_initialize();
-        g_ao_driver = ao_default_driver_id();
-        ao_append_option(&g_ao_options, "client_name", "spop " SPOP_VERSION);
-
-        g_free_bufs = g_queue_new();
-        if (!g_free_bufs)
-            g_error("Can't allocate a queue of free buffers");
-        g_full_bufs = g_queue_new();
-        if (!g_full_bufs)
-            g_error("Can't allocate a queue of full buffers");
-
-        bufs = (lao_buf*) malloc(BUFNB*sizeof(lao_buf));
-        if (!bufs)
-            g_error("Can't allocate buffer structures");
-        for (i=0; i < BUFNB; i++) {
-            bufs[i].buf = malloc(BUFSIZE);
-            if (!(bufs[i].buf))
-                g_error("Can't allocate buffer");
-            g_queue_push_tail(g_free_bufs, &(bufs[i]));
-        }
-
-        if (!g_thread_try_new("ao_player", lao_player, NULL, &err))
-            g_error("Error while creating libao player thread: %s", err->message);
-        g_ao_init = TRUE;
-    }
-
     /* Set up sample format */
-    if (format->sample_type != SP_SAMPLETYPE_INT16_NATIVE_ENDIAN)
-        g_error("Unsupported sample type");
-
     lao_fmt.bits = 16;
     lao_fmt.rate = format->sample_rate;
     lao_fmt.channels = format->channels;
     lao_fmt.byte_format = AO_FMT_NATIVE;
     lao_fmt.matrix = NULL;
-    g_ao_frame_size = sizeof(int16_t) * format->channels;
 
     /* Open the device */
     g_ao_dev = ao_open_live(g_ao_driver, &lao_fmt, g_ao_options);
     if (!g_ao_dev)
         g_error("Error while opening libao device: %s", lao_strerror());
+    g_ao_format = *format;
 }
 
 /* "Private" function, used to shut down the libao device */
@@ -182,74 +132,63 @@ static void lao_close() {
     }
 }
 
-/* "Public" function, called from a libspotify callback */
-G_MODULE_EXPORT int audio_delivery(const sp_audioformat* format, const void* frames, int num_frames) {
-    lao_buf* buf;
-    size_t size;
-
-    /* What are we supposed to do here? */
-    if (num_frames == 0) {
-        /* Pause: flush the queue */
-        g_mutex_lock(&g_buf_mutex);
-        g_playing = FALSE;
-        while (g_queue_get_length(g_full_bufs) > 0) {
-            buf = g_queue_pop_tail(g_full_bufs);
-            g_queue_push_tail(g_free_bufs, buf);
-        }
-        g_mutex_unlock(&g_buf_mutex);
-        return 0;
-    }
-    else {
-        if (!g_ao_dev)
-            lao_setup(format);
-
-        /* Try to add data to the queue */
-        g_mutex_lock(&g_buf_mutex);
-        g_playing = TRUE;
-
-        if (g_queue_get_length(g_free_bufs) == 0) {
-            /* Can't add anything */
-            g_mutex_unlock(&g_buf_mutex);
-            return 0;
-        }
-
-        /* Copy data to a free buffer */
-        buf = g_queue_pop_head(g_free_bufs);
-        size = BUFSIZE < (num_frames * g_ao_frame_size) ? BUFSIZE : (num_frames * g_ao_frame_size);
-        memcpy(buf->buf, frames, size);
-        buf->size = size;
+/* "Public" functions, called from the core (see audio.h) */
+G_MODULE_EXPORT void audio_open(const sp_audioformat* format) {
+    if (!g_ao_init) {
+        GError* err = NULL;
 
-        /* Make the buffer available to the player */
-        g_queue_push_tail(g_full_bufs, buf);
-        g_cond_signal(&g_play_cond);
+        ao_initialize();
+        g_ao_driver = ao_default_driver_id();
+        ao_append_option(&g_ao_options, "client_name", "spop " SPOP_VERSION);
 
-        g_mutex_unlock(&g_buf_mutex);
+        g_buf = audio_buffer_new("ao");
 
-        return size / g_ao_frame_size;
+        if (!g_thread_try_new("ao_player", lao_player, NULL, &err))
+            g_error("Error while creating libao player thread: %s", err->message);
+        g_ao_init = TRUE;
     }
+
+    if (format->sample_type != SP_SAMPLETYPE_INT16_NATIVE_ENDIAN)
+        g_error("Unsupported sample type");
+    audio_buffer_set_format(g_buf, format);
 }
 
-/* Increment stats->samples by the number of frames in a buffer */
-static void _compute_samples_in_buffer(lao_buf* buf, int* samples) {
-    if (buf) {
-        *samples += buf->size / g_ao_frame_size;
-    }
+G_MODULE_EXPORT int audio_write(const void* frames, int num_frames) {
+    return audio_buffer_write(g_buf, frames, num_frames);
 }
 
-/* "Public" function, called from a libspotify callback */
-G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
-    g_mutex_lock(&g_buf_mutex);
+G_MODULE_EXPORT void audio_pause(void) {
+    if (g_buf)
+        audio_buffer_pause(g_buf);
+}
 
-    /* Compute the number of samples in each buffer */
-    stats->samples = 0;
-    if (g_full_bufs)
-        g_queue_foreach(g_full_bufs, (GFunc) _compute_samples_in_buffer, &(stats->samples));
+G_MODULE_EXPORT void audio_resume(void) {
+    if (g_buf)
+        audio_buffer_resume(g_buf);
+}
 
-    stats->stutter = g_stutters;
-    g_stutters = 0;
+G_MODULE_EXPORT void audio_flush(void) {
+    if (g_buf)
+        audio_buffer_flush(g_buf);
+}
 
-    if (stats->stutter > 0)
-        g_debug("ao stats: samples: %d; stutter: %d", stats->samples, stats->stutter);
+G_MODULE_EXPORT void audio_drain(void) {
+    if (g_buf)
+        audio_buffer_drain(g_buf);
+}
 
-    g_mutex_unlock(&g_buf_mutex);
+G_MODULE_EXPORT int audio_latency(void) {
+    return audio_buffer_frames(g_buf);
+}
+
+G_MODULE_EXPORT void audio_close(void) {
+    /* The player thread will close the device if nothing else is played in a
+       few seconds */
+    audio_resume();
+    audio_flush();
+}
+
+/* "Public" function, called from a libspotify callback */
+G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    audio_buffer_stats(g_buf, stats);
 }
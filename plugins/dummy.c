@@ -23,12 +23,171 @@
  * Program grant you additional permission to convey the resulting work.
  */
 
+#include <glib.h>
 #include <gmodule.h>
 
 #include "audio.h"
+#include "audio_buffer.h"
 #include "config.h"
 
+/* A virtual output device: frames are consumed at the sample rate, against the
+   monotonic clock, and thrown away. This makes it possible to reproduce the
+   real-time behaviour of the other plugins (buffering, underruns...) without a
+   sound card. Jitter, underruns and latency can be injected (see the [dummy]
+   section of the configuration file). */
+static audio_buffer* g_buf = NULL;
+static GThread* g_player_thread = NULL;
+
+static guint g_period_ms;
+static guint g_jitter_ms;
+static guint g_underrun_interval;
+static guint g_underrun_ms;
+static guint g_latency_ms;
+
+/* "Private" function: log what was consumed during the last second */
+static void dummy_report(gint64 elapsed, guint64 frames, guint underruns) {
+    int rate = g_buf->format.sample_rate;
+
+    if ((frames == 0) && (underruns == 0))
+        return;
+    g_debug("dummy: %" G_GUINT64_FORMAT " frames in %" G_GINT64_FORMAT " ms (%.1f%% of real time), "
+            "%d buffered, %u underruns",
+            frames, elapsed / G_TIME_SPAN_MILLISECOND,
+            rate > 0 ? (100.0 * frames * G_TIME_SPAN_SECOND) / ((gdouble) rate * elapsed) : 0.0,
+            audio_buffer_frames(g_buf), underruns);
+}
+
+/* Player thread: consume one period of audio at a time */
+static gpointer dummy_player(gpointer data) {
+    gint64 now, next, last_report, next_underrun = -1;
+    guint64 frames = 0;
+    guint underruns = 0;
+    gpointer ptr;
+    gsize size, want, got;
+
+    next = last_report = g_get_monotonic_time();
+
+    while (TRUE) {
+        want = (gsize) g_buf->format.sample_rate * g_period_ms / 1000 * g_buf->frame_size;
+        got = 0;
+        while (got < want) {
+            size = audio_buffer_peek(g_buf, &ptr, want - got);
+            if (size == 0)
+                break;
+            audio_buffer_consume(g_buf, size);
+            got += size;
+        }
+
+        now = g_get_monotonic_time();
+        if (now - last_report >= G_TIME_SPAN_SECOND) {
+            dummy_report(now - last_report, frames, g_buf->underruns - underruns);
+            frames = 0;
+            underruns = g_buf->underruns;
+            last_report = now;
+        }
+
+        if (got == 0) {
+            /* Nothing to play: wait for more, and restart the clock from
+               there */
+            audio_buffer_wait(g_buf, now + G_TIME_SPAN_SECOND);
+            next = g_get_monotonic_time();
+            continue;
+        }
+        frames += got / g_buf->frame_size;
+
+        /* Injected underrun: the device stalls for a while, then restarts
+           without catching up, just like a real one */
+        if (g_underrun_interval > 0) {
+            if (next_underrun < 0)
+                next_underrun = now + g_underrun_interval * G_TIME_SPAN_SECOND;
+            else if (now >= next_underrun) {
+                g_usleep(g_underrun_ms * G_TIME_SPAN_MILLISECOND);
+                g_atomic_int_inc(&g_buf->stutters);
+                g_buf->underruns += 1;
+                next = now = g_get_monotonic_time();
+                next_underrun = now + g_underrun_interval * G_TIME_SPAN_SECOND;
+            }
+        }
+
+        /* Wait for the end of this period, plus some jitter. The jitter does
+           not accumulate: the next period is still computed from the ideal
+           clock. */
+        next += g_period_ms * G_TIME_SPAN_MILLISECOND;
+        now = next;
+        if (g_jitter_ms > 0)
+            now += g_random_int_range(0, g_jitter_ms * G_TIME_SPAN_MILLISECOND);
+        now -= g_get_monotonic_time();
+        if (now > 0)
+            g_usleep(now);
+    }
+
+    return NULL;
+}
+
+/* "Public" functions, called from the core (see audio.h) */
+G_MODULE_EXPORT void audio_open(const sp_audioformat* format) {
+    GError* err = NULL;
+
+    if (!g_buf) {
+        g_period_ms = config_get_int_opt_group("dummy", "period", 10);
+        g_jitter_ms = config_get_int_opt_group("dummy", "jitter", 0);
+        g_underrun_interval = config_get_int_opt_group("dummy", "underrun_interval", 0);
+        g_underrun_ms = config_get_int_opt_group("dummy", "underrun_length", 100);
+        g_latency_ms = config_get_int_opt_group("dummy", "latency", 0);
+        if (g_period_ms == 0)
+            g_period_ms = 1;
+
+        g_buf = audio_buffer_new("dummy");
+        g_player_thread = g_thread_try_new("dummy_player", dummy_player, NULL, &err);
+        if (!g_player_thread)
+            g_error("Error while creating dummy player thread: %s", err->message);
+    }
+
+    audio_buffer_set_format(g_buf, format);
+}
+
+G_MODULE_EXPORT int audio_write(const void* frames, int num_frames) {
+    return audio_buffer_write(g_buf, frames, num_frames);
+}
+
+G_MODULE_EXPORT void audio_pause(void) {
+    if (g_buf)
+        audio_buffer_pause(g_buf);
+}
+
+G_MODULE_EXPORT void audio_resume(void) {
+    if (g_buf)
+        audio_buffer_resume(g_buf);
+}
+
+G_MODULE_EXPORT void audio_flush(void) {
+    if (g_buf)
+        audio_buffer_flush(g_buf);
+}
+
+G_MODULE_EXPORT void audio_drain(void) {
+    if (g_buf)
+        audio_buffer_drain(g_buf);
+}
+
+/* "Private" function: injected latency, only while something is playing */
+static int dummy_delay() {
+    if (!g_buf || !g_atomic_int_get(&g_buf->playing))
+        return 0;
+    return (guint64) g_buf->format.sample_rate * g_latency_ms / 1000;
+}
+
+G_MODULE_EXPORT int audio_latency(void) {
+    return audio_buffer_frames(g_buf) + dummy_delay();
+}
+
+G_MODULE_EXPORT void audio_close(void) {
+    audio_resume();
+    audio_flush();
+}
+
 /* "Public" function, called from a libspotify callback */
-G_MODULE_EXPORT int audio_delivery(const sp_audioformat* format, const void* frames, int num_frames) {
-    return num_frames;
+G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    audio_buffer_stats(g_buf, stats);
+    stats->samples += dummy_delay();
 }
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+/* Parametric equalizer filter: a cascade of biquads (see the [eq] section of
+ * spopd.conf.sample) */
+
+#include <glib.h>
+#include <gmodule.h>
+#include <math.h>
+#include <string.h>
+
+#include "spop.h"
+#include "config.h"
+#include "dsp.h"
+#include "filter.h"
+
+typedef enum {
+    EQ_PEAK,
+    EQ_LOWSHELF,
+    EQ_HIGHSHELF,
+} eq_type;
+
+typedef struct {
+    eq_type type;
+    double  freq;               /* In Hz */
+    double  gain;               /* In dB */
+    double  q;
+} eq_band;
+
+static gboolean g_eq_ready = FALSE;
+static eq_band g_eq_bands[DSP_MAX_BIQUADS];
+static int g_eq_nb_bands = 0;
+static double g_eq_preamp = 1.;
+
+/* Filter for the current format */
+static dsp_biquad g_eq_sections[DSP_MAX_BIQUADS];
+static int g_eq_nb_sections = 0;
+static int g_eq_channels = 0;
+static double* g_eq_state = NULL;
+
+/* "Private" functions */
+static gboolean _eq_parse_double(const gchar* str, double* value) {
+    gchar* end;
+
+    *value = g_ascii_strtod(str, &end);
+    return (end != str) && (*end == '\0');
+}
+
+/* A band is "type:frequency:gain:q" */
+static void _eq_parse_band(gchar* str) {
+    gchar** fields;
+    eq_band band;
+
+    g_strstrip(str);
+    if (*str == '\0')
+        return;
+    if (g_eq_nb_bands >= DSP_MAX_BIQUADS)
+        g_error("eq: too many bands (at most %d)", DSP_MAX_BIQUADS);
+
+    fields = g_strsplit(str, ":", 0);
+    if (g_strv_length(fields) != 4)
+        g_error("eq: invalid band \"%s\" (should be type:frequency:gain:q)", str);
+
+    if (strcmp(fields[0], "peak") == 0)
+        band.type = EQ_PEAK;
+    else if (strcmp(fields[0], "lowshelf") == 0)
+        band.type = EQ_LOWSHELF;
+    else if (strcmp(fields[0], "highshelf") == 0)
+        band.type = EQ_HIGHSHELF;
+    else
+        g_error("eq: unknown band type \"%s\"", fields[0]);
+
+    if (!_eq_parse_double(fields[1], &band.freq) || (band.freq <= 0) ||
+        !_eq_parse_double(fields[2], &band.gain) ||
+        !_eq_parse_double(fields[3], &band.q) || (band.q <= 0))
+        g_error("eq: invalid band \"%s\"", str);
+
+    g_strfreev(fields);
+    g_eq_bands[g_eq_nb_bands++] = band;
+}
+
+static void _eq_read_config() {
+    gchar** bands;
+    gsize bands_size;
+    gchar* preamp;
+    double db;
+    int i;
+
+    bands = config_get_string_list_group("eq", "bands", &bands_size);
+    for (i=0; i < bands_size; i++)
+        _eq_parse_band(bands[i]);
+    g_strfreev(bands);
+
+    preamp = config_get_string_opt_group("eq", "preamp", NULL);
+    if (preamp) {
+        if (!_eq_parse_double(g_strstrip(preamp), &db))
+            g_error("eq: invalid preamp \"%s\"", preamp);
+        g_eq_preamp = pow(10., db / 20.);
+        g_free(preamp);
+    }
+
+    g_debug("eq: %d band(s), preamp %.2f", g_eq_nb_bands, g_eq_preamp);
+    g_eq_ready = TRUE;
+}
+
+/* Coefficients from the "Audio EQ Cookbook" by Robert Bristow-Johnson */
+static void _eq_make_section(const eq_band* band, int rate, dsp_biquad* s) {
+    double a = pow(10., band->gain / 40.);
+    double w0 = 2. * G_PI * band->freq / rate;
+    double cw = cos(w0);
+    double alpha = sin(w0) / (2. * band->q);
+    double sa = 2. * sqrt(a) * alpha;
+    double a0;
+
+    switch (band->type) {
+    case EQ_PEAK:
+        s->b0 = 1. + alpha * a;
+        s->b1 = -2. * cw;
+        s->b2 = 1. - alpha * a;
+        a0    = 1. + alpha / a;
+        s->a1 = -2. * cw;
+        s->a2 = 1. - alpha / a;
+        break;
+    case EQ_LOWSHELF:
+        s->b0 = a * ((a + 1.) - (a - 1.) * cw + sa);
+        s->b1 = 2. * a * ((a - 1.) - (a + 1.) * cw);
+        s->b2 = a * ((a + 1.) - (a - 1.) * cw - sa);
+        a0    = (a + 1.) + (a - 1.) * cw + sa;
+        s->a1 = -2. * ((a - 1.) + (a + 1.) * cw);
+        s->a2 = (a + 1.) + (a - 1.) * cw - sa;
+        break;
+    case EQ_HIGHSHELF:
+    default:
+        s->b0 = a * ((a + 1.) + (a - 1.) * cw + sa);
+        s->b1 = -2. * a * ((a - 1.) + (a + 1.) * cw);
+        s->b2 = a * ((a + 1.) + (a - 1.) * cw - sa);
+        a0    = (a + 1.) - (a - 1.) * cw + sa;
+        s->a1 = 2. * ((a - 1.) - (a + 1.) * cw);
+        s->a2 = (a + 1.) - (a - 1.) * cw - sa;
+        break;
+    }
+
+    s->b0 /= a0;
+    s->b1 /= a0;
+    s->b2 /= a0;
+    s->a1 /= a0;
+    s->a2 /= a0;
+}
+
+/* "Public" functions: filter plugin API */
+G_MODULE_EXPORT void filter_open(const sp_audioformat* format) {
+    int i;
+
+    if (!g_eq_ready)
+        _eq_read_config();
+
+    g_eq_nb_sections = 0;
+    for (i=0; i < g_eq_nb_bands; i++) {
+        if (g_eq_bands[i].freq >= format->sample_rate / 2.) {
+            g_warning("eq: ignoring the %.0f Hz band at %d Hz", g_eq_bands[i].freq, format->sample_rate);
+            continue;
+        }
+        _eq_make_section(&g_eq_bands[i], format->sample_rate, &g_eq_sections[g_eq_nb_sections++]);
+    }
+
+    /* The preamp goes into the first section (or into a section of its own) */
+    if (g_eq_preamp != 1.) {
+        if (g_eq_nb_sections == 0) {
+            memset(&g_eq_sections[0], 0, sizeof(dsp_biquad));
+            g_eq_sections[0].b0 = 1.;
+            g_eq_nb_sections = 1;
+        }
+        g_eq_sections[0].b0 *= g_eq_preamp;
+        g_eq_sections[0].b1 *= g_eq_preamp;
+        g_eq_sections[0].b2 *= g_eq_preamp;
+    }
+
+    g_eq_channels = format->channels;
+    g_free(g_eq_state);
+    g_eq_state = g_new0(double, 2 * DSP_MAX_BIQUADS * g_eq_channels);
+}
+
+G_MODULE_EXPORT void filter_process(int16_t* frames, int num_frames) {
+    if (g_eq_nb_sections > 0)
+        dsp_biquad_s16(frames, num_frames, g_eq_channels, g_eq_sections, g_eq_nb_sections, g_eq_state);
+}
+
+G_MODULE_EXPORT void filter_reset(void) {
+    if (g_eq_state)
+        memset(g_eq_state, 0, 2 * DSP_MAX_BIQUADS * g_eq_channels * sizeof(double));
+}
@@ -4,6 +4,7 @@
 
 #include "spop.h"
 #include "interface.h"
+#include "output.h"
 #include "queue.h"
 #include "spotify.h"
 
@@ -167,7 +168,7 @@ Mpris2Player* spop_mpris2_player_skeleton_new() {
     mpris2_player_set_minimum_rate(obj, 1.0);
     mpris2_player_set_maximum_rate(obj, 1.0);
     mpris2_player_set_rate(obj, 1.0);
-    mpris2_player_set_volume(obj, 1.0);
+    mpris2_player_set_volume(obj, output_get_volume() / 100.);
     mpris2_player_set_can_control(obj, TRUE);
     mpris2_player_set_can_go_next(obj, TRUE);
     mpris2_player_set_can_go_previous(obj, TRUE);
@@ -318,6 +319,7 @@ void spop_mpris2_player_update_properties(Mpris2Player* obj) {
     /* Easy ones first */
     mpris2_player_set_shuffle(obj,     queue_get_shuffle());
     mpris2_player_set_loop_status(obj, queue_get_repeat() ? "Playlist" : "None");
+    mpris2_player_set_volume(obj, output_get_volume() / 100.);
     mpris2_player_set_playback_status(obj, ((qs == PLAYING) ? "Playing" : ((qs == PAUSED) ? "Paused" : "Stopped")));
     mpris2_player_set_can_go_next(obj,     (cur_track_nb < tot_tracks));
     mpris2_player_set_can_go_previous(obj, (cur_track_nb > 0));
@@ -336,7 +338,7 @@ void spop_mpris2_player_update_properties(Mpris2Player* obj) {
 }
 
 gboolean spop_mpris2_player_update_position(Mpris2Player* obj) {
-    guint64 pos = session_play_time() * 1000;
+    guint64 pos = session_played_time();
     guint64 prev_pos = mpris2_player_get_position(obj);
     mpris2_player_set_position(obj, pos);
     if (ABS(pos - prev_pos) >= 1000000) {
@@ -376,8 +378,15 @@ void on_spop_mpris2_player_set_shuffle(Mpris2Player* obj, GParamSpec* pspec, gpo
 }
 void on_spop_mpris2_player_set_volume(Mpris2Player* obj, GParamSpec* pspec, gpointer user_data) {
     gdouble vol = mpris2_player_get_volume(obj);
-    if (vol != 1.0)
-        mpris2_player_set_volume(obj, 1.0);
+    int new_vol = (int) (CLAMP(vol, 0.0, 1.0) * 100 + 0.5);
+    if (new_vol != output_get_volume()) {
+        output_set_volume(new_vol);
+        queue_notify();
+    }
+    else if (vol != new_vol / 100.) {
+        /* Invalid or too precise: reset to current value */
+        mpris2_player_set_volume(obj, new_vol / 100.);
+    }
 }
 /* }}} */
 /* {{{ org.mpris.MediaPlayer2.TrackList methods implementation */
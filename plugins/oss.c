@@ -27,7 +27,6 @@
 #include <fcntl.h>
 #include <glib.h>
 #include <gmodule.h>
-#include <poll.h>
 #include <sys/soundcard.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,12 +36,23 @@
 #include <unistd.h>
 
 #include "audio.h"
+#include "audio_buffer.h"
 #include "config.h"
 
-static int g_oss_fd = -1;
-static struct pollfd g_pfd;
-static size_t g_oss_frame_size;
-static GMutex g_oss_mutex;
+#define BUFSIZE 8192
+
+/* How long the device stays open when there is nothing to play */
+#define IDLE_TIMEOUT (5 * G_TIME_SPAN_SECOND)
+
+static gint g_oss_fd = -1;
+static sp_audioformat g_oss_format;
+
+/* Set by audio_flush() once the device has been reset: the player thread may
+   still be writing frames from before the flush */
+static gint g_oss_flushed = FALSE;
+
+static audio_buffer* g_buf = NULL;
+static GThread* g_player_thread = NULL;
 
 /* "Private" functions, used to set up the OSS device */
 static void oss_open() {
@@ -52,20 +62,40 @@ static void oss_open() {
 
     /* Open the device */
     g_debug("Opening OSS device");
-    g_oss_fd = open(oss_dev, O_WRONLY);
+    g_atomic_int_set(&g_oss_fd, open(oss_dev, O_WRONLY));
     if (g_oss_fd == -1)
         g_error("Can't open OSS device: %s", g_strerror(errno));
-
-    /* Populate the pollfd struct used by poll() */
-    g_pfd.fd = g_oss_fd;
-    g_pfd.events = POLLOUT;
 }
 
 static void oss_close() {
+    int fd = g_oss_fd;
+
     g_debug("Closing OSS device");
-    if (close(g_oss_fd) == -1)
+    g_atomic_int_set(&g_oss_fd, -1);
+    if (close(fd) == -1)
         g_error("Can't close OSS device: %s", g_strerror(errno));
-    g_oss_fd = -1;
+}
+
+/* Ask the device for small fragments, if configured: less audio is queued in
+   the device itself, so pauses and seeks are faster */
+static void oss_setup_fragments() {
+    int size, count, shift, tmp;
+
+    size = config_get_int_opt_group("oss", "fragment_size", 0);
+    count = config_get_int_opt_group("oss", "fragments", 0);
+    if (size <= 0)
+        return;
+
+    /* Size is given as a power of 2, between 16 bytes and 64 KiB */
+    for (shift = 4; (shift < 16) && ((1 << shift) < size); shift++);
+    if (count <= 0)
+        count = 0x7fff;
+
+    tmp = (count << 16) | shift;
+    if (ioctl(g_oss_fd, SNDCTL_DSP_SETFRAGMENT, &tmp) == -1)
+        g_warning("Error setting OSS fragment size: %s", g_strerror(errno));
+    else
+        g_debug("OSS fragments: %d x %d bytes", count, 1 << shift);
 }
 
 /* Set OSS parameters using "format" from libspotify */
@@ -77,7 +107,6 @@ static void oss_setup(const sp_audioformat* format) {
     switch (format->sample_type) {
     case SP_SAMPLETYPE_INT16_NATIVE_ENDIAN:
         sample_type = AFMT_S16_NE;
-        g_oss_frame_size = sizeof(int16_t) * format->channels;
         break;
     default:
         g_error("Unknown sample type");
@@ -87,6 +116,8 @@ static void oss_setup(const sp_audioformat* format) {
        suggested in the OSS doc for some old devices, just in case...
        (http://manuals.opensound.com/developer/callorder.html) */
 
+    oss_setup_fragments();
+
     tmp = format->channels;
     if (ioctl(g_oss_fd, SNDCTL_DSP_CHANNELS, &tmp) == -1)
         g_error("Error setting OSS channels: %s", g_strerror(errno));
@@ -105,42 +136,142 @@ static void oss_setup(const sp_audioformat* format) {
     /* Sample rate: the OSS doc that differences up to 10% should be accepted */
     if (((100*abs(format->sample_rate - tmp))/format->sample_rate) > 10)
         g_error("Could not set OSS sample rate to %d (set to %d instead)", format->sample_rate, tmp);
+
+    g_oss_format = *format;
 }
 
-/* "Public" function, called from a libspotify callback */
-G_MODULE_EXPORT int audio_delivery(const sp_audioformat* format, const void* frames, int num_frames) {
-    int ret;
+/* Player thread: the device is only opened, set up and written to from here,
+   so blocking writes are fine and no lock is needed */
+static gpointer oss_player(gpointer data) {
+    gpointer ptr;
+    gsize size;
+    ssize_t ret;
 
-    g_mutex_lock(&g_oss_mutex);
+    while (TRUE) {
+        size = audio_buffer_peek(g_buf, &ptr, BUFSIZE);
+        if (size == 0) {
+            /* Nothing to play: close the device if this lasts too long, unless
+               playback is paused */
+            if (!audio_buffer_wait(g_buf, g_get_monotonic_time() + IDLE_TIMEOUT) &&
+                (g_oss_fd != -1) && !audio_buffer_paused(g_buf)) {
+                oss_close();
+                audio_buffer_wait(g_buf, -1);
+            }
+            continue;
+        }
 
-    /* What are we supposed to do here? */
-    if (num_frames == 0) {
-        /* Pause: close the device */
-        if (g_oss_fd != -1)
+        /* Some frames to play, but the device is closed or set up for another
+           format: (re)open it and set it up */
+        if ((g_oss_fd != -1) &&
+            ((g_oss_format.sample_rate != g_buf->format.sample_rate) ||
+             (g_oss_format.channels != g_buf->format.channels)))
             oss_close();
-        ret = 0;
-    }
-    else {
         if (g_oss_fd == -1) {
-            /* Some frames to play, but the device is closed: open it and set it up */
             oss_open();
-            oss_setup(format);
+            oss_setup(&g_buf->format);
         }
 
-        /* Is the device ready to be written to? */
-        ret = poll(&g_pfd, 1, 0);
-        if (ret == -1)
-            g_error("Can't poll OSS device: %s", g_strerror(errno));
-        else if (ret != 0) {
-            /* Ok, we can write to the device without blocking */
-            ret = write(g_oss_fd, frames, g_oss_frame_size * num_frames);
-            if (ret == -1)
-                g_error("Can't write to OSS device: %s", g_strerror(errno));
-
-            ret /= g_oss_frame_size;
+        /* Flushed since these frames were peeked: they may be stale */
+        if (g_atomic_int_compare_and_exchange(&g_oss_flushed, TRUE, FALSE))
+            continue;
+
+        ret = write(g_oss_fd, ptr, size);
+
+        /* Flushed while writing: drop what made it to the device after the
+           reset */
+        if (g_atomic_int_compare_and_exchange(&g_oss_flushed, TRUE, FALSE))
+            ioctl(g_oss_fd, SNDCTL_DSP_RESET, NULL);
+
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            g_error("Can't write to OSS device: %s", g_strerror(errno));
         }
+
+        /* The device only accepts whole frames, but be careful anyway */
+        audio_buffer_consume(g_buf, ret - (ret % g_buf->frame_size));
+    }
+
+    return NULL;
+}
+
+/* "Public" functions, called from the core (see audio.h) */
+G_MODULE_EXPORT void audio_open(const sp_audioformat* format) {
+    GError* err = NULL;
+
+    if (!g_buf) {
+        g_buf = audio_buffer_new("oss");
+        g_player_thread = g_thread_try_new("oss_player", oss_player, NULL, &err);
+        if (!g_player_thread)
+            g_error("Error while creating OSS player thread: %s", err->message);
+    }
+
+    audio_buffer_set_format(g_buf, format);
+}
+
+G_MODULE_EXPORT int audio_write(const void* frames, int num_frames) {
+    return audio_buffer_write(g_buf, frames, num_frames);
+}
+
+G_MODULE_EXPORT void audio_pause(void) {
+    /* Keep the device open and the buffered frames until playback is
+       resumed */
+    if (g_buf)
+        audio_buffer_pause(g_buf);
+}
+
+G_MODULE_EXPORT void audio_resume(void) {
+    if (g_buf)
+        audio_buffer_resume(g_buf);
+}
+
+G_MODULE_EXPORT void audio_flush(void) {
+    int fd = g_atomic_int_get(&g_oss_fd);
+
+    if (!g_buf)
+        return;
+    audio_buffer_flush(g_buf);
+
+    /* The device is kept open: drop what it has queued too, or it would still
+       be played */
+    if (fd != -1) {
+        if (ioctl(fd, SNDCTL_DSP_RESET, NULL) == -1)
+            g_debug("Can't reset OSS device: %s", g_strerror(errno));
+        g_atomic_int_set(&g_oss_flushed, TRUE);
     }
+}
+
+G_MODULE_EXPORT void audio_drain(void) {
+    if (g_buf)
+        audio_buffer_drain(g_buf);
+}
+
+/* "Private" function: number of frames written to the device but not played
+   yet */
+static int oss_delay() {
+    int fd = g_atomic_int_get(&g_oss_fd);
+    int delay;
+
+    if ((fd == -1) || !g_buf || (g_buf->frame_size == 0))
+        return 0;
+    if (ioctl(fd, SNDCTL_DSP_GETODELAY, &delay) == -1)
+        return 0;
+    return delay / g_buf->frame_size;
+}
+
+G_MODULE_EXPORT int audio_latency(void) {
+    return audio_buffer_frames(g_buf) + oss_delay();
+}
 
-    g_mutex_unlock(&g_oss_mutex);
-    return ret;
+G_MODULE_EXPORT void audio_close(void) {
+    /* Drop whatever is still buffered; the player thread will close the device
+       once it has been idle for a while */
+    audio_resume();
+    audio_flush();
+}
+
+/* "Public" function, called from a libspotify callback */
+G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    audio_buffer_stats(g_buf, stats);
+    stats->samples += oss_delay();
 }
@@ -30,7 +30,9 @@
 
 #include "spop.h"
 #include "audio.h"
+#include "audio_buffer.h"
 #include "config.h"
+#include "dsp.h"
 
 /* The SoX API is not the most pleasant to use.
  *
@@ -41,54 +43,52 @@
  * (ALSA, OSS or whatever), as requested by the user in the config file, and
  * controlled by SoX.
  *
- * So here the audio_delivery callback initializes SoX, starts audio output
- * (with _sox_start()), fills buffers with data provided by libspotify, and
- * closes audio output with _sox_stop(). _sox_start() opens the SoX output,
- * creates an effects chain using the data in the config file, and starts the
- * player thread. The player thread (_sox_player()) calls sox_flow_effects() to
- * run the effects chain from input to output, hence calling the
- * _sox_input_drain() callback as needed, and then makes some cleanup (close
- * effects chain and output). The _sox_input_drain() callback actually decodes
- * frames provided by libspotify into SoX samples, and feeds the rest of libsox
- * with these samples so that other effects can be applied.
+ * So here audio_open() initializes SoX and starts audio output (with
+ * _sox_start()), and audio_write() fills the buffer with data provided by
+ * libspotify. _sox_start() opens the SoX output, creates an effects chain using
+ * the effects parsed from the config file, and starts the player thread. The
+ * player thread (_sox_player()) calls sox_flow_effects() to run the effects
+ * chain from input to output, hence calling the _sox_input_drain() callback as
+ * needed, and then makes some cleanup (close effects chain and output). The
+ * _sox_input_drain() callback actually decodes frames provided by libspotify
+ * into SoX samples, and feeds the rest of libsox with these samples so that
+ * other effects can be applied.
+ *
+ * Building the chain is slow, so it is kept running as long as possible:
+ * seeking and stopping only flush the buffer, and pausing only parks the player
+ * thread (the buffered frames are kept for when playback is resumed). It is
+ * only torn down by the player thread itself, when the format changes (once all
+ * the frames in the previous format have been played) or when nothing was
+ * played for idle_timeout seconds; the next audio_write() then starts it again.
  *
  * One problem remains: because of how SoX works, there can be audio output
  * *after* playback is stopped (echo, reverb, etc.). So to be able to precisely
- * control *when* the output end, we have to add another effect at the end of
- * the effects chain: that's _sox_output_flow() (and it sucks).
- *
- * Because of effects, stopping playback can take a little while. This is
- * probably not a desired behaviour.
+ * control *when* the output ends, sox_flow_effects() is given a callback
+ * (_sox_flow_callback()) that checks the stop flag after each block and aborts
+ * the flow if needed.
  */
 
-#define BUFSIZE 8192
-#define BUFNB   8
+/* Buffer */
+static audio_buffer* g_buf = NULL;
 
-/* Buffers */
-typedef struct {
-    size_t   size;
-    gpointer buf;
-} sox_buf;
-static GQueue* g_free_bufs = NULL;
-static GQueue* g_full_bufs = NULL;
-static GMutex  g_buf_mutex;
-static GCond   g_buf_cond;
-
-/* Player thread control */
-static GThread* g_player_thread = NULL;
-static gboolean g_player_stop   = FALSE;
-static int g_stutters = 0;
+/* Player thread control. _sox_start() and _sox_stop() are called from
+   libspotify's thread and from the main loop, so they are serialized by the
+   mutex. */
+static GMutex   g_player_mutex;
+static GThread* g_player_thread  = NULL;
+static gint     g_player_running = FALSE;
+static gint     g_player_stop    = FALSE;
 
 /* SoX settings */
 static gboolean     g_sox_init     = FALSE;
 static const gchar* g_sox_out_type = NULL;
 static const gchar* g_sox_out_name = NULL;
-static gchar**      g_sox_effects  = NULL;
-static gsize        g_sox_effects_size;
+static GPtrArray*   g_sox_effects  = NULL;
+static gint64       g_sox_idle_timeout;
 
 /* SoX output */
 static sox_format_t* g_sox_out = NULL;
-static size_t        g_sox_frame_size;
+static sp_audioformat g_sox_format;
 
 /* SoX effects */
 static sox_effects_chain_t* g_effects_chain = NULL;
@@ -97,32 +97,41 @@ static sox_effects_chain_t* g_effects_chain = NULL;
 static void* _sox_player(gpointer data);
 static void _sox_log_handler(unsigned level, const char* filename, const char* fmt, va_list ap);
 static int _sox_input_drain(sox_effect_t*, sox_sample_t*, size_t*);
-static int _sox_output_flow(sox_effect_t*, const sox_sample_t*, sox_sample_t*, size_t*, size_t*);
+static int _sox_flow_callback(sox_bool all_done, void* data);
 static sox_effect_handler_t g_sox_input = { "spop_input", NULL, SOX_EFF_MCHAN, NULL, NULL, NULL,
                                             _sox_input_drain, NULL, NULL, 0 };
-static sox_effect_handler_t g_sox_output = { "spop_output", NULL, SOX_EFF_MCHAN, NULL, NULL, _sox_output_flow,
-                                             NULL, NULL, NULL, 0 };
 
 /* "Private" function used to set up SoX */
 static void _sox_init() {
-    size_t i;
     if (!g_sox_init) {
+        gchar** effects;
+        gsize effects_size;
+        gsize i;
+
         if (sox_init() != SOX_SUCCESS)
             g_error("Can't initialize SoX");
 
         sox_globals.output_message_handler = _sox_log_handler;
 
-        g_free_bufs = g_queue_new();
-        g_full_bufs = g_queue_new();
-        sox_buf* bufs = g_new(sox_buf, BUFNB);
-        for (i=0; i < BUFNB; i++) {
-            bufs[i].buf = g_malloc(BUFSIZE);
-            g_queue_push_tail(g_free_bufs, &bufs[i]);
-        }
+        g_buf = audio_buffer_new("sox");
 
         g_sox_out_type = config_get_string_opt_group("sox", "output_type", NULL);
         g_sox_out_name = config_get_string_opt_group("sox", "output_name", "default");
-        g_sox_effects = config_get_string_list_group("sox", "effects", &g_sox_effects_size);
+        g_sox_idle_timeout = config_get_int_opt_group("sox", "idle_timeout", 30) * G_TIME_SPAN_SECOND;
+
+        /* Parse effects once and for all */
+        effects = config_get_string_list_group("sox", "effects", &effects_size);
+        g_sox_effects = g_ptr_array_new();
+        for (i=0; i < effects_size; i++) {
+            gint argc;
+            gchar** argv;
+            GError* err = NULL;
+
+            if (!g_shell_parse_argv(g_strstrip(effects[i]), &argc, &argv, &err))
+                g_error("Can't parse SoX effect \"%s\": %s", effects[i], err->message);
+            g_ptr_array_add(g_sox_effects, argv);
+        }
+        g_strfreev(effects);
 
         g_sox_init = TRUE;
     }
@@ -156,8 +165,6 @@ static void _sox_parse_effect(gint argc, gchar** argv) {
 
     if (strcmp(argv[0], "spop_input") == 0)
         effhp = &g_sox_input;
-    else if (strcmp(argv[0], "spop_output") == 0)
-        effhp = &g_sox_output;
     else
         effhp = sox_find_effect(argv[0]);
 
@@ -178,9 +185,17 @@ static void _sox_start(const sp_audioformat* format) {
     GError* err = NULL;
     sox_signalinfo_t si;
     sox_encodinginfo_t ei;
+    gchar* args[2];
+    guint i;
 
     g_debug("SoX: starting playback...");
 
+    /* A previous player thread may have stopped by itself */
+    if (g_player_thread) {
+        g_thread_join(g_player_thread);
+        g_player_thread = NULL;
+    }
+
     /* Set up sample format */
     if (format->sample_type != SP_SAMPLETYPE_INT16_NATIVE_ENDIAN)
         g_error("Unsupported sample type");
@@ -193,52 +208,36 @@ static void _sox_start(const sp_audioformat* format) {
 
     sox_init_encodinginfo(&ei);
 
-    g_sox_frame_size = sizeof(int16_t) * format->channels;
-
     /* Open SoX output */
     g_debug("Opening SoX output (type: %s, name: %s)...", g_sox_out_type, g_sox_out_name);
     g_sox_out = sox_open_write(g_sox_out_name, &si, NULL, g_sox_out_type, NULL, NULL);
     if (!g_sox_out)
         g_error("Can't open SoX output");
+    g_sox_format = *format;
 
     /* Effects */
-    if (g_effects_chain) {
-        sox_delete_effects_chain(g_effects_chain);
-        g_effects_chain = NULL;
-    }
     g_effects_chain = sox_create_effects_chain(&ei, &g_sox_out->encoding);
     if (!g_effects_chain)
         g_error("Can't create SoX effects chain");
 
     /* Add input effect */
-    gchar* args[2];
     args[0] = "spop_input";
     _sox_parse_effect(1, args);
 
     /* Add user effects */
-    gsize i;
-    for (i=0; i < g_sox_effects_size; i++) {
-        gint argc;
-        gchar** argv;
-        GError* err = NULL;
-
-        if (!g_shell_parse_argv(g_strstrip(g_sox_effects[i]), &argc, &argv, &err))
-            g_error("Can't parse SoX effect \"%s\": %s", g_sox_effects[i], err->message);
-        _sox_parse_effect(argc, argv);
-        g_strfreev(argv);
+    for (i=0; i < g_sox_effects->len; i++) {
+        gchar** argv = g_ptr_array_index(g_sox_effects, i);
+        _sox_parse_effect(g_strv_length(argv), argv);
     }
 
-    /* Add our output control effect */
-    args[0] = "spop_output";
-    _sox_parse_effect(1, args);
-
     /* Add output effect */
     args[0] = "output";
     args[1] = (gchar*) g_sox_out;
     _sox_parse_effect(2, args);
 
     /* Start the player thread */
-    g_player_stop = FALSE;
+    g_atomic_int_set(&g_player_stop, FALSE);
+    g_atomic_int_set(&g_player_running, TRUE);
     g_player_thread = g_thread_try_new("sox_player", _sox_player, NULL, &err);
     if (!g_player_thread)
         g_error("Error while creating SoX player thread: %s", err->message);
@@ -247,37 +246,29 @@ static void _sox_start(const sp_audioformat* format) {
 static void _sox_stop() {
     g_debug("SoX: requesting player thread to stop.");
 
-    /* Flush the queue */
-    g_mutex_lock(&g_buf_mutex);
-    g_player_stop = TRUE;
-    while (g_queue_get_length(g_full_bufs) > 0) {
-        sox_buf* buf = g_queue_pop_tail(g_full_bufs);
-        g_queue_push_tail(g_free_bufs, buf);
-    }
-    g_cond_signal(&g_buf_cond);
-    g_mutex_unlock(&g_buf_mutex);
+    /* Flush the buffer */
+    g_atomic_int_set(&g_player_stop, TRUE);
+    audio_buffer_flush(g_buf);
+    audio_buffer_wake(g_buf);
 
-    /* Wait until the thread has actually stopped */
+    /* Wait until the thread has actually stopped (and cleaned up) */
     if (g_player_thread) {
         g_thread_join(g_player_thread);
         g_player_thread = NULL;
     }
-
-    /* It's now safe to do some cleanup */
-    if (g_effects_chain) {
-        sox_delete_effects_chain(g_effects_chain);
-        g_effects_chain = NULL;
-    }
-    if (g_sox_out) {
-        sox_close(g_sox_out);
-        g_sox_out = NULL;
-    }
 }
 
 /* Audio player thread */
 static void* _sox_player(gpointer data) {
     g_debug("SoX: player thread started.");
-    sox_flow_effects(g_effects_chain, NULL, NULL);
+    sox_flow_effects(g_effects_chain, _sox_flow_callback, NULL);
+
+    /* Cleanup: the chain is only used by this thread */
+    sox_delete_effects_chain(g_effects_chain);
+    g_effects_chain = NULL;
+    sox_close(g_sox_out);
+    g_sox_out = NULL;
+    g_atomic_int_set(&g_player_running, FALSE);
 
     g_debug("SoX: player thread stopped.");
 
@@ -286,145 +277,133 @@ static void* _sox_player(gpointer data) {
 
 /* Input callback */
 static int _sox_input_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp) {
-    /* Is a buffer available? */
-    g_mutex_lock(&g_buf_mutex);
-    while ((g_queue_get_length(g_full_bufs) == 0) && !g_player_stop) {
-        g_stutters += 1;
-        g_cond_wait(&g_buf_cond, &g_buf_mutex);
-    }
-
-    /* Should we stop now? */
-    if (g_player_stop) {
-        g_mutex_unlock(&g_buf_mutex);
-        g_debug("SoX: stopping playback.");
-        *osamp = 0;
-        return SOX_EOF;
-    }
+    gpointer ptr;
+    gsize size;
+    gint64 idle_end = -1;
+
+    if (g_sox_idle_timeout > 0)
+        idle_end = g_get_monotonic_time() + g_sox_idle_timeout;
+
+    /* Is something available? */
+    while (TRUE) {
+        /* Should we stop now? */
+        if (g_atomic_int_get(&g_player_stop)) {
+            g_debug("SoX: stopping playback.");
+            *osamp = 0;
+            return SOX_EOF;
+        }
 
-    sox_buf* buf = g_queue_pop_head(g_full_bufs);
-    g_mutex_unlock(&g_buf_mutex);
+        size = audio_buffer_peek(g_buf, &ptr, *osamp * sizeof(int16_t));
+        if ((size == 0) &&
+            ((g_buf->format.sample_rate != g_sox_format.sample_rate) ||
+             (g_buf->format.channels != g_sox_format.channels))) {
+            /* Everything in the previous format was played: end the flow
+               (letting the effects finish) so that the chain is recreated */
+            g_debug("SoX: format change, restarting playback.");
+            *osamp = 0;
+            return SOX_EOF;
+        }
+        if (size > 0) {
+            /* Decode these frames (same as SOX_SIGNED_16BIT_TO_SAMPLE() on
+               each sample) */
+            *osamp = size / sizeof(int16_t);
+            dsp_s16_to_s32(obuf, ptr, *osamp);
 
-    /* Decode that buffer */
-    size_t max_samples = *osamp;
-    size_t avail_samples = buf->size / (g_sox_frame_size / sizeof(int16_t));
-    if (avail_samples > max_samples)
-        g_error("SoX: avail_samples (%zu) > max_samples (%zu)", avail_samples, max_samples);
+            /* Make the space available */
+            audio_buffer_consume(g_buf, size);
 
-    int16_t* frm = (int16_t*) buf->buf;
-    size_t i;
-    for (i=0; i < avail_samples; i++)
-        obuf[i] = SOX_SIGNED_16BIT_TO_SAMPLE(frm[i],);
-    *osamp = avail_samples;
+            return SOX_SUCCESS;
+        }
 
-    /* Make the buffer available */
-    g_mutex_lock(&g_buf_mutex);
-    g_queue_push_tail(g_free_bufs, buf);
-    g_mutex_unlock(&g_buf_mutex);
+        /* Also parks the thread while paused */
+        if (!audio_buffer_wait(g_buf, idle_end))
+            break;
+    }
 
-    return SOX_SUCCESS;
+    /* Nothing to play for a long time: release the output */
+    g_debug("SoX: idle for too long, stopping playback.");
+    g_atomic_int_set(&g_player_stop, TRUE);
+    *osamp = 0;
+    return SOX_EOF;
 }
 
-/* Output callback */
-static int _sox_output_flow(sox_effect_t* effp, const sox_sample_t* ibuf, sox_sample_t* obuf,
-                            size_t* isamp, size_t* osamp) {
+/* Flow callback, called by sox_flow_effects() after each block */
+static int _sox_flow_callback(sox_bool all_done, void* data) {
     /* Should we stop now? */
-    /* TODO: is the mutex really needed? */
-    g_mutex_lock(&g_buf_mutex);
-    gboolean stop = g_player_stop;
-    g_mutex_unlock(&g_buf_mutex);
-    if (stop) {
-        *osamp = 0;
+    if (g_atomic_int_get(&g_player_stop))
         return SOX_EOF;
-    }
-
-    /* Minimal safety check... */
-    if (*osamp < *isamp)
-        g_error("SoX: osamp (%zu) < isamp (%zu)", *osamp, *isamp);
-
-    memcpy(obuf, ibuf, *isamp * sizeof(sox_sample_t));
-    *osamp = *isamp;
-
     return SOX_SUCCESS;
 }
 
-/* "Public" function, called from a libspotify callback */
-G_MODULE_EXPORT int audio_delivery(const sp_audioformat* format, const void* frames, int num_frames) {
-    static sp_audioformat old_fmt = { .sample_type = SP_SAMPLETYPE_INT16_NATIVE_ENDIAN,
-                                      .sample_rate = 0,
-                                      .channels = 0 };
-
+/* "Public" functions, called from the core (see audio.h) */
+G_MODULE_EXPORT void audio_open(const sp_audioformat* format) {
     /* (Maybe) init SoX */
     _sox_init();
 
-    /* What are we supposed to do here? */
-    if (num_frames == 0) {
-        /* Pause */
-        _sox_stop();
-        return 0;
-    }
-    else {
-        /* Was there a format change? */
-        if ((format->sample_type != old_fmt.sample_type) ||
-            (format->sample_rate != old_fmt.sample_rate) ||
-            (format->channels != old_fmt.channels)) {
-            g_debug("SoX: format change detected");
-            _sox_stop();
-
-            old_fmt.sample_type = format->sample_type;
-            old_fmt.sample_rate = format->sample_rate;
-            old_fmt.channels = format->channels;
-        }
+    /* On a format change, the running chain plays the frames in the previous
+       format, then stops by itself (see _sox_input_drain()). The frames in
+       the new format are only accepted once this is done. */
+    audio_buffer_set_format(g_buf, format);
 
-        /* Is there a free buffer? */
-        g_mutex_lock(&g_buf_mutex);
-        if (g_queue_get_length(g_free_bufs) == 0) {
-            g_mutex_unlock(&g_buf_mutex);
-            return 0;
-        }
+    g_mutex_lock(&g_player_mutex);
+    if (!g_atomic_int_get(&g_player_running))
+        _sox_start(format);
+    g_mutex_unlock(&g_player_mutex);
+}
 
-        /* Has playback started? */
-        if (!g_player_thread) {
-            _sox_start(format);
-        }
+G_MODULE_EXPORT int audio_write(const void* frames, int num_frames) {
+    /* Was the chain torn down because it was idle, or for a format change? */
+    g_mutex_lock(&g_player_mutex);
+    if (!g_atomic_int_get(&g_player_running))
+        _sox_start(&g_buf->in_format);
+    g_mutex_unlock(&g_player_mutex);
 
-        /* Copy frames to a free buffer */
-        sox_buf* buf = g_queue_pop_head(g_free_bufs);
-        size_t max_frames = BUFSIZE / g_sox_frame_size;
-        size_t copied_frames = num_frames < max_frames ? num_frames : max_frames;
-        size_t copied_size = copied_frames * g_sox_frame_size;
-        memcpy(buf->buf, frames, copied_size);
-        buf->size = copied_size;
+    return audio_buffer_write(g_buf, frames, num_frames);
+}
 
-        /* Make the buffer available to the player */
-        g_queue_push_tail(g_full_bufs, buf);
-        g_cond_signal(&g_buf_cond);
-        g_mutex_unlock(&g_buf_mutex);
+G_MODULE_EXPORT void audio_pause(void) {
+    if (!g_buf)
+        return;
 
-        return copied_frames;
-    }
+    audio_buffer_pause(g_buf);
 }
 
-/* Increment stats->samples by the number of frames in a buffer */
-static void _compute_samples_in_buffer(sox_buf* buf, int* samples) {
-    if (buf) {
-        *samples += buf->size / g_sox_frame_size;
-    }
+G_MODULE_EXPORT void audio_resume(void) {
+    if (g_buf)
+        audio_buffer_resume(g_buf);
 }
 
-/* "Public" function, called from a libspotify callback */
-G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
-    g_mutex_lock(&g_buf_mutex);
+G_MODULE_EXPORT void audio_flush(void) {
+    if (g_buf)
+        audio_buffer_flush(g_buf);
+}
+
+G_MODULE_EXPORT void audio_drain(void) {
+    if (g_buf)
+        audio_buffer_drain(g_buf);
+}
 
-    /* Compute the number of samples in each buffer */
-    stats->samples = 0;
-    if (g_full_bufs)
-        g_queue_foreach(g_full_bufs, (GFunc) _compute_samples_in_buffer, &(stats->samples));
+G_MODULE_EXPORT int audio_latency(void) {
+    return audio_buffer_frames(g_buf);
+}
 
-    stats->stutter = g_stutters;
-    g_stutters = 0;
+G_MODULE_EXPORT void audio_close(void) {
+    if (!g_sox_init)
+        return;
 
-    if (stats->stutter > 0)
-        g_debug("sox stats: samples: %d; stutter: %d", stats->samples, stats->stutter);
+    /* Keep the chain running, the player thread will stop it if nothing is
+       played for a while */
+    audio_resume();
+    if (g_sox_idle_timeout == 0) {
+        g_mutex_lock(&g_player_mutex);
+        _sox_stop();
+        g_mutex_unlock(&g_player_mutex);
+    }
+    else
+        audio_flush();
+}
 
-    g_mutex_unlock(&g_buf_mutex);
+/* "Public" function, called from a libspotify callback */
+G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    audio_buffer_stats(g_buf, stats);
 }
@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "spop.h"
+#include "audio.h"
+#include "audio_buffer.h"
+#include "config.h"
+#include "ringbuf.h"
+
+/* Serve the audio to any number of listeners, over TCP or a Unix socket (see
+ * the [stream] section of the configuration file).
+ *
+ * The plugin behaves like a sound card: the pacer thread consumes the audio
+ * buffer one period at a time, at the sample rate, and copies each period to
+ * the ring buffer of every listener. The server thread sends these buffers to
+ * the listeners without ever blocking. A listener that does not read fast
+ * enough fills its buffer and is disconnected, so that it can't slow down the
+ * playback or the other listeners.
+ *
+ * Listeners get raw frames (16-bit signed, native endianness), or a WAV
+ * stream with a header for the first format played after they connect. WAV
+ * listeners are disconnected when the format changes. */
+
+#define STREAM_MAX_LISTEN 8
+
+typedef struct {
+    int fd;
+    gchar* name;
+    ringbuf* rb;
+
+    /* Only used by the pacer thread */
+    gboolean started;
+    sp_audioformat format;
+
+    /* Set by the pacer thread when the listener has to be disconnected */
+    volatile gint dropped;
+} stream_client;
+
+static audio_buffer* g_buf = NULL;
+
+static gboolean g_wav;
+static guint g_period_ms;
+static guint g_client_buffer_ms;
+
+static int g_listen_fds[STREAM_MAX_LISTEN];
+static int g_nb_listen_fds = 0;
+static int g_wake_pipe[2];
+
+/* Only the server thread adds or removes clients, always with the mutex held;
+   the pacer thread only reads the list, with the mutex held */
+static GMutex g_clients_mutex;
+static GList* g_clients = NULL;
+
+/* "Private" functions */
+static void stream_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+        g_error("stream: can't make socket non-blocking: %s", g_strerror(errno));
+}
+
+static void stream_add_listen_fd(int fd) {
+    if (g_nb_listen_fds >= STREAM_MAX_LISTEN) {
+        close(fd);
+        return;
+    }
+    stream_set_nonblocking(fd);
+    g_listen_fds[g_nb_listen_fds++] = fd;
+}
+
+static void stream_listen_unix(const gchar* path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        g_error("stream: socket path too long: %s", path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        g_error("stream: can't create socket: %s", g_strerror(errno));
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+        g_error("stream: can't bind socket %s: %s", path, g_strerror(errno));
+    if (listen(fd, SOMAXCONN) != 0)
+        g_error("stream: can't listen on socket: %s", g_strerror(errno));
+
+    stream_add_listen_fd(fd);
+    g_info("stream: listening on %s", path);
+}
+
+static void stream_listen_tcp(const gchar* address, const gchar* port) {
+    struct addrinfo hints;
+    struct addrinfo* res;
+    struct addrinfo* rp;
+    int _true = 1;
+    int fd, ret;
+    int nb_fds = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_V4MAPPED | AI_ADDRCONFIG | AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+    ret = getaddrinfo(address, port, &hints, &res);
+    if (ret != 0)
+        g_error("stream: can't get address info: %s", gai_strerror(ret));
+
+    for (rp = res; rp != NULL; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (fd < 0)
+            g_error("stream: can't create socket: %s", g_strerror(errno));
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &_true, sizeof(int)) == -1)
+            g_error("stream: can't set socket options: %s", g_strerror(errno));
+
+        /* Without an address, both :: and 0.0.0.0 are returned: on a dual-stack
+           host, the IPv6 socket must not take the IPv4 port as well */
+        if ((rp->ai_family == AF_INET6) &&
+            (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &_true, sizeof(int)) == -1))
+            g_error("stream: can't set socket options: %s", g_strerror(errno));
+
+        /* Only give up if none of the addresses can be used */
+        if (bind(fd, rp->ai_addr, rp->ai_addrlen) != 0) {
+            if ((nb_fds == 0) && !rp->ai_next)
+                g_error("stream: can't bind socket: %s", g_strerror(errno));
+            g_info("stream: can't bind socket: %s", g_strerror(errno));
+            close(fd);
+            continue;
+        }
+        if (listen(fd, SOMAXCONN) != 0)
+            g_error("stream: can't listen on socket: %s", g_strerror(errno));
+
+        stream_add_listen_fd(fd);
+        nb_fds += 1;
+    }
+    freeaddrinfo(res);
+
+    g_info("stream: listening on %s:%s", address ? address : "*", port);
+}
+
+/* Make poll() return in the server thread */
+static void stream_wake_server() {
+    char c = 0;
+    if (write(g_wake_pipe[1], &c, 1) < 0) {
+        /* The pipe is full: the server thread will wake up anyway */
+    }
+}
+
+static void stream_client_free(stream_client* client) {
+    close(client->fd);
+    ringbuf_free(client->rb);
+    g_free(client->name);
+    g_free(client);
+}
+
+/* WAV header for an endless stream */
+static gsize stream_wav_header(const sp_audioformat* format, guint8* buf) {
+    guint32 rate = format->sample_rate;
+    guint16 channels = format->channels;
+    guint16 block = channels * sizeof(int16_t);
+    guint32 bytes_per_s = rate * block;
+    guint32 u32;
+    guint16 u16;
+    guint8* p = buf;
+
+#define PUT(data, size) { memcpy(p, data, size); p += size; }
+#define PUT32(v) { u32 = GUINT32_TO_LE(v); PUT(&u32, 4); }
+#define PUT16(v) { u16 = GUINT16_TO_LE(v); PUT(&u16, 2); }
+    PUT("RIFF", 4);
+    PUT32(G_MAXUINT32);
+    PUT("WAVEfmt ", 8);
+    PUT32(16);
+    PUT16(1);                   /* PCM */
+    PUT16(channels);
+    PUT32(rate);
+    PUT32(bytes_per_s);
+    PUT16(block);
+    PUT16(16);
+    PUT("data", 4);
+    PUT32(G_MAXUINT32);
+#undef PUT16
+#undef PUT32
+#undef PUT
+
+    return p - buf;
+}
+
+/* Copy some frames to the buffer of every listener */
+static void stream_broadcast(const void* data, gsize size) {
+    GList* cur;
+    guint8 header[64];
+    gsize len;
+
+    g_mutex_lock(&g_clients_mutex);
+    for (cur = g_clients; cur; cur = cur->next) {
+        stream_client* client = cur->data;
+
+        if (g_atomic_int_get(&client->dropped))
+            continue;
+
+        if (!client->started) {
+            client->started = TRUE;
+            client->format = g_buf->format;
+            if (g_wav) {
+                len = stream_wav_header(&client->format, header);
+                ringbuf_write(client->rb, header, len);
+            }
+        }
+        else if (g_wav && ((client->format.sample_rate != g_buf->format.sample_rate) ||
+                           (client->format.channels != g_buf->format.channels))) {
+            g_info("stream: format changed, disconnecting %s", client->name);
+            g_atomic_int_set(&client->dropped, TRUE);
+            continue;
+        }
+
+        if (ringbuf_space(client->rb) < size) {
+            g_info("stream: %s is too slow, disconnecting it", client->name);
+            g_atomic_int_set(&client->dropped, TRUE);
+            continue;
+        }
+        ringbuf_write(client->rb, data, size);
+    }
+    g_mutex_unlock(&g_clients_mutex);
+}
+
+/* Pacer thread: consume one period of audio at a time, and give it to the
+   listeners */
+static gpointer stream_pacer(gpointer data) {
+    gint64 now, next;
+    gpointer ptr;
+    gsize size, want, got;
+
+    next = g_get_monotonic_time();
+
+    while (TRUE) {
+        want = (gsize) g_buf->format.sample_rate * g_period_ms / 1000 * g_buf->frame_size;
+        got = 0;
+        while (got < want) {
+            size = audio_buffer_peek(g_buf, &ptr, want - got);
+            if (size == 0)
+                break;
+            stream_broadcast(ptr, size);
+            audio_buffer_consume(g_buf, size);
+            got += size;
+        }
+
+        now = g_get_monotonic_time();
+        if (got == 0) {
+            /* Nothing to play: wait for more, and restart the clock from
+               there */
+            audio_buffer_wait(g_buf, now + G_TIME_SPAN_SECOND);
+            next = g_get_monotonic_time();
+            continue;
+        }
+        stream_wake_server();
+
+        next += g_period_ms * G_TIME_SPAN_MILLISECOND;
+        if (next > now)
+            g_usleep(next - now);
+    }
+
+    return NULL;
+}
+
+static void stream_accept(int fd) {
+    stream_client* client;
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    int cfd, sndbuf;
+
+    cfd = accept(fd, (struct sockaddr*) &addr, &addrlen);
+    if (cfd < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            g_warning("stream: can't accept connection: %s", g_strerror(errno));
+        return;
+    }
+    stream_set_nonblocking(cfd);
+
+    client = g_new0(stream_client, 1);
+    client->fd = cfd;
+    client->rb = ringbuf_new(g_client_buffer_ms * 48 * 2 * sizeof(int16_t));
+
+    /* Without this, the kernel would happily queue several seconds of audio
+       for a slow listener (the send buffer can grow up to a few MB), and the
+       ring buffer would not bound anything. Linux doubles this value. */
+    sndbuf = client->rb->size / 4;
+    if (setsockopt(cfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == -1)
+        g_warning("stream: can't set socket send buffer size: %s", g_strerror(errno));
+
+    if ((addr.ss_family != AF_UNIX) &&
+        (getnameinfo((struct sockaddr*) &addr, addrlen, host, sizeof(host), port, sizeof(port),
+                     NI_NUMERICHOST | NI_NUMERICSERV) == 0))
+        client->name = g_strdup_printf("%s:%s", host, port);
+    else
+        client->name = g_strdup_printf("client %d", cfd);
+
+    g_mutex_lock(&g_clients_mutex);
+    g_clients = g_list_prepend(g_clients, client);
+    g_mutex_unlock(&g_clients_mutex);
+
+    g_info("stream: new listener %s", client->name);
+}
+
+/* Send as much as possible to a client. Returns FALSE if it must be
+   disconnected. */
+static gboolean stream_send(stream_client* client) {
+    gpointer ptr;
+    gsize size;
+    ssize_t n;
+
+    while ((size = ringbuf_peek(client->rb, &ptr)) > 0) {
+        n = send(client->fd, ptr, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+                return TRUE;
+            g_info("stream: error while sending to %s: %s", client->name, g_strerror(errno));
+            return FALSE;
+        }
+        ringbuf_consume(client->rb, n);
+        if ((gsize) n < size)
+            return TRUE;
+    }
+    return TRUE;
+}
+
+/* Server thread: accept the connections, send the audio to the listeners, and
+   remove the ones that are gone */
+static gpointer stream_server(gpointer data) {
+    GArray* fds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+    GPtrArray* clients = g_ptr_array_new();
+    struct pollfd pfd;
+    GList* cur;
+    char buf[256];
+    int i, first;
+
+    while (TRUE) {
+        g_array_set_size(fds, 0);
+        g_ptr_array_set_size(clients, 0);
+
+        pfd.fd = g_wake_pipe[0];
+        pfd.events = POLLIN;
+        g_array_append_val(fds, pfd);
+        for (i=0; i < g_nb_listen_fds; i++) {
+            pfd.fd = g_listen_fds[i];
+            g_array_append_val(fds, pfd);
+        }
+
+        /* Clients: wait until they can take more data, or until they hang up
+           (they're not supposed to send anything) */
+        first = fds->len;
+        g_mutex_lock(&g_clients_mutex);
+        for (cur = g_clients; cur; cur = cur->next) {
+            stream_client* client = cur->data;
+            pfd.fd = client->fd;
+            pfd.events = POLLIN | ((ringbuf_fill(client->rb) > 0) ? POLLOUT : 0);
+            g_array_append_val(fds, pfd);
+            g_ptr_array_add(clients, client);
+        }
+        g_mutex_unlock(&g_clients_mutex);
+
+        if (poll((struct pollfd*) fds->data, fds->len, -1) < 0) {
+            if (errno != EINTR)
+                g_error("stream: poll() failed: %s", g_strerror(errno));
+            continue;
+        }
+
+        if (g_array_index(fds, struct pollfd, 0).revents & POLLIN) {
+            while (read(g_wake_pipe[0], buf, sizeof(buf)) > 0);
+        }
+        for (i=1; i < first; i++) {
+            if (g_array_index(fds, struct pollfd, i).revents & POLLIN)
+                stream_accept(g_array_index(fds, struct pollfd, i).fd);
+        }
+
+        for (i=first; i < fds->len; i++) {
+            stream_client* client = g_ptr_array_index(clients, i - first);
+            short revents = g_array_index(fds, struct pollfd, i).revents;
+            gboolean keep = !g_atomic_int_get(&client->dropped);
+
+            if (keep && (revents & (POLLIN | POLLHUP | POLLERR))) {
+                /* Anything sent by the client is ignored, but EOF means it's
+                   gone */
+                ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+                    keep = FALSE;
+            }
+            if (keep)
+                keep = stream_send(client);
+
+            if (!keep) {
+                g_mutex_lock(&g_clients_mutex);
+                g_clients = g_list_remove(g_clients, client);
+                g_mutex_unlock(&g_clients_mutex);
+                g_info("stream: listener %s disconnected", client->name);
+                stream_client_free(client);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Called by GLib when the module is loaded: start listening right away, so
+   that listeners can connect before anything is played */
+G_MODULE_EXPORT const gchar* g_module_check_init(GModule* module) {
+    GError* err = NULL;
+    gchar* format;
+    gchar* path;
+
+    format = config_get_string_opt_group("stream", "format", "wav");
+    if (strcmp(format, "wav") == 0)
+        g_wav = TRUE;
+    else if (strcmp(format, "raw") == 0)
+        g_wav = FALSE;
+    else
+        g_error("stream: unknown format \"%s\"", format);
+    g_free(format);
+
+    g_period_ms = config_get_int_opt_group("stream", "period", 20);
+    if (g_period_ms == 0)
+        g_period_ms = 1;
+    g_client_buffer_ms = config_get_int_opt_group("stream", "client_buffer", 2000);
+    if (g_client_buffer_ms < 2 * g_period_ms)
+        g_client_buffer_ms = 2 * g_period_ms;
+
+    path = config_get_string_opt_group("stream", "socket", NULL);
+    if (path && *path)
+        stream_listen_unix(path);
+    else {
+        gchar* address = config_get_string_opt_group("stream", "address", "127.0.0.1");
+        gchar* port = config_get_string_opt_group("stream", "port", "6603");
+        stream_listen_tcp(*address ? address : NULL, port);
+        g_free(address);
+        g_free(port);
+    }
+    g_free(path);
+
+    if (pipe(g_wake_pipe) != 0)
+        g_error("stream: can't create pipe: %s", g_strerror(errno));
+    stream_set_nonblocking(g_wake_pipe[0]);
+    stream_set_nonblocking(g_wake_pipe[1]);
+
+    g_buf = audio_buffer_new("stream");
+    if (!g_thread_try_new("stream_pacer", stream_pacer, NULL, &err) ||
+        !g_thread_try_new("stream_server", stream_server, NULL, &err))
+        g_error("Error while creating stream threads: %s", err->message);
+
+    return NULL;
+}
+
+/* "Public" functions, called from the core (see audio.h) */
+G_MODULE_EXPORT void audio_open(const sp_audioformat* format) {
+    audio_buffer_set_format(g_buf, format);
+}
+
+G_MODULE_EXPORT int audio_write(const void* frames, int num_frames) {
+    return audio_buffer_write(g_buf, frames, num_frames);
+}
+
+G_MODULE_EXPORT void audio_pause(void) {
+    audio_buffer_pause(g_buf);
+}
+
+G_MODULE_EXPORT void audio_resume(void) {
+    audio_buffer_resume(g_buf);
+}
+
+G_MODULE_EXPORT void audio_flush(void) {
+    audio_buffer_flush(g_buf);
+}
+
+G_MODULE_EXPORT void audio_drain(void) {
+    audio_buffer_drain(g_buf);
+}
+
+G_MODULE_EXPORT int audio_latency(void) {
+    return audio_buffer_frames(g_buf);
+}
+
+G_MODULE_EXPORT void audio_close(void) {
+    audio_resume();
+    audio_flush();
+}
+
+/* "Public" function, called from a libspotify callback */
+G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    audio_buffer_stats(g_buf, stats);
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+#include <gmodule.h>
+#include <string.h>
+
+#include "spop.h"
+#include "audio.h"
+#include "config.h"
+#include "plugin.h"
+#include "ringbuf.h"
+
+/* Send the same audio to several audio plugins (the "sinks", see the [tee]
+ * section of the configuration file).
+ *
+ * Each sink has its own ring buffer and feeder thread, which gives the frames
+ * to the sink's plugin as fast as it takes them. The first sink is the master:
+ * it decides how many frames are accepted, and its latency is the one used for
+ * the playback position. The other sinks never slow it down: if one of them
+ * falls behind and its ring buffer is full, the frames it can't take are
+ * dropped (and counted as stutters). */
+
+/* The ring buffers are allocated before the format is known, so they are sized
+   for the worst case: 48 kHz, 16-bit stereo */
+#define MAX_BYTES_PER_MS (48 * 2 * sizeof(int16_t))
+
+/* Frames given to a sink at once, and how long to wait when it is full */
+#define TEE_CHUNK_SIZE 16384
+#define TEE_RETRY (5 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct {
+    audio_output out;
+    ringbuf* rb;
+    GThread* thread;
+
+    /* Serializes the calls to the plugin (from the feeder thread and from the
+       core) */
+    GMutex lock;
+
+    /* Format of the frames given to the plugin (owned by the feeder thread) */
+    sp_audioformat format;
+    gsize frame_size;
+
+    /* Format of the frames written to the ring buffer, and how much of it can
+       be used. The feeder only switches to a new format once it has given the
+       plugin all the frames in the previous one: until then nothing is written
+       (in_format is protected by the lock). */
+    sp_audioformat in_format;
+    gsize in_frame_size;
+    guint buffer_ms;
+    gsize high_watermark;
+    volatile gint format_changed;
+
+    /* Frames taken out of the ring buffer, not yet accepted by the plugin
+       (protected by the lock) */
+    guint8 chunk[TEE_CHUNK_SIZE];
+    gsize chunk_len;
+    gsize chunk_pos;
+    volatile gint chunk_frames;
+
+    volatile gint draining;
+
+    volatile gint dropped;      /* Frames dropped since the last stats */
+    guint64 total_dropped;
+} tee_sink;
+
+static tee_sink** g_sinks = NULL;
+static int g_nb_sinks = 0;
+
+/* "Private" functions */
+static gpointer tee_feeder(gpointer data) {
+    tee_sink* sink = data;
+    gsize fill;
+    int n;
+
+    while (TRUE) {
+        g_mutex_lock(&sink->lock);
+        if (sink->chunk_pos >= sink->chunk_len) {
+            /* Everything in the previous format was played: use the new one */
+            if (g_atomic_int_get(&sink->format_changed) && (ringbuf_fill(sink->rb) == 0)) {
+                sink->format = sink->in_format;
+                sink->frame_size = sink->in_frame_size;
+                g_atomic_int_set(&sink->format_changed, FALSE);
+            }
+
+            /* Get more frames (whole frames only) */
+            fill = ringbuf_fill(sink->rb);
+            fill = MIN(fill, sizeof(sink->chunk));
+            if (sink->frame_size > 0)
+                fill -= fill % sink->frame_size;
+            sink->chunk_len = (fill > 0) ? ringbuf_read(sink->rb, sink->chunk, fill) : 0;
+            sink->chunk_pos = 0;
+            g_atomic_int_set(&sink->chunk_frames, (fill > 0) ? sink->chunk_len / sink->frame_size : 0);
+        }
+
+        if (sink->chunk_len == 0) {
+            /* Nothing to play: end of track? */
+            if (g_atomic_int_compare_and_exchange(&sink->draining, 1, 0))
+                audio_output_drain(&sink->out);
+            g_mutex_unlock(&sink->lock);
+            ringbuf_wait(sink->rb, -1);
+            continue;
+        }
+
+        n = audio_output_deliver(&sink->out, &sink->format, sink->chunk + sink->chunk_pos,
+                                 (sink->chunk_len - sink->chunk_pos) / sink->frame_size);
+        sink->chunk_pos += n * sink->frame_size;
+        g_atomic_int_set(&sink->chunk_frames, (sink->chunk_len - sink->chunk_pos) / sink->frame_size);
+        g_mutex_unlock(&sink->lock);
+
+        /* The plugin is full (or paused): try again a bit later */
+        if (n == 0)
+            g_usleep(TEE_RETRY);
+    }
+
+    return NULL;
+}
+
+static tee_sink* tee_sink_new(const gchar* name, guint buffer_ms) {
+    tee_sink* sink = g_new0(tee_sink, 1);
+    gchar* thread_name;
+    GError* err = NULL;
+
+    if (!plugin_audio_load(name, &sink->out))
+        g_error("tee: can't use %s as audio output", name);
+
+    sink->rb = ringbuf_new(buffer_ms * MAX_BYTES_PER_MS);
+    sink->buffer_ms = buffer_ms;
+    g_mutex_init(&sink->lock);
+
+    thread_name = g_strdup_printf("tee_%s", name);
+    sink->thread = g_thread_try_new(thread_name, tee_feeder, sink, &err);
+    if (!sink->thread)
+        g_error("Error while creating tee feeder thread: %s", err->message);
+    g_free(thread_name);
+
+    return sink;
+}
+
+static void tee_init() {
+    gchar** names;
+    gsize names_size;
+    guint buffer_ms;
+    int i, j;
+
+    names = config_get_string_list_group("tee", "outputs", &names_size);
+    buffer_ms = config_get_int_opt_group("tee", "buffer", 100);
+    if (buffer_ms < 10)
+        buffer_ms = 10;
+
+    if (names_size == 0)
+        g_error("tee: no output configured");
+    for (i=0; i < names_size; i++) {
+        g_strstrip(names[i]);
+        if (strcmp(names[i], "tee") == 0)
+            g_error("tee: can't use tee as one of its own outputs");
+        for (j=0; j < i; j++)
+            if (strcmp(names[i], names[j]) == 0)
+                g_error("tee: %s is used twice", names[i]);
+    }
+
+    g_sinks = g_new0(tee_sink*, names_size);
+    for (i=0; i < names_size; i++) {
+        g_sinks[i] = tee_sink_new(names[i], buffer_ms);
+        g_nb_sinks += 1;
+    }
+    g_debug("tee: %d outputs, master is %s", g_nb_sinks, g_sinks[0]->out.name);
+
+    g_strfreev(names);
+}
+
+/* Number of frames the ring buffer of a sink can take */
+static int tee_room(tee_sink* sink) {
+    gsize fill, room;
+
+    /* The feeder has not switched to the new format yet */
+    if (g_atomic_int_get(&sink->format_changed) || (sink->in_frame_size == 0))
+        return 0;
+
+    fill = ringbuf_fill(sink->rb);
+    room = (fill < sink->high_watermark) ? sink->high_watermark - fill : 0;
+    room = MIN(room, ringbuf_space(sink->rb));
+    return room / sink->in_frame_size;
+}
+
+/* Drop everything the plugin didn't take yet. Must be called with the lock
+   held. */
+static void tee_drop(tee_sink* sink) {
+    g_atomic_int_set(&sink->draining, FALSE);
+    ringbuf_flush(sink->rb);
+    sink->chunk_len = sink->chunk_pos = 0;
+    g_atomic_int_set(&sink->chunk_frames, 0);
+}
+
+/* Frames of a sink that are not audible yet. Must be called without the lock
+   held. */
+static int tee_latency(tee_sink* sink) {
+    int latency;
+    gsize frame_size;
+
+    /* The feeder thread may be reopening the device, or switching to a new
+       format */
+    g_mutex_lock(&sink->lock);
+    frame_size = sink->frame_size;
+    latency = audio_output_latency(&sink->out);
+    g_mutex_unlock(&sink->lock);
+
+    if (frame_size == 0)
+        return 0;
+    return ringbuf_fill(sink->rb) / frame_size + g_atomic_int_get(&sink->chunk_frames)
+        + latency;
+}
+
+/* "Public" functions, called from the core (see audio.h) */
+G_MODULE_EXPORT void audio_open(const sp_audioformat* format) {
+    guint64 bytes_per_s;
+    int i;
+
+    if (!g_sinks)
+        tee_init();
+
+    for (i=0; i < g_nb_sinks; i++) {
+        tee_sink* sink = g_sinks[i];
+
+        if ((sink->in_frame_size > 0) &&
+            (format->sample_rate == sink->in_format.sample_rate) &&
+            (format->channels == sink->in_format.channels))
+            continue;
+
+        g_mutex_lock(&sink->lock);
+        sink->in_format = *format;
+        sink->in_frame_size = sizeof(int16_t) * format->channels;
+        g_atomic_int_set(&sink->format_changed, TRUE);
+        g_mutex_unlock(&sink->lock);
+
+        bytes_per_s = (guint64) sink->in_frame_size * format->sample_rate;
+        sink->high_watermark = MIN(sink->rb->size, bytes_per_s * sink->buffer_ms / 1000);
+        sink->high_watermark -= sink->high_watermark % sink->in_frame_size;
+
+        /* The feeder may be waiting for frames */
+        ringbuf_wake(sink->rb);
+    }
+}
+
+G_MODULE_EXPORT int audio_write(const void* frames, int num_frames) {
+    int i, n, room;
+
+    /* The master decides... */
+    n = MIN(num_frames, tee_room(g_sinks[0]));
+    if (n <= 0)
+        return 0;
+
+    for (i=0; i < g_nb_sinks; i++) {
+        tee_sink* sink = g_sinks[i];
+
+        g_atomic_int_set(&sink->draining, FALSE);
+        room = (i == 0) ? n : MIN(n, tee_room(sink));
+        if (room > 0)
+            ringbuf_write(sink->rb, frames, room * sink->in_frame_size);
+        if (room < n)
+            g_atomic_int_add(&sink->dropped, n - room);
+    }
+
+    return n;
+}
+
+G_MODULE_EXPORT void audio_pause(void) {
+    int i;
+    for (i=0; i < g_nb_sinks; i++) {
+        g_mutex_lock(&g_sinks[i]->lock);
+        audio_output_pause(&g_sinks[i]->out);
+        g_mutex_unlock(&g_sinks[i]->lock);
+    }
+}
+
+G_MODULE_EXPORT void audio_resume(void) {
+    int i;
+    for (i=0; i < g_nb_sinks; i++) {
+        g_mutex_lock(&g_sinks[i]->lock);
+        audio_output_resume(&g_sinks[i]->out);
+        g_mutex_unlock(&g_sinks[i]->lock);
+    }
+}
+
+G_MODULE_EXPORT void audio_flush(void) {
+    int i;
+    for (i=0; i < g_nb_sinks; i++) {
+        tee_sink* sink = g_sinks[i];
+
+        g_mutex_lock(&sink->lock);
+        tee_drop(sink);
+        audio_output_flush(&sink->out);
+        g_mutex_unlock(&sink->lock);
+    }
+}
+
+G_MODULE_EXPORT void audio_drain(void) {
+    int i;
+    for (i=0; i < g_nb_sinks; i++) {
+        g_atomic_int_set(&g_sinks[i]->draining, TRUE);
+        ringbuf_wake(g_sinks[i]->rb);
+    }
+}
+
+G_MODULE_EXPORT int audio_latency(void) {
+    return (g_nb_sinks > 0) ? tee_latency(g_sinks[0]) : 0;
+}
+
+G_MODULE_EXPORT void audio_close(void) {
+    int i;
+    for (i=0; i < g_nb_sinks; i++) {
+        tee_sink* sink = g_sinks[i];
+
+        g_mutex_lock(&sink->lock);
+        tee_drop(sink);
+        audio_output_close(&sink->out);
+        g_mutex_unlock(&sink->lock);
+    }
+}
+
+/* "Public" function, called from a libspotify callback: the latency is the
+   master's, the stutters are the sum of the stutters of all the sinks and of
+   the frames they dropped */
+G_MODULE_EXPORT void get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    int i;
+
+    stats->samples = audio_latency();
+    stats->stutter = 0;
+
+    for (i=0; i < g_nb_sinks; i++) {
+        tee_sink* sink = g_sinks[i];
+        sp_audio_buffer_stats st = { 0, 0 };
+        int dropped;
+
+        if (sink->out.buffer_stats) {
+            g_mutex_lock(&sink->lock);
+            sink->out.buffer_stats(session, &st);
+            g_mutex_unlock(&sink->lock);
+        }
+        dropped = g_atomic_int_and(&sink->dropped, 0);
+        sink->total_dropped += dropped;
+
+        stats->stutter += st.stutter + ((dropped > 0) ? 1 : 0);
+        if ((st.stutter > 0) || (dropped > 0))
+            g_debug("tee: %s: latency: %d frames; stutter: %d; dropped: %d frames (%" G_GUINT64_FORMAT " so far)",
+                    sink->out.name, tee_latency(sink), st.stutter, dropped, sink->total_dropped);
+    }
+}
@@ -26,8 +26,57 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include <glib.h>
 #include <libspotify/api.h>
 
-int audio_delivery(const sp_audioformat *format, const void *frames, int num_frames);
+/* Audio output plugins (libspop_audio_<name>) come in two flavours.
+ *
+ * Version 1 plugins only export audio_delivery(), where num_frames == 0 means
+ * "stop playing and drop everything", whatever the reason (pause, stop, track
+ * change, seek...). They are still supported through a compatibility layer in
+ * plugin.c.
+ *
+ * Version 2 plugins export audio_open(), audio_write() and audio_close(), and
+ * optionally any of the other functions below. The missing ones are emulated
+ * with the closest available function (for instance audio_flush() instead of
+ * audio_pause()).
+ *
+ * audio_open(), audio_write() and audio_drain() are called from libspotify's
+ * thread; the other functions are called from the main thread.
+ *
+ * Both versions may also export get_audio_buffer_stats(), which is given to
+ * libspotify as is. */
+
+/* Version 1 */
+int audio_delivery(const sp_audioformat* format, const void* frames, int num_frames);
+
+/* Version 2 */
+
+/* Frames with a new format are about to be written (first frames of a track, or
+   format change) */
+void audio_open(const sp_audioformat* format);
+
+/* Play some frames. Must not block: return the number of frames actually
+   accepted, libspotify will deliver the other ones again later. */
+int audio_write(const void* frames, int num_frames);
+
+/* Stop playing, but keep everything that was buffered for audio_resume() */
+void audio_pause(void);
+void audio_resume(void);
+
+/* Drop all the buffered frames (seek) */
+void audio_flush(void);
+
+/* No more frames will be written for the current track: play the buffered ones
+   without waiting for more (end of track) */
+void audio_drain(void);
+
+/* Number of frames that were accepted by audio_write() but are not audible
+   yet */
+int audio_latency(void);
+
+/* Playback is stopped: drop the buffered frames, and release the output device
+   if it makes sense */
+void audio_close(void);
 
 #endif
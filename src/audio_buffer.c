@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+#include <libspotify/api.h>
+#include <stdint.h>
+
+#include "spop.h"
+#include "audio_buffer.h"
+#include "config.h"
+#include "ringbuf.h"
+
+/* The ring buffer is allocated before the format is known, so it is sized for
+ * the worst case: 48 kHz, 16-bit stereo */
+#define MAX_BYTES_PER_MS (48 * 2 * sizeof(int16_t))
+
+/* How long the consumer sleeps while waiting for the low watermark */
+#define PREBUFFER_POLL (10 * G_TIME_SPAN_MILLISECOND)
+
+audio_buffer* audio_buffer_new(const gchar* name) {
+    audio_buffer* ab = g_new0(audio_buffer, 1);
+
+    ab->name = name;
+    ab->buffer_ms = config_get_int_opt("audio_buffer", 750);
+    ab->prebuffer_ms = config_get_int_opt("audio_prebuffer", 100);
+    if (ab->buffer_ms < 100)
+        ab->buffer_ms = 100;
+    if (ab->prebuffer_ms > ab->buffer_ms / 2)
+        ab->prebuffer_ms = ab->buffer_ms / 2;
+
+    ab->rb = ringbuf_new(ab->buffer_ms * MAX_BYTES_PER_MS);
+    g_mutex_init(&ab->format_mutex);
+    g_mutex_init(&ab->pause_mutex);
+    g_cond_init(&ab->pause_cond);
+    g_debug("%s: using a %u ms audio buffer (prebuffer: %u ms)", name, ab->buffer_ms, ab->prebuffer_ms);
+
+    return ab;
+}
+
+void audio_buffer_free(audio_buffer* ab) {
+    g_mutex_clear(&ab->format_mutex);
+    g_mutex_clear(&ab->pause_mutex);
+    g_cond_clear(&ab->pause_cond);
+    ringbuf_free(ab->rb);
+    g_free(ab);
+}
+
+/* Set the format of the next frames. The frames already written in the
+ * previous format are still played as such: the consumer only switches to the
+ * new one when they are all gone, and audio_buffer_write() accepts nothing until
+ * then. */
+void audio_buffer_set_format(audio_buffer* ab, const sp_audioformat* format) {
+    guint64 bytes_per_s;
+
+    if (format->sample_type != SP_SAMPLETYPE_INT16_NATIVE_ENDIAN)
+        g_error("%s: unsupported sample type", ab->name);
+    if (sizeof(int16_t) * format->channels > sizeof(ab->bounce))
+        g_error("%s: unsupported number of channels: %d", ab->name, format->channels);
+
+    if ((ab->in_frame_size > 0) &&
+        (format->sample_rate == ab->in_format.sample_rate) &&
+        (format->channels == ab->in_format.channels))
+        return;
+
+    g_mutex_lock(&ab->format_mutex);
+    ab->in_format = *format;
+    ab->in_frame_size = sizeof(int16_t) * format->channels;
+    g_atomic_int_set(&ab->format_changed, TRUE);
+    g_mutex_unlock(&ab->format_mutex);
+
+    bytes_per_s = (guint64) ab->in_frame_size * format->sample_rate;
+    ab->high_watermark = MIN(ab->rb->size, bytes_per_s * ab->buffer_ms / 1000);
+    ab->high_watermark -= ab->high_watermark % ab->in_frame_size;
+
+    /* The consumer may be sleeping on an empty buffer */
+    audio_buffer_wake(ab);
+}
+
+/* Consumer side of audio_buffer_set_format(): switch to the new format once
+ * everything in the previous one was played. Returns TRUE if the format was
+ * changed. */
+static gboolean _audio_buffer_update_format(audio_buffer* ab) {
+    guint64 bytes_per_s;
+
+    if (!g_atomic_int_get(&ab->format_changed) || (ringbuf_fill(ab->rb) > 0))
+        return FALSE;
+
+    g_mutex_lock(&ab->format_mutex);
+    ab->format = ab->in_format;
+    ab->frame_size = ab->in_frame_size;
+    g_atomic_int_set(&ab->format_changed, FALSE);
+    g_mutex_unlock(&ab->format_mutex);
+
+    bytes_per_s = (guint64) ab->frame_size * ab->format.sample_rate;
+    ab->low_watermark = bytes_per_s * ab->prebuffer_ms / 1000;
+    ab->low_watermark -= ab->low_watermark % ab->frame_size;
+    if (ab->low_watermark > 0)
+        g_atomic_int_set(&ab->prebuffering, TRUE);
+
+    return TRUE;
+}
+
+/* Copy as many frames as possible (up to the high watermark) to the buffer.
+ * Returns the number of frames actually copied. */
+int audio_buffer_write(audio_buffer* ab, const void* frames, int num_frames) {
+    gsize fill, room;
+    int nb;
+
+    /* The consumer has not switched to the new format yet */
+    if (g_atomic_int_get(&ab->format_changed))
+        return 0;
+
+    g_atomic_int_set(&ab->playing, TRUE);
+    g_atomic_int_set(&ab->draining, FALSE);
+
+    fill = ringbuf_fill(ab->rb);
+    room = (fill < ab->high_watermark) ? ab->high_watermark - fill : 0;
+    room = MIN(room, ringbuf_space(ab->rb));
+    nb = MIN(num_frames, room / ab->in_frame_size);
+
+    if (nb > 0)
+        ringbuf_write(ab->rb, frames, nb * ab->in_frame_size);
+
+    return nb;
+}
+
+/* Discard everything that has not been played yet */
+void audio_buffer_flush(audio_buffer* ab) {
+    g_atomic_int_set(&ab->playing, FALSE);
+    g_atomic_int_set(&ab->draining, FALSE);
+    ringbuf_flush(ab->rb);
+    if (ab->prebuffer_ms > 0)
+        g_atomic_int_set(&ab->prebuffering, TRUE);
+}
+
+/* No more data is coming for now (end of track): play what is left without
+ * waiting for the low watermark, and don't count the end of the data as an
+ * underrun */
+void audio_buffer_drain(audio_buffer* ab) {
+    g_atomic_int_set(&ab->draining, TRUE);
+    audio_buffer_wake(ab);
+}
+
+/* Stop giving frames to the consumer, but keep them */
+void audio_buffer_pause(audio_buffer* ab) {
+    g_atomic_int_set(&ab->paused, TRUE);
+    audio_buffer_wake(ab);
+}
+
+/* Play the kept frames right away (no prebuffering) */
+void audio_buffer_resume(audio_buffer* ab) {
+    g_mutex_lock(&ab->pause_mutex);
+    g_atomic_int_set(&ab->paused, FALSE);
+    g_cond_signal(&ab->pause_cond);
+    g_mutex_unlock(&ab->pause_mutex);
+}
+
+/* Get a pointer to at most max_size bytes (whole frames only) that can be
+ * played. Returns 0 if there is nothing to play yet, in which case the consumer
+ * should call audio_buffer_wait(). */
+gsize audio_buffer_peek(audio_buffer* ab, gpointer* ptr, gsize max_size) {
+    gsize size;
+
+    _audio_buffer_update_format(ab);
+
+    if (g_atomic_int_get(&ab->paused))
+        return 0;
+
+    /* Nothing more will come in the current format before it's all played, so
+       don't wait for the low watermark then */
+    if (g_atomic_int_get(&ab->prebuffering)) {
+        if ((ringbuf_fill(ab->rb) < ab->low_watermark) && !g_atomic_int_get(&ab->draining) &&
+            !g_atomic_int_get(&ab->format_changed))
+            return 0;
+        g_atomic_int_set(&ab->prebuffering, FALSE);
+    }
+
+    size = ringbuf_peek(ab->rb, ptr);
+    if (size == 0)
+        return 0;
+    size = MIN(size, max_size);
+    size -= size % ab->frame_size;
+
+    if ((size == 0) && (max_size >= ab->frame_size)) {
+        /* A frame wraps around the end of the ring buffer: use a copy */
+        if (ringbuf_read(ab->rb, ab->bounce, ab->frame_size) == ab->frame_size) {
+            ab->bounced = TRUE;
+            *ptr = ab->bounce;
+            size = ab->frame_size;
+        }
+    }
+
+    return size;
+}
+
+/* Release data returned by audio_buffer_peek() once it has been played */
+void audio_buffer_consume(audio_buffer* ab, gsize size) {
+    if (ab->bounced)
+        ab->bounced = FALSE;
+    else
+        ringbuf_consume(ab->rb, size);
+}
+
+/* Wait until playback is resumed, audio_buffer_wake() is called, or timeout */
+static gboolean _audio_buffer_wait_resume(audio_buffer* ab, gint64 end_time) {
+    gboolean ret = TRUE;
+
+    g_mutex_lock(&ab->pause_mutex);
+    while (g_atomic_int_get(&ab->paused) && !ab->pause_kicked) {
+        if (end_time < 0)
+            g_cond_wait(&ab->pause_cond, &ab->pause_mutex);
+        else if (!g_cond_wait_until(&ab->pause_cond, &ab->pause_mutex, end_time)) {
+            ret = FALSE;
+            break;
+        }
+    }
+    ab->pause_kicked = FALSE;
+    g_mutex_unlock(&ab->pause_mutex);
+
+    return ret;
+}
+
+/* Wait for something to play, ring buffer wake-up, or timeout (end_time is a
+ * monotonic time, -1 for no timeout). Returns FALSE on timeout. Underruns are
+ * accounted here, since this is only called when the consumer is starved. */
+gboolean audio_buffer_wait(audio_buffer* ab, gint64 end_time) {
+    gsize fill;
+
+    /* Let the consumer look at the new format before it waits for frames */
+    if (_audio_buffer_update_format(ab))
+        return TRUE;
+
+    if (g_atomic_int_get(&ab->paused))
+        return _audio_buffer_wait_resume(ab, end_time);
+
+    fill = ringbuf_fill(ab->rb);
+
+    if ((fill > 0) && g_atomic_int_get(&ab->prebuffering) && !g_atomic_int_get(&ab->draining)) {
+        /* Not enough data to start playing yet. The ring buffer only wakes us
+           up when it was empty, so poll until the low watermark is reached. */
+        g_usleep(PREBUFFER_POLL);
+        return TRUE;
+    }
+
+    if ((fill == 0) && g_atomic_int_get(&ab->draining)) {
+        /* Everything was played */
+        g_atomic_int_set(&ab->playing, FALSE);
+    }
+    else if ((fill == 0) && g_atomic_int_get(&ab->playing) && !g_atomic_int_get(&ab->prebuffering)) {
+        /* Buffer underrun */
+        g_atomic_int_inc(&ab->stutters);
+        ab->underruns += 1;
+        if (ab->low_watermark > 0)
+            g_atomic_int_set(&ab->prebuffering, TRUE);
+    }
+
+    return ringbuf_wait(ab->rb, end_time);
+}
+
+/* Make audio_buffer_wait() return now */
+void audio_buffer_wake(audio_buffer* ab) {
+    ringbuf_wake(ab->rb);
+
+    g_mutex_lock(&ab->pause_mutex);
+    ab->pause_kicked = TRUE;
+    g_cond_signal(&ab->pause_cond);
+    g_mutex_unlock(&ab->pause_mutex);
+}
+
+/* Number of frames waiting to be played */
+int audio_buffer_frames(audio_buffer* ab) {
+    size_t frame_size;
+
+    if (!ab)
+        return 0;
+    frame_size = ab->frame_size;
+    if (frame_size == 0)
+        return 0;
+    return ringbuf_fill(ab->rb) / frame_size;
+}
+
+gboolean audio_buffer_paused(audio_buffer* ab) {
+    return ab && g_atomic_int_get(&ab->paused);
+}
+
+/* Implementation of get_audio_buffer_stats() for the audio plugins */
+void audio_buffer_stats(audio_buffer* ab, sp_audio_buffer_stats* stats) {
+    stats->samples = audio_buffer_frames(ab);
+    stats->stutter = ab ? g_atomic_int_and(&ab->stutters, 0) : 0;
+
+    if (stats->stutter > 0)
+        g_debug("%s stats: samples: %d; stutter: %d (%u underruns so far)",
+                ab->name, stats->samples, stats->stutter, ab->underruns);
+}
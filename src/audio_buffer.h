@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef AUDIO_BUFFER_H
+#define AUDIO_BUFFER_H
+
+#include <glib.h>
+#include <libspotify/api.h>
+
+#include "ringbuf.h"
+
+/* Buffering shared by the audio plugins.
+ *
+ * audio_delivery() (the producer, called from libspotify's thread) copies
+ * frames to the buffer, and the plugin's player thread (the consumer) sends
+ * them to the actual output. Only whole frames are ever written or read.
+ *
+ * The high watermark limits how much audio is buffered (and hence the output
+ * latency). The low watermark is used after an underrun: the consumer does not
+ * start playing again until that much audio is available, so that a slow
+ * delivery results in one clean gap instead of many small stutters.
+ *
+ * While paused, the consumer gets nothing to play but the buffered audio is
+ * kept, so that playback restarts right away on resume.
+ *
+ * A new format only applies to the consumer (format, frame_size) once all the
+ * frames written in the previous one have been played: until then the producer
+ * can't write anything. So the consumer can use these fields without a lock,
+ * and they always describe the frames it gets from audio_buffer_peek(). */
+typedef struct {
+    const gchar*   name;
+    ringbuf*       rb;
+    sp_audioformat format;      /* Owned by the consumer */
+    size_t         frame_size;
+
+    guint buffer_ms;
+    guint prebuffer_ms;
+    gsize low_watermark;        /* In bytes, owned by the consumer */
+
+    /* Format given by the producer, and not yet used by the consumer while
+       format_changed is set */
+    GMutex         format_mutex;
+    sp_audioformat in_format;
+    size_t         in_frame_size;
+    gsize          high_watermark;  /* In bytes, owned by the producer */
+    gint           format_changed;
+
+    gint  playing;
+    gint  prebuffering;
+    gint  draining;
+    gint  paused;
+    guint stutters;
+    guint underruns;
+
+    /* Used to park the consumer while paused */
+    GMutex pause_mutex;
+    GCond  pause_cond;
+    gint   pause_kicked;
+
+    /* Used when a frame wraps around the end of the ring buffer */
+    gboolean bounced;
+    guint8   bounce[64];
+} audio_buffer;
+
+audio_buffer* audio_buffer_new(const gchar* name);
+void audio_buffer_free(audio_buffer* ab);
+
+/* Producer side */
+void audio_buffer_set_format(audio_buffer* ab, const sp_audioformat* format);
+int audio_buffer_write(audio_buffer* ab, const void* frames, int num_frames);
+void audio_buffer_flush(audio_buffer* ab);
+void audio_buffer_drain(audio_buffer* ab);
+void audio_buffer_pause(audio_buffer* ab);
+void audio_buffer_resume(audio_buffer* ab);
+
+/* Consumer side */
+gsize audio_buffer_peek(audio_buffer* ab, gpointer* ptr, gsize max_size);
+void audio_buffer_consume(audio_buffer* ab, gsize size);
+gboolean audio_buffer_wait(audio_buffer* ab, gint64 end_time);
+void audio_buffer_wake(audio_buffer* ab);
+
+/* Information about the buffer */
+int audio_buffer_frames(audio_buffer* ab);
+gboolean audio_buffer_paused(audio_buffer* ab);
+void audio_buffer_stats(audio_buffer* ab, sp_audio_buffer_stats* stats);
+
+#endif
@@ -24,7 +24,6 @@
  */
 
 #include <glib.h>
-#include <json-glib/json-glib.h>
 #include <libspotify/api.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,23 +33,26 @@
 #include "commands.h"
 #include "config.h"
 #include "interface.h"
+#include "json_writer.h"
+#include "output.h"
+#include "plugin.h"
 #include "queue.h"
 #include "spotify.h"
 #include "utils.h"
 
 /* {{{ JSON helpers */
-#define jb_add_bool(jb, name, val) {\
-    json_builder_set_member_name(jb, name); \
-    json_builder_add_boolean_value(jb, val); }
-#define jb_add_double(jb, name, val) {\
-    json_builder_set_member_name(jb, name); \
-    json_builder_add_double_value(jb, val); }
-#define jb_add_int(jb, name, val) {\
-    json_builder_set_member_name(jb, name); \
-    json_builder_add_int_value(jb, val); }
-#define jb_add_string(jb, name, val) {\
-    json_builder_set_member_name(jb, name); \
-    json_builder_add_string_value(jb, val); }
+#define jw_add_bool(jw, name, val) {\
+    json_writer_set_member_name(jw, name); \
+    json_writer_add_boolean_value(jw, val); }
+#define jw_add_double(jw, name, val) {\
+    json_writer_set_member_name(jw, name); \
+    json_writer_add_double_value(jw, val); }
+#define jw_add_int(jw, name, val) {\
+    json_writer_set_member_name(jw, name); \
+    json_writer_add_int_value(jw, val); }
+#define jw_add_string(jw, name, val) {\
+    json_writer_set_member_name(jw, name); \
+    json_writer_add_string_value(jw, val); }
 
 typedef enum { UICRT_ERROR=-1, UICRT_DONE, UICRT_WAIT } uri_image_cb_result_type;
 typedef struct {
@@ -63,7 +65,9 @@ typedef struct {
     sp_image* image;
 } uri_image_cb_data;
 
-static void json_tracks_array(GArray* tracks, JsonBuilder* jb) {
+/* The index of each track is its position in the complete list: offset is the
+   position of the first track of the array */
+static void json_tracks_array(GArray* tracks, guint offset, json_writer* jw) {
     int i;
     sp_track* track;
 
@@ -84,17 +88,17 @@ static void json_tracks_array(GArray* tracks, JsonBuilder* jb) {
         track_get_data(track, &track_name, &track_artist, &track_album, &track_link,
                        &track_duration, &track_popularity, &track_starred);
 
-        json_builder_begin_object(jb);
-        jb_add_string(jb, "artist", track_artist);
-        jb_add_string(jb, "title", track_name);
-        jb_add_string(jb, "album", track_album);
-        jb_add_int(jb, "duration", track_duration);
-        jb_add_string(jb, "uri", track_link);
-        jb_add_bool(jb, "available", track_avail);
-        jb_add_int(jb, "popularity", track_popularity);
-        jb_add_bool(jb, "starred", track_starred);
-        jb_add_int(jb, "index", i+1);
-        json_builder_end_object(jb);
+        json_writer_begin_object(jw);
+        jw_add_string(jw, "artist", track_artist);
+        jw_add_string(jw, "title", track_name);
+        jw_add_string(jw, "album", track_album);
+        jw_add_int(jw, "duration", track_duration);
+        jw_add_string(jw, "uri", track_link);
+        jw_add_bool(jw, "available", track_avail);
+        jw_add_int(jw, "popularity", track_popularity);
+        jw_add_bool(jw, "starred", track_starred);
+        jw_add_int(jw, "index", offset+i+1);
+        json_writer_end_object(jw);
 
         g_free(track_name);
         g_free(track_artist);
@@ -102,22 +106,22 @@ static void json_tracks_array(GArray* tracks, JsonBuilder* jb) {
         g_free(track_link);
     }
 }
-static void json_playlist_offline_status(sp_playlist* pl, JsonBuilder* jb) {
+static void json_playlist_offline_status(sp_playlist* pl, json_writer* jw) {
     sp_playlist_offline_status pos = playlist_get_offline_status(pl);
-    json_builder_set_member_name(jb, "offline");
+    json_writer_set_member_name(jw, "offline");
     switch(pos) {
     case SP_PLAYLIST_OFFLINE_STATUS_NO:
-        json_builder_add_boolean_value(jb, FALSE); break;
+        json_writer_add_boolean_value(jw, FALSE); break;
     case SP_PLAYLIST_OFFLINE_STATUS_YES:
-        json_builder_add_boolean_value(jb, TRUE); break;
+        json_writer_add_boolean_value(jw, TRUE); break;
     case SP_PLAYLIST_OFFLINE_STATUS_DOWNLOADING:
-        json_builder_add_string_value(jb, "downloading");
-        jb_add_int(jb, "offline_progress", playlist_get_offline_download_completed(pl));
+        json_writer_add_string_value(jw, "downloading");
+        jw_add_int(jw, "offline_progress", playlist_get_offline_download_completed(pl));
         break;
     case SP_PLAYLIST_OFFLINE_STATUS_WAITING:
-        json_builder_add_string_value(jb, "waiting"); break;
+        json_writer_add_string_value(jw, "waiting"); break;
     default:
-        json_builder_add_string_value(jb, "unknown");
+        json_writer_add_string_value(jw, "unknown");
     }
 }
 /* }}} */
@@ -129,10 +133,10 @@ static void json_playlist_offline_status(sp_playlist* pl, JsonBuilder* jb) {
 gboolean command_run(command_finalize_func finalize, gpointer finalize_data, command_descriptor* desc, int argc, char** argv) {
     gboolean ret = TRUE;
     command_context* ctx = g_new(command_context, 1);
-    ctx->jb = json_builder_new();
+    ctx->jw = json_writer_new(config_get_bool_opt("pretty_json", FALSE));
     ctx->finalize = finalize;
     ctx->finalize_data = finalize_data;
-    json_builder_begin_object(ctx->jb);
+    json_writer_begin_object(ctx->jw);
 
 #define _str_to_uint(dst, src)                  \
     guint dst; {                                \
@@ -140,7 +144,7 @@ gboolean command_run(command_finalize_func finalize, gpointer finalize_data, com
     dst = strtoul(src, &endptr, 0);             \
     if (endptr == src) {                        \
         g_debug("Invalid argument: %s", src);   \
-        jb_add_string(ctx->jb, "error", "invalid argument (should be an unsigned integer)"); \
+        jw_add_string(ctx->jw, "error", "invalid argument (should be an unsigned integer)"); \
         goto cr_end;                            \
     }}
 #define _str_to_link(dst, src)                  \
@@ -148,7 +152,7 @@ gboolean command_run(command_finalize_func finalize, gpointer finalize_data, com
     dst = sp_link_create_from_string(src);      \
     if (!dst) {                                 \
         g_debug("Invalid argument: %s", src);   \
-        jb_add_string(ctx->jb, "error", "invalid argument (should be a Spotify URI)"); \
+        jw_add_string(ctx->jw, "error", "invalid argument (should be a Spotify URI)"); \
         goto cr_end;                                                    \
     }}
 
@@ -162,11 +166,17 @@ gboolean command_run(command_finalize_func finalize, gpointer finalize_data, com
             gboolean (*cmd)(command_context*, guint) = desc->func;
             ret = cmd(ctx, arg1);
         }
-        else if (desc->args[1] == CA_INT) {
+        else if ((desc->args[1] == CA_INT) && (desc->args[2] == CA_NONE)) {
             _str_to_uint(arg2, argv[2]);
             gboolean (*cmd)(command_context*, guint, guint) = desc->func;
             ret = cmd(ctx, arg1, arg2);
         }
+        else if ((desc->args[1] == CA_INT) && (desc->args[2] == CA_INT)) {
+            _str_to_uint(arg2, argv[2]);
+            _str_to_uint(arg3, argv[3]);
+            gboolean (*cmd)(command_context*, guint, guint, guint) = desc->func;
+            ret = cmd(ctx, arg1, arg2, arg3);
+        }
         else
             g_error("Unknown argument type");
     }
@@ -176,6 +186,12 @@ gboolean command_run(command_finalize_func finalize, gpointer finalize_data, com
             gboolean (*cmd)(command_context*, const gchar*) = desc->func;
             ret = cmd(ctx, arg1);
         }
+        else if ((desc->args[1] == CA_INT) && (desc->args[2] == CA_INT)) {
+            _str_to_uint(arg2, argv[2]);
+            _str_to_uint(arg3, argv[3]);
+            gboolean (*cmd)(command_context*, const gchar*, guint, guint) = desc->func;
+            ret = cmd(ctx, arg1, arg2, arg3);
+        }
         else
             g_error("Unknown argument type");
     }
@@ -201,22 +217,16 @@ gboolean command_run(command_finalize_func finalize, gpointer finalize_data, com
     return ret;
 }
 
-/* End the command: prepare JSON output, finalize it (most of the time send it to an IO channel), free the context */
+/* End the command: finish the JSON output, finalize it (most of the time send it to an IO channel), free the context */
 void command_end(command_context* ctx) {
-    json_builder_end_object(ctx->jb);
-    JsonGenerator* gen = json_generator_new();
-    g_object_set(gen, "pretty", config_get_bool_opt("pretty_json", FALSE), NULL);
-    json_generator_set_root(gen, json_builder_get_root(ctx->jb));
+    GString* str;
 
-    gchar* str = json_generator_to_data(gen, NULL);
-    g_object_unref(gen);
-    g_object_unref(ctx->jb);
+    json_writer_end_object(ctx->jw);
+    str = json_writer_free(ctx->jw, FALSE);
+    g_string_append_c(str, '\n');
 
-    gchar* strn = g_strconcat(str, "\n", NULL);
-    g_free(str);
-
-    ctx->finalize(strn, ctx->finalize_data);
-    g_free(strn);
+    ctx->finalize(str, ctx->finalize_data);
+    g_string_free(str, TRUE);
     g_free(ctx);
 }
 /* }}} */
@@ -228,37 +238,37 @@ gboolean help(command_context* ctx) {
   int i, n;
   command_arg arg;
 
-  json_builder_set_member_name(ctx->jb, "commands");
-  json_builder_begin_array(ctx->jb);
+  json_writer_set_member_name(ctx->jw, "commands");
+  json_writer_begin_array(ctx->jw);
 
   for (i = 0; g_commands[i].name != NULL; i++) {
     // name property
-    json_builder_begin_object(ctx->jb);
-    jb_add_string(ctx->jb, "command", g_commands[i].name);
+    json_writer_begin_object(ctx->jw);
+    jw_add_string(ctx->jw, "command", g_commands[i].name);
 
     // args array property
-    json_builder_set_member_name(ctx->jb, "args");
-    json_builder_begin_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "args");
+    json_writer_begin_array(ctx->jw);
     for (n = 0; n < MAX_CMD_ARGS && g_commands[i].desc.args[n] != CA_NONE; n++) {
       arg = g_commands[i].desc.args[n];
       if (arg == CA_INT) {
-        json_builder_add_string_value(ctx->jb, "Integer");
+        json_writer_add_string_value(ctx->jw, "Integer");
       } else if (arg == CA_STR) {
-        json_builder_add_string_value(ctx->jb, "String");
+        json_writer_add_string_value(ctx->jw, "String");
       } else if (arg == CA_URI) {
-        json_builder_add_string_value(ctx->jb, "URI");
+        json_writer_add_string_value(ctx->jw, "URI");
       } else {
-        json_builder_add_string_value(ctx->jb, "undefined");
+        json_writer_add_string_value(ctx->jw, "undefined");
       }
     }
-    json_builder_end_array(ctx->jb); // end args array
-    jb_add_string(ctx->jb, "summary", g_commands[i].summary);
+    json_writer_end_array(ctx->jw); // end args array
+    jw_add_string(ctx->jw, "summary", g_commands[i].summary);
 
-    json_builder_end_object(ctx->jb); // end command object
+    json_writer_end_object(ctx->jw); // end command object
   }
-  json_builder_end_array(ctx->jb); // end commands array
+  json_writer_end_array(ctx->jw); // end commands array
 
-  jb_add_string(ctx->jb, "version", SPOP_VERSION);
+  jw_add_string(ctx->jw, "version", SPOP_VERSION);
 
   return TRUE;
 }
@@ -276,8 +286,8 @@ gboolean list_playlists(command_context* ctx) {
     gchar uri[1024];
 
     n = playlists_len();
-    json_builder_set_member_name(ctx->jb, "playlists");
-    json_builder_begin_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "playlists");
+    json_writer_begin_array(ctx->jw);
 
     for (i=0; i<n; i++) {
         pt = playlist_type(i);
@@ -285,34 +295,34 @@ gboolean list_playlists(command_context* ctx) {
         case SP_PLAYLIST_TYPE_START_FOLDER:
             g_debug("Playlist %d is a folder start", i);
 
-            json_builder_begin_object(ctx->jb);
+            json_writer_begin_object(ctx->jw);
             pfn = playlist_folder_name(i);
-            jb_add_string(ctx->jb, "name", pfn);
+            jw_add_string(ctx->jw, "name", pfn);
             g_free(pfn);
 
-            jb_add_string(ctx->jb, "type", "folder");
+            jw_add_string(ctx->jw, "type", "folder");
 
-            json_builder_set_member_name(ctx->jb, "playlists");
-            json_builder_begin_array(ctx->jb);
+            json_writer_set_member_name(ctx->jw, "playlists");
+            json_writer_begin_array(ctx->jw);
             break;
 
         case SP_PLAYLIST_TYPE_END_FOLDER:
             g_debug("Playlist %d is a folder end", i);
-            json_builder_end_array(ctx->jb);
-            json_builder_end_object(ctx->jb);
+            json_writer_end_array(ctx->jw);
+            json_writer_end_object(ctx->jw);
             break;
 
         case SP_PLAYLIST_TYPE_PLAYLIST:
             pl = playlist_get(i);
-            json_builder_begin_object(ctx->jb);
+            json_writer_begin_object(ctx->jw);
             if (!pl) {
                 g_debug("Got NULL pointer when loading playlist %d.", i);
-                json_builder_end_object(ctx->jb);
+                json_writer_end_object(ctx->jw);
                 break;
             }
             if (!sp_playlist_is_loaded(pl)) {
                 g_debug("Playlist %d is not loaded.", i);
-                json_builder_end_object(ctx->jb);
+                json_writer_end_object(ctx->jw);
                 break;
             }
             if (i == 0)
@@ -324,23 +334,23 @@ gboolean list_playlists(command_context* ctx) {
                 /* Regular playlist */
                 t = sp_playlist_num_tracks(pl);
 
-                jb_add_string(ctx->jb, "type", "playlist");
-                jb_add_string(ctx->jb, "name", pn);
-                jb_add_int(ctx->jb, "tracks", t);
-                json_playlist_offline_status(pl, ctx->jb);
-                jb_add_int(ctx->jb, "index", i);
+                jw_add_string(ctx->jw, "type", "playlist");
+                jw_add_string(ctx->jw, "name", pn);
+                jw_add_int(ctx->jw, "tracks", t);
+                json_playlist_offline_status(pl, ctx->jw);
+                jw_add_int(ctx->jw, "index", i);
 
                 lnk = sp_link_create_from_playlist(pl);
                 if (sp_link_as_string(lnk, uri, 1024) < 1024) {
-                    jb_add_string(ctx->jb, "uri", uri);
+                    jw_add_string(ctx->jw, "uri", uri);
                 }
                 sp_link_release(lnk);
             }
             else {
                 /* Playlist separator */
-                jb_add_string(ctx->jb, "type", "separator");
+                jw_add_string(ctx->jw, "type", "separator");
             }
-            json_builder_end_object(ctx->jb);
+            json_writer_end_object(ctx->jw);
             break;
 
         default:
@@ -348,45 +358,58 @@ gboolean list_playlists(command_context* ctx) {
         }
     }
 
-    json_builder_end_array(ctx->jb);
+    json_writer_end_array(ctx->jw);
     return TRUE;
 }
 
-gboolean list_tracks(command_context* ctx, guint idx) {
+static gboolean _list_tracks(command_context* ctx, guint idx, guint offset, guint count, gboolean paged) {
     sp_playlist* pl;
     GArray* tracks;
 
     /* Get the playlist */
     pl = playlist_get(idx);
     if (!pl) {
-        jb_add_string(ctx->jb, "error", "invalid playlist");
+        jw_add_string(ctx->jw, "error", "invalid playlist");
         return TRUE;
     }
 
-    /* Get the tracks array */
-    // FIXME
-    tracks = tracks_get_playlist(pl);
+    /* Get the tracks array: only the requested ones, so that the cost of a
+       page doesn't depend on the size of the playlist */
+    tracks = tracks_get_playlist_range(pl, offset, count);
     if (!tracks) {
-        jb_add_string(ctx->jb, "error", "playlist not loaded yet");
+        jw_add_string(ctx->jw, "error", "playlist not loaded yet");
         return TRUE;
     }
 
-    jb_add_string(ctx->jb, "name", sp_playlist_name(pl));
+    jw_add_string(ctx->jw, "name", sp_playlist_name(pl));
     const gchar* desc = sp_playlist_get_description(pl);
     if (desc) {
-        jb_add_string(ctx->jb, "description", desc);
+        jw_add_string(ctx->jw, "description", desc);
     }
 
-    json_builder_set_member_name(ctx->jb, "tracks");
-    json_builder_begin_array(ctx->jb);
-    json_tracks_array(tracks, ctx->jb);
-    json_builder_end_array(ctx->jb);
+    if (paged) {
+        jw_add_int(ctx->jw, "total_tracks", sp_playlist_num_tracks(pl));
+        jw_add_int(ctx->jw, "offset", offset);
+    }
+
+    json_writer_set_member_name(ctx->jw, "tracks");
+    json_writer_begin_array(ctx->jw);
+    json_tracks_array(tracks, offset, ctx->jw);
+    json_writer_end_array(ctx->jw);
     g_array_free(tracks, TRUE);
 
-    json_playlist_offline_status(pl, ctx->jb);
+    json_playlist_offline_status(pl, ctx->jw);
 
     return TRUE;
 }
+
+gboolean list_tracks(command_context* ctx, guint idx) {
+    return _list_tracks(ctx, idx, 0, G_MAXUINT, FALSE);
+}
+
+gboolean list_tracks_range(command_context* ctx, guint idx, guint offset, guint count) {
+    return _list_tracks(ctx, idx, offset, count, TRUE);
+}
 /* }}} */
 /* {{{ Status and play mode */
 gboolean status(command_context* ctx) {
@@ -403,29 +426,33 @@ gboolean status(command_context* ctx) {
 
     qs = queue_get_status(&track, &track_nb, &total_tracks);
 
-    jb_add_string(ctx->jb, "status",
+    jw_add_string(ctx->jw, "status",
                   (qs == PLAYING) ? "playing"
                   : ((qs == PAUSED) ? "paused" : "stopped"));
 
-    jb_add_bool(ctx->jb, "repeat", queue_get_repeat());
-    jb_add_bool(ctx->jb, "shuffle", queue_get_shuffle());
-    jb_add_int(ctx->jb, "total_tracks", total_tracks);
+    jw_add_bool(ctx->jw, "repeat", queue_get_repeat());
+    jw_add_bool(ctx->jw, "shuffle", queue_get_shuffle());
+    jw_add_int(ctx->jw, "volume", output_get_volume());
+    jw_add_int(ctx->jw, "total_tracks", total_tracks);
+    if (session_transition_gap() >= 0)
+        jw_add_int(ctx->jw, "transition_gap", session_transition_gap());
 
     if (qs != STOPPED) {
-        jb_add_int(ctx->jb, "current_track", track_nb+1);
+        jw_add_int(ctx->jw, "current_track", track_nb+1);
 
         track_get_data(track, &track_name, &track_artist, &track_album, &track_link,
                        &track_duration, &track_popularity, &track_starred);
         track_position = session_play_time();
 
-        jb_add_string(ctx->jb, "artist", track_artist);
-        jb_add_string(ctx->jb, "title", track_name);
-        jb_add_string(ctx->jb, "album", track_album);
-        jb_add_int(ctx->jb, "duration", track_duration);
-        jb_add_double(ctx->jb, "position", track_position/1000.);
-        jb_add_string(ctx->jb, "uri", track_link);
-        jb_add_int(ctx->jb, "popularity", track_popularity);
-        jb_add_bool(ctx->jb, "starred", track_starred)
+        jw_add_string(ctx->jw, "artist", track_artist);
+        jw_add_string(ctx->jw, "title", track_name);
+        jw_add_string(ctx->jw, "album", track_album);
+        jw_add_int(ctx->jw, "duration", track_duration);
+        jw_add_double(ctx->jw, "position", track_position/1000.);
+        jw_add_double(ctx->jw, "delivered_position", session_delivered_time() / (gdouble) G_USEC_PER_SEC);
+        jw_add_string(ctx->jw, "uri", track_link);
+        jw_add_int(ctx->jw, "popularity", track_popularity);
+        jw_add_bool(ctx->jw, "starred", track_starred)
         g_free(track_name);
         g_free(track_artist);
         g_free(track_album);
@@ -434,6 +461,66 @@ gboolean status(command_context* ctx) {
     return TRUE;
 }
 
+static void jw_add_latency_stats(json_writer* jw, const gchar* name, const latency_stats* ls) {
+    json_writer_set_member_name(jw, name);
+    json_writer_begin_object(jw);
+    jw_add_int(jw, "count", ls->count);
+    if (ls->count > 0) {
+        jw_add_double(jw, "last", ls->last / 1000.);
+        jw_add_double(jw, "min", ls->min / 1000.);
+        jw_add_double(jw, "avg", latency_stats_avg(ls) / 1000.);
+        jw_add_double(jw, "max", ls->max / 1000.);
+    }
+    json_writer_end_object(jw);
+}
+
+gboolean stats(command_context* ctx) {
+    gint64 delivered = session_delivered_time();
+    gint64 played = session_played_time();
+    GArray* stages;
+    interface_stats clients;
+    int i;
+
+    /* All durations in ms */
+    jw_add_double(ctx->jw, "output_latency", MAX(delivered - played, 0) / 1000.);
+    if (session_transition_gap() >= 0)
+        jw_add_int(ctx->jw, "transition_gap", session_transition_gap());
+    jw_add_latency_stats(ctx->jw, "seek_latency", session_seek_latency());
+    jw_add_latency_stats(ctx->jw, "resume_latency", session_resume_latency());
+
+    /* Processing time of each stage of the output, and how much of the real
+       time it uses (in %) */
+    stages = output_get_stages();
+    json_writer_set_member_name(ctx->jw, "output_stages");
+    json_writer_begin_array(ctx->jw);
+    for (i=0; i < stages->len; i++) {
+        output_stage* st = &g_array_index(stages, output_stage, i);
+
+        json_writer_begin_object(ctx->jw);
+        jw_add_string(ctx->jw, "name", st->name);
+        jw_add_int(ctx->jw, "frames", st->frames);
+        if (st->audio_time > 0)
+            jw_add_double(ctx->jw, "load", (100. * st->time.sum) / st->audio_time);
+        jw_add_latency_stats(ctx->jw, "time", &st->time);
+        json_writer_end_object(ctx->jw);
+    }
+    json_writer_end_array(ctx->jw);
+    g_array_free(stages, TRUE);
+
+    /* Connected clients, and answers waiting to be sent to them (in bytes) */
+    interface_get_stats(&clients);
+    json_writer_set_member_name(ctx->jw, "clients");
+    json_writer_begin_object(ctx->jw);
+    jw_add_int(ctx->jw, "connected", clients.clients);
+    jw_add_int(ctx->jw, "queued", clients.queued);
+    jw_add_int(ctx->jw, "max_queued", clients.max_queued);
+    jw_add_int(ctx->jw, "peak_queued", clients.peak_queued);
+    jw_add_int(ctx->jw, "dropped", clients.dropped);
+    json_writer_end_object(ctx->jw);
+
+    return TRUE;
+}
+
 gboolean notify(command_context* ctx) {
     queue_notify();
     return status(ctx);
@@ -445,11 +532,39 @@ gboolean repeat(command_context* ctx) {
     return status(ctx);
 }
 
+gboolean volume(command_context* ctx, guint vol) {
+    output_set_volume(vol);
+    queue_notify();
+    return status(ctx);
+}
+
 gboolean shuffle(command_context* ctx) {
     gboolean s = queue_get_shuffle();
     queue_set_shuffle(TRUE, !s);
     return status(ctx);
 }
+
+gboolean get_output(command_context* ctx) {
+    jw_add_string(ctx->jw, "output", g_audio->name);
+    return TRUE;
+}
+
+static void _set_output_cb(gpointer data) {
+    command_context* ctx = data;
+    get_output(ctx);
+    command_end(ctx);
+}
+gboolean set_output(command_context* ctx, const gchar* name) {
+    if (g_strcmp0(name, g_audio->name) == 0)
+        return get_output(ctx);
+
+    /* The answer is sent once the new output is in use */
+    if (!session_switch_output(name, _set_output_cb, ctx)) {
+        jw_add_string(ctx->jw, "error", "can't switch to this audio output");
+        return TRUE;
+    }
+    return FALSE;
+}
 /* }}} */
 /* {{{ Queue */
 gboolean list_queue(command_context* ctx) {
@@ -459,10 +574,30 @@ gboolean list_queue(command_context* ctx) {
     if (!tracks)
         g_error("Couldn't read queue.");
 
-    json_builder_set_member_name(ctx->jb, "tracks");
-    json_builder_begin_array(ctx->jb);
-    json_tracks_array(tracks, ctx->jb);
-    json_builder_end_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "tracks");
+    json_writer_begin_array(ctx->jw);
+    json_tracks_array(tracks, 0, ctx->jw);
+    json_writer_end_array(ctx->jw);
+    g_array_free(tracks, TRUE);
+    return TRUE;
+}
+
+gboolean list_queue_range(command_context* ctx, guint offset, guint count) {
+    GArray* tracks;
+    int total_tracks;
+
+    tracks = queue_tracks_range(offset, count);
+    if (!tracks)
+        g_error("Couldn't read queue.");
+
+    queue_get_status(NULL, NULL, &total_tracks);
+    jw_add_int(ctx->jw, "total_tracks", total_tracks);
+    jw_add_int(ctx->jw, "offset", offset);
+
+    json_writer_set_member_name(ctx->jw, "tracks");
+    json_writer_begin_array(ctx->jw);
+    json_tracks_array(tracks, offset, ctx->jw);
+    json_writer_end_array(ctx->jw);
     g_array_free(tracks, TRUE);
     return TRUE;
 }
@@ -486,7 +621,7 @@ gboolean play_playlist(command_context* ctx, guint idx) {
 
     /* First check the playlist type */
     if (playlist_type(idx) != SP_PLAYLIST_TYPE_PLAYLIST) {
-        jb_add_string(ctx->jb, "error", "not a playlist");
+        jw_add_string(ctx->jw, "error", "not a playlist");
         return TRUE;
     }
 
@@ -494,7 +629,7 @@ gboolean play_playlist(command_context* ctx, guint idx) {
     pl = playlist_get(idx);
 
     if (!pl) {
-        jb_add_string(ctx->jb, "error", "invalid playlist");
+        jw_add_string(ctx->jw, "error", "invalid playlist");
         return TRUE;
     }
 
@@ -512,14 +647,14 @@ gboolean play_track(command_context* ctx, guint pl_idx, guint tr_idx) {
 
     /* First check the playlist type */
     if (playlist_type(pl_idx) != SP_PLAYLIST_TYPE_PLAYLIST) {
-        jb_add_string(ctx->jb, "error", "not a playlist");
+        jw_add_string(ctx->jw, "error", "not a playlist");
         return TRUE;
     }
 
     /* Then get the playlist */
     pl = playlist_get(pl_idx);
     if (!pl) {
-        jb_add_string(ctx->jb, "error", "invalid playlist");
+        jw_add_string(ctx->jw, "error", "invalid playlist");
         return TRUE;
     }
 
@@ -527,11 +662,11 @@ gboolean play_track(command_context* ctx, guint pl_idx, guint tr_idx) {
     // FIXME
     tracks = tracks_get_playlist(pl);
     if (!tracks) {
-        jb_add_string(ctx->jb, "error", "playlist not loaded yet");
+        jw_add_string(ctx->jw, "error", "playlist not loaded yet");
         return TRUE;
     }
     if ((tr_idx <= 0) || (tr_idx > tracks->len)) {
-        jb_add_string(ctx->jb, "error", "invalid track number");
+        jw_add_string(ctx->jw, "error", "invalid track number");
         g_array_free(tracks, TRUE);
         return TRUE;
     }
@@ -552,7 +687,7 @@ gboolean add_playlist(command_context* ctx, guint idx) {
 
     /* First check the playlist type */
     if (playlist_type(idx) != SP_PLAYLIST_TYPE_PLAYLIST) {
-        jb_add_string(ctx->jb, "error", "not a playlist");
+        jw_add_string(ctx->jw, "error", "not a playlist");
         return TRUE;
     }
 
@@ -560,7 +695,7 @@ gboolean add_playlist(command_context* ctx, guint idx) {
     pl = playlist_get(idx);
 
     if (!pl) {
-        jb_add_string(ctx->jb, "error", "invalid playlist");
+        jw_add_string(ctx->jw, "error", "invalid playlist");
         return TRUE;
     }
 
@@ -568,7 +703,7 @@ gboolean add_playlist(command_context* ctx, guint idx) {
     queue_add_playlist(TRUE, pl);
 
     queue_get_status(NULL, NULL, &tot);
-    jb_add_int(ctx->jb, "total_tracks", tot);
+    jw_add_int(ctx->jw, "total_tracks", tot);
     return TRUE;
 }
 
@@ -580,14 +715,14 @@ gboolean add_track(command_context* ctx, guint pl_idx, guint tr_idx) {
 
     /* First check the playlist type */
     if (playlist_type(pl_idx) != SP_PLAYLIST_TYPE_PLAYLIST) {
-        jb_add_string(ctx->jb, "error", "not a playlist");
+        jw_add_string(ctx->jw, "error", "not a playlist");
         return TRUE;
     }
 
     /* Then get the playlist */
     pl = playlist_get(pl_idx);
     if (!pl) {
-        jb_add_string(ctx->jb, "error", "invalid playlist");
+        jw_add_string(ctx->jw, "error", "invalid playlist");
         return TRUE;
     }
 
@@ -595,11 +730,11 @@ gboolean add_track(command_context* ctx, guint pl_idx, guint tr_idx) {
     // FIXME
     tracks = tracks_get_playlist(pl);
     if (!tracks) {
-        jb_add_string(ctx->jb, "error", "playlist not loaded yet");
+        jw_add_string(ctx->jw, "error", "playlist not loaded yet");
         return TRUE;
     }
     if ((tr_idx <= 0) || (tr_idx > tracks->len)) {
-        jb_add_string(ctx->jb, "error", "invalid track number");
+        jw_add_string(ctx->jw, "error", "invalid track number");
         g_array_free(tracks, TRUE);
         return TRUE;
     }
@@ -610,7 +745,7 @@ gboolean add_track(command_context* ctx, guint pl_idx, guint tr_idx) {
     queue_add_track(TRUE, tr);
 
     queue_get_status(NULL, NULL, &tot);
-    jb_add_int(ctx->jb, "total_tracks", tot);
+    jw_add_int(ctx->jw, "total_tracks", tot);
     return TRUE;
 }
 /* }}} */
@@ -654,17 +789,17 @@ gboolean offline_status(command_context* ctx) {
     session_get_offline_sync_status(&status, &sync_in_progress, &tracks_to_sync,
                                     &num_playlists, &time_left);
 
-    jb_add_int(ctx->jb, "offline_playlists", num_playlists);
-    jb_add_int(ctx->jb, "tracks_to_sync", tracks_to_sync);
-    jb_add_bool(ctx->jb, "sync_in_progress", sync_in_progress);
+    jw_add_int(ctx->jw, "offline_playlists", num_playlists);
+    jw_add_int(ctx->jw, "tracks_to_sync", tracks_to_sync);
+    jw_add_bool(ctx->jw, "sync_in_progress", sync_in_progress);
     if (sync_in_progress) {
-        jb_add_int(ctx->jb, "tracks_done", status.done_tracks);
-        jb_add_int(ctx->jb, "tracks_copied", status.copied_tracks);
-        jb_add_int(ctx->jb, "tracks_queued", status.queued_tracks);
-        jb_add_int(ctx->jb, "tracks_error", status.error_tracks);
-        jb_add_int(ctx->jb, "tracks_willnotcopy", status.willnotcopy_tracks);
+        jw_add_int(ctx->jw, "tracks_done", status.done_tracks);
+        jw_add_int(ctx->jw, "tracks_copied", status.copied_tracks);
+        jw_add_int(ctx->jw, "tracks_queued", status.queued_tracks);
+        jw_add_int(ctx->jw, "tracks_error", status.error_tracks);
+        jw_add_int(ctx->jw, "tracks_willnotcopy", status.willnotcopy_tracks);
     }
-    jb_add_int(ctx->jb, "time_before_relogin", time_left);
+    jw_add_int(ctx->jw, "time_before_relogin", time_left);
 
     return TRUE;
 }
@@ -672,7 +807,7 @@ gboolean offline_status(command_context* ctx) {
 gboolean offline_toggle(command_context* ctx, guint idx) {
     sp_playlist* pl = playlist_get(idx);
     if (!pl) {
-        jb_add_string(ctx->jb, "error", "invalid playlist");
+        jw_add_string(ctx->jw, "error", "invalid playlist");
         return TRUE;
     }
 
@@ -680,7 +815,7 @@ gboolean offline_toggle(command_context* ctx, guint idx) {
     gboolean mode = (pos != SP_PLAYLIST_OFFLINE_STATUS_NO);
     playlist_set_offline_mode(pl, !mode);
 
-    jb_add_bool(ctx->jb, "offline", !mode);
+    jw_add_bool(ctx->jw, "offline", !mode);
     return TRUE;
 }
 /* }}} */
@@ -693,22 +828,22 @@ gboolean image(command_context* ctx) {
 
     queue_get_status(&track, NULL, NULL);
     if (!track) {
-        jb_add_string(ctx->jb, "status", "empty-queue");
+        jw_add_string(ctx->jw, "status", "empty-queue");
         return TRUE;
     }
 
     res = track_get_image_data(track, (gpointer*) &img_data, &len);
     if (!res) {
         // FIXME
-        jb_add_string(ctx->jb, "status", "not-loaded");
+        jw_add_string(ctx->jw, "status", "not-loaded");
     }
     else if (!img_data) {
-        jb_add_string(ctx->jb, "status", "absent");
+        jw_add_string(ctx->jw, "status", "absent");
     }
     else {
         gchar* b64data = g_base64_encode(img_data, len);
-        jb_add_string(ctx->jb, "status", "ok");
-        jb_add_string(ctx->jb, "data", b64data);
+        jw_add_string(ctx->jw, "status", "ok");
+        jw_add_string(ctx->jw, "data", b64data);
 
         g_free(b64data);
         g_free(img_data);
@@ -725,27 +860,27 @@ static void _uri_info_album_cb(sp_albumbrowse* ab, gpointer userdata) {
     /* Check for error */
     sp_error err = sp_albumbrowse_error(ab);
     if (err != SP_ERROR_OK) {
-        jb_add_string(ctx->jb, "error", sp_error_message(err));
+        jw_add_string(ctx->jw, "error", sp_error_message(err));
         goto _uiac_clean;
     }
 
     sp_album* album = sp_albumbrowse_album(ab);
     sp_artist* artist = sp_albumbrowse_artist(ab);
 
-    jb_add_string(ctx->jb, "title", sp_album_name(album));
-    jb_add_string(ctx->jb, "artist", sp_artist_name(artist));
-    jb_add_int(ctx->jb, "year", sp_album_year(album));
+    jw_add_string(ctx->jw, "title", sp_album_name(album));
+    jw_add_string(ctx->jw, "artist", sp_artist_name(artist));
+    jw_add_int(ctx->jw, "year", sp_album_year(album));
 
     sp_albumtype type = sp_album_type(album);
-    json_builder_set_member_name(ctx->jb, "album_type");
+    json_writer_set_member_name(ctx->jw, "album_type");
     if (type == SP_ALBUMTYPE_ALBUM)
-        json_builder_add_string_value(ctx->jb, "album");
+        json_writer_add_string_value(ctx->jw, "album");
     else if (type == SP_ALBUMTYPE_SINGLE)
-        json_builder_add_string_value(ctx->jb, "single");
+        json_writer_add_string_value(ctx->jw, "single");
     else if (type == SP_ALBUMTYPE_COMPILATION)
-        json_builder_add_string_value(ctx->jb, "compilation");
+        json_writer_add_string_value(ctx->jw, "compilation");
     else
-        json_builder_add_string_value(ctx->jb, "unknown");
+        json_writer_add_string_value(ctx->jw, "unknown");
 
     GArray* tracks;
     int n = sp_albumbrowse_num_tracks(ab);
@@ -758,13 +893,13 @@ static void _uri_info_album_cb(sp_albumbrowse* ab, gpointer userdata) {
         sp_track* tr = sp_albumbrowse_track(ab, i);
         g_array_append_val(tracks, tr);
     }
-    json_builder_set_member_name(ctx->jb, "tracks");
-    json_builder_begin_array(ctx->jb);
-    json_tracks_array(tracks, ctx->jb);
-    json_builder_end_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "tracks");
+    json_writer_begin_array(ctx->jw);
+    json_tracks_array(tracks, 0, ctx->jw);
+    json_writer_end_array(ctx->jw);
     g_array_free(tracks, TRUE);
 
-    jb_add_string(ctx->jb, "review", sp_albumbrowse_review(ab));
+    jw_add_string(ctx->jw, "review", sp_albumbrowse_review(ab));
 
  _uiac_clean:
     sp_albumbrowse_release(ab);
@@ -780,12 +915,12 @@ static void _uri_info_artist_cb(sp_artistbrowse* arb, gpointer userdata) {
     /* Check for error */
     sp_error err = sp_artistbrowse_error(arb);
     if (err != SP_ERROR_OK) {
-        jb_add_string(ctx->jb, "error", sp_error_message(err));
+        jw_add_string(ctx->jw, "error", sp_error_message(err));
         goto _uiarc_clean;
     }
 
     sp_artist* artist = sp_artistbrowse_artist(arb);
-    jb_add_string(ctx->jb, "artist", sp_artist_name(artist));
+    jw_add_string(ctx->jw, "artist", sp_artist_name(artist));
 
     /* Tracks... */
     n = sp_artistbrowse_num_tracks(arb);
@@ -797,57 +932,57 @@ static void _uri_info_artist_cb(sp_artistbrowse* arb, gpointer userdata) {
         g_array_append_val(tracks, tr);
     }
 
-    json_builder_set_member_name(ctx->jb, "tracks");
-    json_builder_begin_array(ctx->jb);
-    json_tracks_array(tracks, ctx->jb);
-    json_builder_end_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "tracks");
+    json_writer_begin_array(ctx->jw);
+    json_tracks_array(tracks, 0, ctx->jw);
+    json_writer_end_array(ctx->jw);
     g_array_free(tracks, TRUE);
 
     /* Albums... */
     n = sp_artistbrowse_num_albums(arb);
-    json_builder_set_member_name(ctx->jb, "albums");
-    json_builder_begin_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "albums");
+    json_writer_begin_array(ctx->jw);
     for (i=0; i < n; i++) {
         sp_album* alb = sp_artistbrowse_album(arb, i);
-        json_builder_begin_object(ctx->jb);
+        json_writer_begin_object(ctx->jw);
 
         sp_artist* albart = sp_album_artist(alb);
-        jb_add_string(ctx->jb, "artist", sp_artist_name(albart));
+        jw_add_string(ctx->jw, "artist", sp_artist_name(albart));
 
-        jb_add_string(ctx->jb, "title", sp_album_name(alb));
-        jb_add_bool(ctx->jb, "available", sp_album_is_available(alb));
+        jw_add_string(ctx->jw, "title", sp_album_name(alb));
+        jw_add_bool(ctx->jw, "available", sp_album_is_available(alb));
 
         sp_link* lnk = sp_link_create_from_album(alb);
         if (sp_link_as_string(lnk, uri, 1024) < 1024) {
-            jb_add_string(ctx->jb, "uri", uri);
+            jw_add_string(ctx->jw, "uri", uri);
         }
         sp_link_release(lnk);
 
-        json_builder_end_object(ctx->jb);
+        json_writer_end_object(ctx->jw);
     }
-    json_builder_end_array(ctx->jb);
+    json_writer_end_array(ctx->jw);
 
     /* Similar artists... */
     n = sp_artistbrowse_num_similar_artists(arb);
-    json_builder_set_member_name(ctx->jb, "similar_artists");
-    json_builder_begin_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "similar_artists");
+    json_writer_begin_array(ctx->jw);
     for (i=0; i < n; i++) {
         sp_artist* simart = sp_artistbrowse_similar_artist(arb, i);
-        json_builder_begin_object(ctx->jb);
+        json_writer_begin_object(ctx->jw);
 
-        jb_add_string(ctx->jb, "artist", sp_artist_name(simart));
+        jw_add_string(ctx->jw, "artist", sp_artist_name(simart));
 
         sp_link* lnk = sp_link_create_from_artist(simart);
         if (sp_link_as_string(lnk, uri, 1024) < 1024) {
-            jb_add_string(ctx->jb, "uri", uri);
+            jw_add_string(ctx->jw, "uri", uri);
         }
         sp_link_release(lnk);
 
-        json_builder_end_object(ctx->jb);
+        json_writer_end_object(ctx->jw);
     }
-    json_builder_end_array(ctx->jb);
+    json_writer_end_array(ctx->jw);
 
-    jb_add_string(ctx->jb, "biography", sp_artistbrowse_biography(arb));
+    jw_add_string(ctx->jw, "biography", sp_artistbrowse_biography(arb));
 
  _uiarc_clean:
     sp_artistbrowse_release(arb);
@@ -867,7 +1002,7 @@ static gboolean _uri_info_playlist_cb(gpointer* data) {
         if (count < CMD_CALLBACK_MAX_CALLS)
             return TRUE;
         else {
-            jb_add_string(ctx->jb, "error", "playlist not loaded");
+            jw_add_string(ctx->jw, "error", "playlist not loaded");
             goto _uipc_clean;
         }
     }
@@ -889,20 +1024,20 @@ static gboolean _uri_info_playlist_cb(gpointer* data) {
         }
     }
 
-    jb_add_string(ctx->jb, "name", sp_playlist_name(pl));
+    jw_add_string(ctx->jw, "name", sp_playlist_name(pl));
     const gchar* desc = sp_playlist_get_description(pl);
     if (desc) {
-        jb_add_string(ctx->jb, "description", desc);
+        jw_add_string(ctx->jw, "description", desc);
     }
-    jb_add_string(ctx->jb, "owner", sp_user_display_name(owner));
-    jb_add_bool(ctx->jb, "collaborative", sp_playlist_is_collaborative(pl));
-    jb_add_int(ctx->jb, "subscribers", sp_playlist_num_subscribers(pl));
+    jw_add_string(ctx->jw, "owner", sp_user_display_name(owner));
+    jw_add_bool(ctx->jw, "collaborative", sp_playlist_is_collaborative(pl));
+    jw_add_int(ctx->jw, "subscribers", sp_playlist_num_subscribers(pl));
     /* TODO: image */
 
-    json_builder_set_member_name(ctx->jb, "tracks");
-    json_builder_begin_array(ctx->jb);
-    json_tracks_array(tracks, ctx->jb);
-    json_builder_end_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "tracks");
+    json_writer_begin_array(ctx->jw);
+    json_tracks_array(tracks, 0, ctx->jw);
+    json_writer_end_array(ctx->jw);
 
     g_array_free(tracks, TRUE);
 
@@ -928,7 +1063,7 @@ static gboolean _uri_info_track_cb(gpointer* data) {
         if (count < CMD_CALLBACK_MAX_CALLS)
             return TRUE;
         else {
-            jb_add_string(ctx->jb, "error", "track not loaded");
+            jw_add_string(ctx->jw, "error", "track not loaded");
             goto _uitcb_clean;
         }
     }
@@ -942,14 +1077,14 @@ static gboolean _uri_info_track_cb(gpointer* data) {
     track_get_data(track, &name, &artist, &album, NULL, &duration, &popularity, &starred);
     gboolean available = track_available(track);
 
-    jb_add_string(ctx->jb, "artist", artist);
-    jb_add_string(ctx->jb, "title", name);
-    jb_add_string(ctx->jb, "album", album);
-    jb_add_int(ctx->jb, "duration", duration);
-    jb_add_int(ctx->jb, "offset", offset);
-    jb_add_bool(ctx->jb, "available", available);
-    jb_add_int(ctx->jb, "popularity", popularity);
-    jb_add_bool(ctx->jb, "starred", starred);
+    jw_add_string(ctx->jw, "artist", artist);
+    jw_add_string(ctx->jw, "title", name);
+    jw_add_string(ctx->jw, "album", album);
+    jw_add_int(ctx->jw, "duration", duration);
+    jw_add_int(ctx->jw, "offset", offset);
+    jw_add_bool(ctx->jw, "available", available);
+    jw_add_int(ctx->jw, "popularity", popularity);
+    jw_add_bool(ctx->jw, "starred", starred);
 
     g_free(name);
     g_free(artist);
@@ -983,7 +1118,7 @@ static uri_image_cb_result_type _uri_image_cb_track(uri_image_cb_data* data) {
     track = sp_link_as_track(link);
     if (!track) {
         g_debug("Invalid track link");
-        jb_add_string(ctx->jb, "error", "invalid track link");
+        jw_add_string(ctx->jw, "error", "invalid track link");
         return UICRT_ERROR;
     }
 
@@ -993,7 +1128,7 @@ static uri_image_cb_result_type _uri_image_cb_track(uri_image_cb_data* data) {
             return UICRT_WAIT;
         else {
             g_debug("Track not loaded error");
-            jb_add_string(ctx->jb, "error", "track not loaded");
+            jw_add_string(ctx->jw, "error", "track not loaded");
             return UICRT_ERROR;
         }
     }
@@ -1019,19 +1154,19 @@ static uri_image_cb_result_type _uri_image_cb_album(uri_image_cb_data* data) {
         album = sp_link_as_album(link);
         if (!album) {
             g_debug("Invalid album link");
-            jb_add_string(ctx->jb, "error", "invalid album link");
+            jw_add_string(ctx->jw, "error", "invalid album link");
             return UICRT_ERROR;
         }
     } else if (data->track) {
         album = sp_track_album(data->track);
         if (!album) {
             g_debug("Track without album");
-            jb_add_string(ctx->jb, "error", "track without album");
+            jw_add_string(ctx->jw, "error", "track without album");
             return UICRT_ERROR;
         }
     } else {
         g_debug("Album precondition failed");
-        jb_add_string(ctx->jb, "error", "album precondition failed");
+        jw_add_string(ctx->jw, "error", "album precondition failed");
         return UICRT_ERROR;
     }
 
@@ -1041,7 +1176,7 @@ static uri_image_cb_result_type _uri_image_cb_album(uri_image_cb_data* data) {
             return UICRT_WAIT;
         else {
             g_debug("Album not loaded error");
-            jb_add_string(ctx->jb, "error", "album not loaded");
+            jw_add_string(ctx->jw, "error", "album not loaded");
             return UICRT_ERROR;
         }
     }
@@ -1064,7 +1199,7 @@ static uri_image_cb_result_type _uri_image_cb_image(uri_image_cb_data* data) {
         return UICRT_DONE;
     } else if (!data->album) {
         g_debug("Album absent");
-        jb_add_string(ctx->jb, "error", "album absent");
+        jw_add_string(ctx->jw, "error", "album absent");
         return UICRT_ERROR;
     }
 
@@ -1072,7 +1207,7 @@ static uri_image_cb_result_type _uri_image_cb_image(uri_image_cb_data* data) {
     img_id = sp_album_cover(data->album, data->size);
     if (!img_id) {
         g_debug("Image id not found");
-        jb_add_string(ctx->jb, "error", "Image absent");
+        jw_add_string(ctx->jw, "error", "Image absent");
         return UICRT_ERROR;
     }
 
@@ -1082,7 +1217,7 @@ static uri_image_cb_result_type _uri_image_cb_image(uri_image_cb_data* data) {
             return UICRT_WAIT;
         } else {
             g_debug("Image not loaded error");
-            jb_add_string(ctx->jb, "error", "image not loaded");
+            jw_add_string(ctx->jw, "error", "image not loaded");
             return UICRT_ERROR;
         }
     }
@@ -1101,7 +1236,7 @@ static uri_image_cb_result_type _uri_image_cb_image_data(uri_image_cb_data* data
 
     if (!data->image) {
         g_debug("Image not loaded");
-        jb_add_string(ctx->jb, "error", "image not loaded");
+        jw_add_string(ctx->jw, "error", "image not loaded");
       return UICRT_ERROR;
     }
 
@@ -1109,13 +1244,13 @@ static uri_image_cb_result_type _uri_image_cb_image_data(uri_image_cb_data* data
     img_data = sp_image_data(data->image, &len);
     if (!img_data) {
         g_debug("Image data absent");
-        jb_add_string(ctx->jb, "error", "image data absent");
+        jw_add_string(ctx->jw, "error", "image data absent");
         return UICRT_ERROR;
     }
 
     b64data = g_base64_encode(img_data, len);
-    jb_add_string(ctx->jb, "status", "ok");
-    jb_add_string(ctx->jb, "data", b64data);
+    jw_add_string(ctx->jw, "status", "ok");
+    jw_add_string(ctx->jw, "data", b64data);
 
     return UICRT_DONE;
 }
@@ -1198,7 +1333,7 @@ static void _uri_add_album_cb(sp_albumbrowse* ab, gpointer userdata) {
         int tot;
         queue_notify();
         queue_get_status(NULL, NULL, &tot);
-        jb_add_int(ctx->jb, "total_tracks", tot);
+        jw_add_int(ctx->jw, "total_tracks", tot);
     }
 
     sp_albumbrowse_release(ab);
@@ -1217,7 +1352,7 @@ static gboolean _uri_add_playlist_cb(gpointer* data) {
         if (count < CMD_CALLBACK_MAX_CALLS)
             return TRUE;
         else {
-            jb_add_string(ctx->jb, "error", "playlist not loaded");
+            jw_add_string(ctx->jw, "error", "playlist not loaded");
             goto _uapcb_clean;
         }
     }
@@ -1243,7 +1378,7 @@ static gboolean _uri_add_playlist_cb(gpointer* data) {
 
         int tot;
         queue_get_status(NULL, NULL, &tot);
-        jb_add_int(ctx->jb, "total_tracks", tot);
+        jw_add_int(ctx->jw, "total_tracks", tot);
     }
 
     g_array_free(tracks, TRUE);
@@ -1270,7 +1405,7 @@ static gboolean _uri_add_track_cb(gpointer* data) {
         if (count < CMD_CALLBACK_MAX_CALLS)
             return TRUE;
         else {
-            jb_add_string(ctx->jb, "error", "track not loaded");
+            jw_add_string(ctx->jw, "error", "track not loaded");
             goto _uatcb_clean;
         }
     }
@@ -1287,7 +1422,7 @@ static gboolean _uri_add_track_cb(gpointer* data) {
 
         int tot;
         queue_get_status(NULL, NULL, &tot);
-        jb_add_int(ctx->jb, "total_tracks", tot);
+        jw_add_int(ctx->jw, "total_tracks", tot);
     }
 
  _uatcb_clean:
@@ -1307,17 +1442,17 @@ gboolean uri_info(command_context* ctx, sp_link* lnk) {
 
     switch(type) {
     case SP_LINKTYPE_INVALID:
-        jb_add_string(ctx->jb, "type", "invalid");
+        jw_add_string(ctx->jw, "type", "invalid");
         sp_link_release(lnk);
         break;
 
     case SP_LINKTYPE_TRACK: {
-        jb_add_string(ctx->jb, "type", "track");
+        jw_add_string(ctx->jw, "type", "track");
 
         int offset;
         sp_track* track = sp_link_as_track_and_offset(lnk, &offset);
         if (!track) {
-            jb_add_string(ctx->jb, "error", "can't retrieve track");
+            jw_add_string(ctx->jw, "error", "can't retrieve track");
             sp_link_release(lnk);
             break;
         }
@@ -1337,11 +1472,11 @@ gboolean uri_info(command_context* ctx, sp_link* lnk) {
         break;
     }
     case SP_LINKTYPE_ALBUM: {
-        jb_add_string(ctx->jb, "type", "album");
+        jw_add_string(ctx->jw, "type", "album");
 
         sp_album* album = sp_link_as_album(lnk);
         if (!album) {
-            jb_add_string(ctx->jb, "error", "can't retrieve album");
+            jw_add_string(ctx->jw, "error", "can't retrieve album");
             sp_link_release(lnk);
             break;
         }
@@ -1351,11 +1486,11 @@ gboolean uri_info(command_context* ctx, sp_link* lnk) {
         break;
     }
     case SP_LINKTYPE_ARTIST: {
-        jb_add_string(ctx->jb, "type", "artist");
+        jw_add_string(ctx->jw, "type", "artist");
 
         sp_artist* artist = sp_link_as_artist(lnk);
         if (!artist) {
-            jb_add_string(ctx->jb, "error", "can't retrieve artist");
+            jw_add_string(ctx->jw, "error", "can't retrieve artist");
             sp_link_release(lnk);
             break;
         }
@@ -1365,11 +1500,11 @@ gboolean uri_info(command_context* ctx, sp_link* lnk) {
         break;
     }
     case SP_LINKTYPE_PLAYLIST: {
-        jb_add_string(ctx->jb, "type", "playlist");
+        jw_add_string(ctx->jw, "type", "playlist");
 
         sp_playlist* pl = playlist_get_from_link(lnk);
         if (!pl) {
-            jb_add_string(ctx->jb, "error", "can't retrieve playlist");
+            jw_add_string(ctx->jw, "error", "can't retrieve playlist");
             sp_link_release(lnk);
             break;
         }
@@ -1387,7 +1522,7 @@ gboolean uri_info(command_context* ctx, sp_link* lnk) {
         break;
     }
     default:
-        jb_add_string(ctx->jb, "type", "not implemented");
+        jw_add_string(ctx->jw, "type", "not implemented");
         sp_link_release(lnk);
         break;
     }
@@ -1401,14 +1536,14 @@ static gboolean _uri_add_play(command_context* ctx, sp_link* lnk, gboolean play)
 
     switch(type) {
     case SP_LINKTYPE_INVALID:
-        jb_add_string(ctx->jb, "error", "invalid URI");
+        jw_add_string(ctx->jw, "error", "invalid URI");
         sp_link_release(lnk);
         break;
     case SP_LINKTYPE_TRACK: {
         int offset;
         sp_track* track = sp_link_as_track_and_offset(lnk, &offset);
         if (!track) {
-            jb_add_string(ctx->jb, "error", "can't retrieve track");
+            jw_add_string(ctx->jw, "error", "can't retrieve track");
             sp_link_release(lnk);
             break;
         }
@@ -1430,7 +1565,7 @@ static gboolean _uri_add_play(command_context* ctx, sp_link* lnk, gboolean play)
     case SP_LINKTYPE_ALBUM: {
         sp_album* album = sp_link_as_album(lnk);
         if (!album) {
-            jb_add_string(ctx->jb, "error", "can't retrieve album");
+            jw_add_string(ctx->jw, "error", "can't retrieve album");
             sp_link_release(lnk);
             break;
         }
@@ -1444,7 +1579,7 @@ static gboolean _uri_add_play(command_context* ctx, sp_link* lnk, gboolean play)
     case SP_LINKTYPE_PLAYLIST: {
         sp_playlist* pl = playlist_get_from_link(lnk);
         if (!pl) {
-            jb_add_string(ctx->jb, "error", "can't retrieve playlist");
+            jw_add_string(ctx->jw, "error", "can't retrieve playlist");
             sp_link_release(lnk);
             break;
         }
@@ -1463,7 +1598,7 @@ static gboolean _uri_add_play(command_context* ctx, sp_link* lnk, gboolean play)
         break;
     }
     default:
-        jb_add_string(ctx->jb, "error", "not implemented");
+        jw_add_string(ctx->jw, "error", "not implemented");
         sp_link_release(lnk);
         break;
     }
@@ -1488,14 +1623,14 @@ gboolean uri_image_size(command_context* ctx, sp_link* lnk, guint size) {
     gboolean done = TRUE;
 
     if (size < SP_IMAGE_SIZE_NORMAL || size > SP_IMAGE_SIZE_LARGE) {
-        jb_add_string(ctx->jb, "error", "invalid size");
+        jw_add_string(ctx->jw, "error", "invalid size");
         sp_link_release(lnk);
         return done;
     }
 
     switch(type) {
     case SP_LINKTYPE_INVALID:
-        jb_add_string(ctx->jb, "error", "invalid URI");
+        jw_add_string(ctx->jw, "error", "invalid URI");
         sp_link_release(lnk);
         break;
     case SP_LINKTYPE_TRACK:
@@ -1514,7 +1649,7 @@ gboolean uri_image_size(command_context* ctx, sp_link* lnk, guint size) {
         break;
     }
     default:
-        jb_add_string(ctx->jb, "error", "link not supported");
+        jw_add_string(ctx->jw, "error", "link not supported");
         sp_link_release(lnk);
         break;
     }
@@ -1530,11 +1665,11 @@ gboolean toggle_star(command_context* ctx) {
 
     queue_get_status(&track, NULL, NULL);
     if (!track) {
-        jb_add_string(ctx->jb, "status", "empty-queue");
+        jw_add_string(ctx->jw, "status", "empty-queue");
         return TRUE;
     }
     if (!sp_track_is_loaded(track)) {
-        jb_add_string(ctx->jb, "status", "not-loaded");
+        jw_add_string(ctx->jw, "status", "not-loaded");
         return TRUE;
     }
 
@@ -1565,7 +1700,7 @@ static gboolean _uri_star_tracks_cb(struct _uri_star_tracks_data* data) {
             if (data->count < CMD_CALLBACK_MAX_CALLS)
                 return TRUE;
             else {
-                jb_add_string(data->ctx->jb, "error", "track not loaded");
+                jw_add_string(data->ctx->jw, "error", "track not loaded");
                 goto _ustc_clean;
             }
         }
@@ -1573,8 +1708,8 @@ static gboolean _uri_star_tracks_cb(struct _uri_star_tracks_data* data) {
 
     // Star!
     track_set_starred(data->tracks, data->starred);
-    jb_add_string(data->ctx->jb, "status", "success");
-    jb_add_int(data->ctx->jb, "tracks_changed", size);
+    jw_add_string(data->ctx->jw, "status", "success");
+    jw_add_int(data->ctx->jw, "tracks_changed", size);
 
  _ustc_clean:
     command_end(data->ctx);
@@ -1589,7 +1724,7 @@ static void _uri_star_album_cb(sp_albumbrowse* ab, gpointer userdata) {
     /* Check for error */
     sp_error err = sp_albumbrowse_error(ab);
     if (err != SP_ERROR_OK) {
-        jb_add_string(data->ctx->jb, "error", sp_error_message(err));
+        jw_add_string(data->ctx->jw, "error", sp_error_message(err));
         goto _usac_clean_err;
     }
 
@@ -1628,7 +1763,7 @@ static gboolean _uri_star_playlist_cb(struct _uri_star_playlist_data* pl_data) {
         if (pl_data->data->count < CMD_CALLBACK_MAX_CALLS)
             return TRUE;
         else {
-            jb_add_string(pl_data->data->ctx->jb, "error", "playlist not loaded");
+            jw_add_string(pl_data->data->ctx->jw, "error", "playlist not loaded");
             goto _uspc_clean_err;
         }
     }
@@ -1662,14 +1797,14 @@ gboolean uri_star(command_context* ctx, sp_link* lnk, guint starred) {
 
     switch(type) {
     case SP_LINKTYPE_INVALID:
-        jb_add_string(ctx->jb, "error", "link not supported");
+        jw_add_string(ctx->jw, "error", "link not supported");
         sp_link_release(lnk);
         break;
 
     case SP_LINKTYPE_TRACK: {
         sp_track* track = sp_link_as_track(lnk);
         if (!track) {
-            jb_add_string(ctx->jb, "error", "can't retrieve track");
+            jw_add_string(ctx->jw, "error", "can't retrieve track");
             sp_link_release(lnk);
             break;
         }
@@ -1691,7 +1826,7 @@ gboolean uri_star(command_context* ctx, sp_link* lnk, guint starred) {
     case SP_LINKTYPE_ALBUM: {
         sp_album* album = sp_link_as_album(lnk);
         if (!album) {
-            jb_add_string(ctx->jb, "error", "can't retrieve album");
+            jw_add_string(ctx->jw, "error", "can't retrieve album");
             sp_link_release(lnk);
             break;
         }
@@ -1708,7 +1843,7 @@ gboolean uri_star(command_context* ctx, sp_link* lnk, guint starred) {
     case SP_LINKTYPE_PLAYLIST: {
         sp_playlist* pl = playlist_get_from_link(lnk);
         if (!pl) {
-            jb_add_string(ctx->jb, "error", "can't retrieve playlist");
+            jw_add_string(ctx->jw, "error", "can't retrieve playlist");
             sp_link_release(lnk);
             break;
         }
@@ -1729,7 +1864,7 @@ gboolean uri_star(command_context* ctx, sp_link* lnk, guint starred) {
         break;
     }
     default:
-        jb_add_string(ctx->jb, "error", "not implemented");
+        jw_add_string(ctx->jw, "error", "not implemented");
         sp_link_release(lnk);
         break;
     }
@@ -1738,34 +1873,40 @@ gboolean uri_star(command_context* ctx, sp_link* lnk, guint starred) {
 }
 /* }}} */
 /* {{{ Search */
+typedef struct {
+    command_context* ctx;
+    guint offset;
+} search_cb_data;
+
 static void _search_cb(sp_search* srch, gpointer userdata) {
-    command_context* ctx = (command_context*) userdata;
+    search_cb_data* scd = (search_cb_data*) userdata;
+    command_context* ctx = scd->ctx;
     int i, n;
 
     /* Check for error */
     sp_error err = sp_search_error(srch);
     if (err != SP_ERROR_OK) {
-        jb_add_string(ctx->jb, "error", sp_error_message(err));
+        jw_add_string(ctx->jw, "error", sp_error_message(err));
         goto _s_cb_clean;
     }
 
     /* Basic things first */
-    jb_add_string(ctx->jb, "query", sp_search_query(srch));
+    jw_add_string(ctx->jw, "query", sp_search_query(srch));
     const gchar* dym = sp_search_did_you_mean(srch);
     if (dym[0] != '\0') {
-        jb_add_string(ctx->jb, "did_you_mean", dym);
+        jw_add_string(ctx->jw, "did_you_mean", dym);
     }
 
     sp_link* lnk = sp_link_create_from_search(srch);
     gchar uri[1024];
     if (sp_link_as_string(lnk, uri, 1024) < 1024) {
         /* FIXME: what to do if >= 1024? */
-        jb_add_string(ctx->jb, "uri", uri);
+        jw_add_string(ctx->jw, "uri", uri);
     }
     sp_link_release(lnk);
 
     /* Now tracks... */
-    jb_add_int(ctx->jb, "total_tracks", sp_search_total_tracks(srch));
+    jw_add_int(ctx->jw, "total_tracks", sp_search_total_tracks(srch));
 
     n = sp_search_num_tracks(srch);
     GArray* tracks = g_array_sized_new(FALSE, FALSE, sizeof(sp_track*), n);
@@ -1776,86 +1917,107 @@ static void _search_cb(sp_search* srch, gpointer userdata) {
         g_array_append_val(tracks, tr);
     }
 
-    json_builder_set_member_name(ctx->jb, "tracks");
-    json_builder_begin_array(ctx->jb);
-    json_tracks_array(tracks, ctx->jb);
-    json_builder_end_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "tracks");
+    json_writer_begin_array(ctx->jw);
+    json_tracks_array(tracks, scd->offset, ctx->jw);
+    json_writer_end_array(ctx->jw);
     g_array_free(tracks, TRUE);
 
     /* Albums... */
-    jb_add_int(ctx->jb, "total_albums", sp_search_total_albums(srch));
+    jw_add_int(ctx->jw, "total_albums", sp_search_total_albums(srch));
 
     n = sp_search_num_albums(srch);
-    json_builder_set_member_name(ctx->jb, "albums");
-    json_builder_begin_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "albums");
+    json_writer_begin_array(ctx->jw);
     for (i=0; i < n; i++) {
         sp_album* alb = sp_search_album(srch, i);
-        json_builder_begin_object(ctx->jb);
+        json_writer_begin_object(ctx->jw);
 
         sp_artist* artist = sp_album_artist(alb);
-        jb_add_string(ctx->jb, "artist", sp_artist_name(artist));
+        jw_add_string(ctx->jw, "artist", sp_artist_name(artist));
 
-        jb_add_string(ctx->jb, "title", sp_album_name(alb));
-        jb_add_bool(ctx->jb, "available", sp_album_is_available(alb));
+        jw_add_string(ctx->jw, "title", sp_album_name(alb));
+        jw_add_bool(ctx->jw, "available", sp_album_is_available(alb));
 
         lnk = sp_link_create_from_album(alb);
         if (sp_link_as_string(lnk, uri, 1024) < 1024) {
-            jb_add_string(ctx->jb, "uri", uri);
+            jw_add_string(ctx->jw, "uri", uri);
         }
         sp_link_release(lnk);
 
-        json_builder_end_object(ctx->jb);
+        json_writer_end_object(ctx->jw);
     }
-    json_builder_end_array(ctx->jb);
+    json_writer_end_array(ctx->jw);
 
     /* Artists... */
-    jb_add_int(ctx->jb, "total_artists", sp_search_total_artists(srch));
+    jw_add_int(ctx->jw, "total_artists", sp_search_total_artists(srch));
 
     n = sp_search_num_artists(srch);
-    json_builder_set_member_name(ctx->jb, "artists");
-    json_builder_begin_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "artists");
+    json_writer_begin_array(ctx->jw);
     for (i=0; i < n; i++) {
         sp_artist* artist = sp_search_artist(srch, i);
-        json_builder_begin_object(ctx->jb);
+        json_writer_begin_object(ctx->jw);
 
-        jb_add_string(ctx->jb, "artist", sp_artist_name(artist));
+        jw_add_string(ctx->jw, "artist", sp_artist_name(artist));
 
         lnk = sp_link_create_from_artist(artist);
         if (sp_link_as_string(lnk, uri, 1024) < 1024) {
-            jb_add_string(ctx->jb, "uri", uri);
+            jw_add_string(ctx->jw, "uri", uri);
         }
         sp_link_release(lnk);
 
-        json_builder_end_object(ctx->jb);
+        json_writer_end_object(ctx->jw);
     }
-    json_builder_end_array(ctx->jb);
+    json_writer_end_array(ctx->jw);
 
     /* Playlists... */
-    jb_add_int(ctx->jb, "total_playlists", sp_search_total_playlists(srch));
+    jw_add_int(ctx->jw, "total_playlists", sp_search_total_playlists(srch));
     n = sp_search_num_playlists(srch);
-    json_builder_set_member_name(ctx->jb, "playlists");
-    json_builder_begin_array(ctx->jb);
+    json_writer_set_member_name(ctx->jw, "playlists");
+    json_writer_begin_array(ctx->jw);
     for (i=0; i < n; i++) {
-        json_builder_begin_object(ctx->jb);
-        jb_add_string(ctx->jb, "name", sp_search_playlist_name(srch, i));
-        jb_add_string(ctx->jb, "uri", sp_search_playlist_uri(srch, i));
-        json_builder_end_object(ctx->jb);
+        json_writer_begin_object(ctx->jw);
+        jw_add_string(ctx->jw, "name", sp_search_playlist_name(srch, i));
+        jw_add_string(ctx->jw, "uri", sp_search_playlist_uri(srch, i));
+        json_writer_end_object(ctx->jw);
     }
-    json_builder_end_array(ctx->jb);
+    json_writer_end_array(ctx->jw);
 
     /* And we're done! */
  _s_cb_clean:
     sp_search_release(srch);
+    g_free(scd);
     command_end(ctx);
 }
 
-gboolean search(command_context* ctx, const gchar* query) {
-    sp_search* srch = search_create(query, _search_cb, ctx);
+static gboolean _search(command_context* ctx, const gchar* query, guint offset, guint count, gboolean paged) {
+    sp_search* srch;
+    search_cb_data* scd = g_new(search_cb_data, 1);
+
+    scd->ctx = ctx;
+    scd->offset = offset;
+    if (paged) {
+        jw_add_int(ctx->jw, "offset", offset);
+        srch = search_create_range(query, offset, count, _search_cb, scd);
+    }
+    else
+        srch = search_create(query, _search_cb, scd);
+
     if (srch)
         return FALSE;
     else {
-        jb_add_string(ctx->jb, "error", "can't create search");
+        g_free(scd);
+        jw_add_string(ctx->jw, "error", "can't create search");
         return TRUE;
     }
 }
+
+gboolean search(command_context* ctx, const gchar* query) {
+    return _search(ctx, query, 0, 0, FALSE);
+}
+
+gboolean search_range(command_context* ctx, const gchar* query, guint offset, guint count) {
+    return _search(ctx, query, offset, count, TRUE);
+}
 /* }}} */
@@ -27,14 +27,15 @@
 #define COMMANDS_H
 
 #include <glib.h>
-#include <json-glib/json-glib.h>
 #include <libspotify/api.h>
 
 #include "interface.h"
+#include "json_writer.h"
 
-typedef void (*command_finalize_func)(gchar* json_result, gpointer data);
+/* The finalize function may take the contents of json_result */
+typedef void (*command_finalize_func)(GString* json_result, gpointer data);
 typedef struct {
-    JsonBuilder* jb;
+    json_writer* jw;
     command_finalize_func finalize;
     gpointer finalize_data;
 } command_context;
@@ -47,13 +48,19 @@ gboolean help(command_context* ctx);
 
 gboolean list_playlists(command_context* ctx);
 gboolean list_tracks(command_context* ctx, guint idx);
+gboolean list_tracks_range(command_context* ctx, guint idx, guint offset, guint count);
 
 gboolean status(command_context* ctx);
+gboolean stats(command_context* ctx);
 gboolean notify(command_context* ctx);
 gboolean repeat(command_context* ctx);
 gboolean shuffle(command_context* ctx);
+gboolean volume(command_context* ctx, guint vol);
+gboolean get_output(command_context* ctx);
+gboolean set_output(command_context* ctx, const gchar* name);
 
 gboolean list_queue(command_context* ctx);
+gboolean list_queue_range(command_context* ctx, guint offset, guint count);
 gboolean clear_queue(command_context* ctx);
 gboolean remove_queue_items(command_context* ctx, guint first, guint last);
 gboolean remove_queue_item(command_context* ctx, guint idx);
@@ -88,5 +95,6 @@ gboolean toggle_star(command_context* ctx);
 gboolean uri_star(command_context* ctx, sp_link* lnk, guint starred);
 
 gboolean search(command_context* ctx, const gchar* query);
+gboolean search_range(command_context* ctx, const gchar* query, guint offset, guint count);
 
 #endif
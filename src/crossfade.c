@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+#include <libspotify/api.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "spop.h"
+#include "config.h"
+#include "crossfade.h"
+#include "dsp.h"
+#include "output.h"
+#include "plugin.h"
+
+/* Extra room in the FIFO, in seconds, so that libspotify can keep delivering
+   while the plugin is busy */
+#define CROSSFADE_HEADROOM 1
+
+/* How often the end of the last track is pushed to the plugin once playback
+   stopped */
+#define CROSSFADE_PUMP_INTERVAL 50
+
+static guint g_cf_seconds = 0;
+static GMutex g_cf_mutex;
+
+/* FIFO: a ring of frames. Positions are absolute frame counters, the index in
+   the ring is (pos % g_cf_size). */
+static int16_t* g_cf_buf = NULL;
+static guint64 g_cf_size = 0;
+static guint64 g_cf_in = 0;
+static guint64 g_cf_out = 0;
+static guint64 g_cf_hold = 0;
+static sp_audioformat g_cf_format;
+
+/* Transition state */
+static gboolean g_cf_ending = FALSE;     /* The end of the track is in the FIFO */
+static gboolean g_cf_mixing = FALSE;     /* Mixing the next track into it */
+static gboolean g_cf_finishing = FALSE;  /* No next track: play everything */
+static guint64 g_cf_tail_start;
+static guint64 g_cf_tail_end;
+static guint64 g_cf_mix_pos;
+
+void crossfade_init() {
+    g_cf_seconds = config_get_int_opt("crossfade", 0);
+    if (g_cf_seconds > 0)
+        g_debug("Crossfading tracks over %u seconds.", g_cf_seconds);
+}
+
+gboolean crossfade_enabled() {
+    return g_cf_seconds > 0;
+}
+
+/* "Private" function: forget everything that is in the FIFO */
+static void _cf_reset() {
+    g_cf_in = g_cf_out = 0;
+    g_cf_ending = g_cf_mixing = g_cf_finishing = FALSE;
+}
+
+/* "Private" function: (re)allocate the FIFO for a new format. Must be
+   empty. */
+static void _cf_set_format(const sp_audioformat* format) {
+    if (format->sample_type != SP_SAMPLETYPE_INT16_NATIVE_ENDIAN)
+        g_error("Crossfade: unsupported sample type");
+
+    g_cf_format = *format;
+    g_cf_hold = (guint64) g_cf_seconds * format->sample_rate;
+    g_cf_size = (guint64) (g_cf_seconds + CROSSFADE_HEADROOM) * format->sample_rate;
+    g_free(g_cf_buf);
+    g_cf_buf = g_new(int16_t, g_cf_size * format->channels);
+    _cf_reset();
+}
+
+/* "Private" function: get the contiguous part of the ring starting at
+   absolute position pos, limited to len frames */
+static int16_t* _cf_region(guint64 pos, guint64* len) {
+    guint64 idx = pos % g_cf_size;
+    *len = MIN(*len, g_cf_size - idx);
+    return g_cf_buf + idx * g_cf_format.channels;
+}
+
+/* "Private" function: send frames up to absolute position end to the audio
+   plugin, as long as it accepts them */
+static void _cf_push(guint64 end) {
+    while (g_cf_out < end) {
+        guint64 len = end - g_cf_out;
+        int16_t* ptr = _cf_region(g_cf_out, &len);
+        int n = output_deliver(&g_cf_format, ptr, len);
+        if (n <= 0)
+            break;
+        g_cf_out += n;
+    }
+}
+
+/* "Private" function: mix the first frames of the next track into the end of
+   the current one */
+static int _cf_mix(const int16_t* frames, int num_frames) {
+    guint64 tail_len = g_cf_tail_end - g_cf_tail_start;
+    guint64 todo = MIN((guint64) num_frames, g_cf_tail_end - g_cf_mix_pos);
+    guint64 done = 0;
+    float step = 1.f / tail_len;
+
+    while (done < todo) {
+        guint64 len = todo - done;
+        int16_t* ptr = _cf_region(g_cf_mix_pos, &len);
+        float gain = (g_cf_mix_pos - g_cf_tail_start) * step;
+
+        dsp_crossfade_s16(ptr, frames + done * g_cf_format.channels, len,
+                          g_cf_format.channels, gain, step);
+        g_cf_mix_pos += len;
+        done += len;
+    }
+
+    if (g_cf_mix_pos == g_cf_tail_end) {
+        g_debug("Crossfade: done (%" G_GUINT64_FORMAT " frames).", tail_len);
+        g_cf_mixing = FALSE;
+    }
+    return done;
+}
+
+int crossfade_deliver(const sp_audioformat* format, const void* frames, int num_frames) {
+    const int16_t* src = frames;
+    int accepted = 0;
+    guint64 room, len, end;
+
+    g_mutex_lock(&g_cf_mutex);
+
+    if (num_frames == 0) {
+        /* Audio discontinuity. Keep the end of the previous track if it is
+           still waiting for the next one. */
+        if (!g_cf_ending && !g_cf_mixing)
+            _cf_reset();
+        g_mutex_unlock(&g_cf_mutex);
+        return output_deliver(format, frames, 0);
+    }
+
+    if ((g_cf_size == 0) ||
+        (format->sample_rate != g_cf_format.sample_rate) ||
+        (format->channels != g_cf_format.channels)) {
+        /* Tracks with different formats can't be mixed: play the end of the
+           previous one as is first */
+        if (g_cf_in > g_cf_out) {
+            g_cf_ending = g_cf_mixing = FALSE;
+            _cf_push(g_cf_in);
+            if (g_cf_in > g_cf_out) {
+                g_mutex_unlock(&g_cf_mutex);
+                return 0;
+            }
+        }
+        _cf_set_format(format);
+    }
+
+    if (g_cf_ending || g_cf_finishing) {
+        /* First frames of the next track */
+        g_cf_ending = g_cf_finishing = FALSE;
+        g_cf_tail_start = g_cf_mix_pos = g_cf_out;
+        g_cf_tail_end = g_cf_in;
+        g_cf_mixing = (g_cf_tail_end > g_cf_tail_start);
+        g_debug("Crossfade: starting (%" G_GUINT64_FORMAT " frames).", g_cf_tail_end - g_cf_tail_start);
+    }
+
+    if (g_cf_mixing)
+        accepted = _cf_mix(src, num_frames);
+
+    if (!g_cf_mixing) {
+        /* Append the remaining frames */
+        room = g_cf_size - (g_cf_in - g_cf_out);
+        len = MIN(room, (guint64) (num_frames - accepted));
+        while (len > 0) {
+            guint64 chunk = len;
+            int16_t* ptr = _cf_region(g_cf_in, &chunk);
+            memcpy(ptr, src + accepted * g_cf_format.channels, chunk * g_cf_format.channels * sizeof(int16_t));
+            g_cf_in += chunk;
+            accepted += chunk;
+            len -= chunk;
+        }
+    }
+
+    /* Send everything but the last seconds to the plugin. While mixing, only
+       what has been mixed already can be sent. */
+    if (g_cf_mixing)
+        end = g_cf_mix_pos;
+    else
+        end = (g_cf_in > g_cf_hold) ? g_cf_in - g_cf_hold : 0;
+    _cf_push(end);
+
+    g_mutex_unlock(&g_cf_mutex);
+    return accepted;
+}
+
+void crossfade_end_of_track() {
+    g_mutex_lock(&g_cf_mutex);
+    if (g_cf_in > g_cf_out)
+        g_cf_ending = TRUE;
+    g_mutex_unlock(&g_cf_mutex);
+}
+
+/* "Private" function, called from the main loop until the FIFO is empty */
+static gboolean _cf_pump(gpointer data) {
+    gboolean again;
+
+    g_mutex_lock(&g_cf_mutex);
+    if (g_cf_finishing) {
+        _cf_push(g_cf_in);
+        again = (g_cf_in > g_cf_out);
+        if (!again) {
+            g_cf_finishing = FALSE;
+            output_drain();
+        }
+    }
+    else
+        again = FALSE;
+    g_mutex_unlock(&g_cf_mutex);
+
+    return again;
+}
+
+/* There is no next track: play the end of the current one normally */
+void crossfade_finish() {
+    g_mutex_lock(&g_cf_mutex);
+    g_cf_ending = g_cf_mixing = FALSE;
+    g_cf_finishing = TRUE;
+    g_mutex_unlock(&g_cf_mutex);
+
+    if (_cf_pump(NULL))
+        g_timeout_add(CROSSFADE_PUMP_INTERVAL, _cf_pump, NULL);
+}
+
+void crossfade_flush() {
+    g_mutex_lock(&g_cf_mutex);
+    _cf_reset();
+    g_mutex_unlock(&g_cf_mutex);
+}
+
+int crossfade_latency() {
+    int n;
+
+    g_mutex_lock(&g_cf_mutex);
+    n = g_cf_in - g_cf_out;
+    g_mutex_unlock(&g_cf_mutex);
+
+    return n;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef CROSSFADE_H
+#define CROSSFADE_H
+
+#include <glib.h>
+#include <libspotify/api.h>
+
+/* Crossfade between consecutive tracks.
+ *
+ * libspotify only plays one track at a time, so the last seconds of a track
+ * are held back in a FIFO between cb_music_delivery() and the audio plugin.
+ * When the next track starts, its first frames are mixed into that FIFO with a
+ * gain ramp. Since libspotify delivers frames much faster than they are
+ * played, the FIFO fills up again long before the next transition. */
+
+void crossfade_init();
+gboolean crossfade_enabled();
+
+/* Called from libspotify's thread */
+int crossfade_deliver(const sp_audioformat* format, const void* frames, int num_frames);
+void crossfade_end_of_track();
+
+/* Called from the main thread */
+void crossfade_finish();
+void crossfade_flush();
+
+/* Number of frames held back in the FIFO */
+int crossfade_latency();
+
+#endif
@@ -0,0 +1,579 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dsp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DSP_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*crossfade_s16_func)(int16_t*, const int16_t*, size_t, int, float, float);
+typedef void (*gain_s16_func)(int16_t*, const int16_t*, size_t, int, float, float);
+typedef void (*s16_to_s32_func)(int32_t*, const int16_t*, size_t);
+typedef float (*dot_f32_func)(const float*, const float*, size_t);
+typedef void (*biquad_s16_func)(int16_t*, size_t, int, const dsp_biquad*, int, double*);
+
+typedef struct {
+    const gchar* name;
+    gboolean (*supported)();
+    crossfade_s16_func crossfade_s16;
+    gain_s16_func gain_s16;
+    s16_to_s32_func s16_to_s32;
+    dot_f32_func dot_f32;
+    biquad_s16_func biquad_s16;
+} dsp_impl;
+
+
+/***********************
+ *** Scalar versions ***
+ ***********************/
+static inline int16_t dsp_sat16(float v) {
+    long r = lrintf(v);
+    if (r > G_MAXINT16) return G_MAXINT16;
+    if (r < G_MININT16) return G_MININT16;
+    return (int16_t) r;
+}
+
+/* Process frames [first, frames). The SIMD versions use this for the frames
+   that don't fill a whole vector, so the gain has to be computed the same
+   way. */
+static void crossfade_s16_from(int16_t* dst, const int16_t* src, size_t first, size_t frames,
+                               int channels, float gain, float step) {
+    size_t i;
+    int c;
+
+    for (i=first; i < frames; i++) {
+        float g = gain + (float) i * step;
+        float h = 1.f - g;
+        for (c=0; c < channels; c++) {
+            size_t j = i * channels + c;
+            dst[j] = dsp_sat16(dst[j] * h + src[j] * g);
+        }
+    }
+}
+
+static void crossfade_s16_scalar(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                                 float gain, float step) {
+    crossfade_s16_from(dst, src, 0, frames, channels, gain, step);
+}
+
+static void gain_s16_from(int16_t* dst, const int16_t* src, size_t first, size_t frames,
+                          int channels, float gain, float step) {
+    size_t i;
+    int c;
+
+    for (i=first; i < frames; i++) {
+        float g = gain + (float) i * step;
+        for (c=0; c < channels; c++) {
+            size_t j = i * channels + c;
+            dst[j] = dsp_sat16(src[j] * g);
+        }
+    }
+}
+
+static void gain_s16_scalar(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                            float gain, float step) {
+    gain_s16_from(dst, src, 0, frames, channels, gain, step);
+}
+
+static void s16_to_s32_from(int32_t* dst, const int16_t* src, size_t first, size_t samples) {
+    size_t i;
+    for (i=first; i < samples; i++)
+        dst[i] = (int32_t) ((uint32_t) src[i] << 16);
+}
+
+static void s16_to_s32_scalar(int32_t* dst, const int16_t* src, size_t samples) {
+    s16_to_s32_from(dst, src, 0, samples);
+}
+
+static inline int16_t dsp_sat16d(double v) {
+    if (v > G_MAXINT16) return G_MAXINT16;
+    if (v < G_MININT16) return G_MININT16;
+    return (int16_t) lrint(v);
+}
+
+/* Transposed direct form II. State of section s for channel c: z1 is
+   state[2*s*channels + c], z2 is state[(2*s+1)*channels + c]. */
+static void biquad_s16_scalar(int16_t* frames, size_t num_frames, int channels,
+                              const dsp_biquad* sections, int nb_sections, double* state) {
+    size_t i;
+    int c, s;
+
+    for (i=0; i < num_frames; i++) {
+        for (c=0; c < channels; c++) {
+            double x = frames[i * channels + c];
+            for (s=0; s < nb_sections; s++) {
+                const dsp_biquad* q = &sections[s];
+                double* z1 = &state[2 * s * channels + c];
+                double* z2 = &state[(2 * s + 1) * channels + c];
+                double y = q->b0 * x + *z1;
+                *z1 = q->b1 * x - q->a1 * y + *z2;
+                *z2 = q->b2 * x - q->a2 * y;
+                x = y;
+            }
+            frames[i * channels + c] = dsp_sat16d(x);
+        }
+    }
+}
+
+static float dot_f32_scalar(const float* a, const float* b, size_t n) {
+    size_t i;
+    float sum = 0.f;
+    for (i=0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static gboolean scalar_supported() {
+    return TRUE;
+}
+
+
+/*********************
+ *** SSE2 versions ***
+ *********************/
+#ifdef DSP_X86
+/* Only mono and stereo are vectorized: 8 samples (4 or 8 frames) at a time */
+__attribute__((target("sse2")))
+static void crossfade_s16_sse2(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                               float gain, float step) {
+    size_t i, n;
+    __m128 vgain, vstep, vone, idx_lo, idx_hi;
+
+    if ((channels != 1) && (channels != 2)) {
+        crossfade_s16_from(dst, src, 0, frames, channels, gain, step);
+        return;
+    }
+
+    vgain = _mm_set1_ps(gain);
+    vstep = _mm_set1_ps(step);
+    vone = _mm_set1_ps(1.f);
+    if (channels == 1) {
+        idx_lo = _mm_setr_ps(0, 1, 2, 3);
+        idx_hi = _mm_setr_ps(4, 5, 6, 7);
+    }
+    else {
+        idx_lo = _mm_setr_ps(0, 0, 1, 1);
+        idx_hi = _mm_setr_ps(2, 2, 3, 3);
+    }
+
+    n = frames - frames % (8 / channels);
+    for (i=0; i < n; i += 8 / channels) {
+        int16_t* d = dst + i * channels;
+        const int16_t* s = src + i * channels;
+        __m128 base = _mm_set1_ps((float) i);
+
+        __m128i vd = _mm_loadu_si128((const __m128i*) d);
+        __m128i vs = _mm_loadu_si128((const __m128i*) s);
+
+        /* Sign-extend to 32 bits and convert to float */
+        __m128 d_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(vd, vd), 16));
+        __m128 d_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(vd, vd), 16));
+        __m128 s_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(vs, vs), 16));
+        __m128 s_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(vs, vs), 16));
+
+        __m128 g_lo = _mm_add_ps(vgain, _mm_mul_ps(_mm_add_ps(base, idx_lo), vstep));
+        __m128 g_hi = _mm_add_ps(vgain, _mm_mul_ps(_mm_add_ps(base, idx_hi), vstep));
+
+        __m128 r_lo = _mm_add_ps(_mm_mul_ps(d_lo, _mm_sub_ps(vone, g_lo)), _mm_mul_ps(s_lo, g_lo));
+        __m128 r_hi = _mm_add_ps(_mm_mul_ps(d_hi, _mm_sub_ps(vone, g_hi)), _mm_mul_ps(s_hi, g_hi));
+
+        /* Round and saturate */
+        _mm_storeu_si128((__m128i*) d, _mm_packs_epi32(_mm_cvtps_epi32(r_lo), _mm_cvtps_epi32(r_hi)));
+    }
+
+    crossfade_s16_from(dst, src, n, frames, channels, gain, step);
+}
+
+__attribute__((target("sse2")))
+static void gain_s16_sse2(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                          float gain, float step) {
+    size_t i, n;
+    __m128 vgain, vstep, idx_lo, idx_hi;
+
+    if ((channels != 1) && (channels != 2)) {
+        gain_s16_from(dst, src, 0, frames, channels, gain, step);
+        return;
+    }
+
+    vgain = _mm_set1_ps(gain);
+    vstep = _mm_set1_ps(step);
+    if (channels == 1) {
+        idx_lo = _mm_setr_ps(0, 1, 2, 3);
+        idx_hi = _mm_setr_ps(4, 5, 6, 7);
+    }
+    else {
+        idx_lo = _mm_setr_ps(0, 0, 1, 1);
+        idx_hi = _mm_setr_ps(2, 2, 3, 3);
+    }
+
+    n = frames - frames % (8 / channels);
+    for (i=0; i < n; i += 8 / channels) {
+        __m128 base = _mm_set1_ps((float) i);
+        __m128i vs = _mm_loadu_si128((const __m128i*) (src + i * channels));
+
+        __m128 s_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(vs, vs), 16));
+        __m128 s_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(vs, vs), 16));
+
+        __m128 g_lo = _mm_add_ps(vgain, _mm_mul_ps(_mm_add_ps(base, idx_lo), vstep));
+        __m128 g_hi = _mm_add_ps(vgain, _mm_mul_ps(_mm_add_ps(base, idx_hi), vstep));
+
+        __m128i r = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(s_lo, g_lo)),
+                                    _mm_cvtps_epi32(_mm_mul_ps(s_hi, g_hi)));
+        _mm_storeu_si128((__m128i*) (dst + i * channels), r);
+    }
+
+    gain_s16_from(dst, src, n, frames, channels, gain, step);
+}
+
+__attribute__((target("sse2")))
+static void s16_to_s32_sse2(int32_t* dst, const int16_t* src, size_t samples) {
+    size_t i, n = samples - samples % 8;
+    __m128i zero = _mm_setzero_si128();
+
+    for (i=0; i < n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        /* Interleaving with zeros puts each sample in the upper half of a
+           32-bit word */
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_unpacklo_epi16(zero, v));
+        _mm_storeu_si128((__m128i*) (dst + i + 4), _mm_unpackhi_epi16(zero, v));
+    }
+
+    s16_to_s32_from(dst, src, n, samples);
+}
+
+/* A biquad can't be vectorized along time, but the channels are independent:
+   stereo frames go through the cascade with both channels in one vector */
+__attribute__((target("sse2")))
+static void biquad_s16_sse2(int16_t* frames, size_t num_frames, int channels,
+                            const dsp_biquad* sections, int nb_sections, double* state) {
+    __m128d b0[DSP_MAX_BIQUADS], b1[DSP_MAX_BIQUADS], b2[DSP_MAX_BIQUADS];
+    __m128d a1[DSP_MAX_BIQUADS], a2[DSP_MAX_BIQUADS];
+    __m128d z1[DSP_MAX_BIQUADS], z2[DSP_MAX_BIQUADS];
+    __m128d vmax = _mm_set1_pd(G_MAXINT16);
+    __m128d vmin = _mm_set1_pd(G_MININT16);
+    size_t i;
+    int s;
+
+    if ((channels != 2) || (nb_sections > DSP_MAX_BIQUADS)) {
+        biquad_s16_scalar(frames, num_frames, channels, sections, nb_sections, state);
+        return;
+    }
+
+    for (s=0; s < nb_sections; s++) {
+        b0[s] = _mm_set1_pd(sections[s].b0);
+        b1[s] = _mm_set1_pd(sections[s].b1);
+        b2[s] = _mm_set1_pd(sections[s].b2);
+        a1[s] = _mm_set1_pd(sections[s].a1);
+        a2[s] = _mm_set1_pd(sections[s].a2);
+        z1[s] = _mm_loadu_pd(state + 4 * s);
+        z2[s] = _mm_loadu_pd(state + 4 * s + 2);
+    }
+
+    for (i=0; i < num_frames; i++) {
+        int32_t frame;
+        __m128i vi;
+        __m128d x;
+
+        memcpy(&frame, frames + 2 * i, sizeof(frame));
+        vi = _mm_cvtsi32_si128(frame);
+        x = _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(vi, vi), 16));
+
+        for (s=0; s < nb_sections; s++) {
+            __m128d y = _mm_add_pd(_mm_mul_pd(b0[s], x), z1[s]);
+            z1[s] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[s], x), _mm_mul_pd(a1[s], y)), z2[s]);
+            z2[s] = _mm_sub_pd(_mm_mul_pd(b2[s], x), _mm_mul_pd(a2[s], y));
+            x = y;
+        }
+
+        /* Saturate before the conversion, which can't handle large values */
+        x = _mm_max_pd(_mm_min_pd(x, vmax), vmin);
+        vi = _mm_cvtpd_epi32(x);
+        frame = _mm_cvtsi128_si32(_mm_packs_epi32(vi, vi));
+        memcpy(frames + 2 * i, &frame, sizeof(frame));
+    }
+
+    for (s=0; s < nb_sections; s++) {
+        _mm_storeu_pd(state + 4 * s, z1[s]);
+        _mm_storeu_pd(state + 4 * s + 2, z2[s]);
+    }
+}
+
+/* Two accumulators, to hide the latency of the additions */
+__attribute__((target("sse2")))
+static float dot_f32_sse2(const float* a, const float* b, size_t n) {
+    size_t i, m = n - n % 8;
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    float r[4], sum;
+
+    for (i=0; i < m; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    _mm_storeu_ps(r, _mm_add_ps(acc0, acc1));
+    sum = (r[0] + r[1]) + (r[2] + r[3]);
+
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static gboolean sse2_supported() {
+#ifdef __x86_64__
+    return TRUE;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+
+/*********************
+ *** AVX2 versions ***
+ *********************/
+/* 16 samples (8 or 16 frames) at a time */
+__attribute__((target("avx2")))
+static void crossfade_s16_avx2(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                               float gain, float step) {
+    size_t i, n;
+    __m256 vgain, vstep, vone, idx_lo, idx_hi;
+
+    if ((channels != 1) && (channels != 2)) {
+        crossfade_s16_from(dst, src, 0, frames, channels, gain, step);
+        return;
+    }
+
+    vgain = _mm256_set1_ps(gain);
+    vstep = _mm256_set1_ps(step);
+    vone = _mm256_set1_ps(1.f);
+    if (channels == 1) {
+        idx_lo = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+        idx_hi = _mm256_setr_ps(8, 9, 10, 11, 12, 13, 14, 15);
+    }
+    else {
+        idx_lo = _mm256_setr_ps(0, 0, 1, 1, 2, 2, 3, 3);
+        idx_hi = _mm256_setr_ps(4, 4, 5, 5, 6, 6, 7, 7);
+    }
+
+    n = frames - frames % (16 / channels);
+    for (i=0; i < n; i += 16 / channels) {
+        int16_t* d = dst + i * channels;
+        const int16_t* s = src + i * channels;
+        __m256 base = _mm256_set1_ps((float) i);
+
+        __m256i vd = _mm256_loadu_si256((const __m256i*) d);
+        __m256i vs = _mm256_loadu_si256((const __m256i*) s);
+
+        __m256 d_lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(vd)));
+        __m256 d_hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(vd, 1)));
+        __m256 s_lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(vs)));
+        __m256 s_hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(vs, 1)));
+
+        __m256 g_lo = _mm256_add_ps(vgain, _mm256_mul_ps(_mm256_add_ps(base, idx_lo), vstep));
+        __m256 g_hi = _mm256_add_ps(vgain, _mm256_mul_ps(_mm256_add_ps(base, idx_hi), vstep));
+
+        __m256 r_lo = _mm256_add_ps(_mm256_mul_ps(d_lo, _mm256_sub_ps(vone, g_lo)), _mm256_mul_ps(s_lo, g_lo));
+        __m256 r_hi = _mm256_add_ps(_mm256_mul_ps(d_hi, _mm256_sub_ps(vone, g_hi)), _mm256_mul_ps(s_hi, g_hi));
+
+        /* packs works on each 128-bit lane separately: put the 64-bit blocks
+           back in order afterwards */
+        __m256i r = _mm256_packs_epi32(_mm256_cvtps_epi32(r_lo), _mm256_cvtps_epi32(r_hi));
+        _mm256_storeu_si256((__m256i*) d, _mm256_permute4x64_epi64(r, 0xD8));
+    }
+
+    crossfade_s16_from(dst, src, n, frames, channels, gain, step);
+}
+
+__attribute__((target("avx2")))
+static void gain_s16_avx2(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                          float gain, float step) {
+    size_t i, n;
+    __m256 vgain, vstep, idx_lo, idx_hi;
+
+    if ((channels != 1) && (channels != 2)) {
+        gain_s16_from(dst, src, 0, frames, channels, gain, step);
+        return;
+    }
+
+    vgain = _mm256_set1_ps(gain);
+    vstep = _mm256_set1_ps(step);
+    if (channels == 1) {
+        idx_lo = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+        idx_hi = _mm256_setr_ps(8, 9, 10, 11, 12, 13, 14, 15);
+    }
+    else {
+        idx_lo = _mm256_setr_ps(0, 0, 1, 1, 2, 2, 3, 3);
+        idx_hi = _mm256_setr_ps(4, 4, 5, 5, 6, 6, 7, 7);
+    }
+
+    n = frames - frames % (16 / channels);
+    for (i=0; i < n; i += 16 / channels) {
+        __m256 base = _mm256_set1_ps((float) i);
+        __m256i vs = _mm256_loadu_si256((const __m256i*) (src + i * channels));
+
+        __m256 s_lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(vs)));
+        __m256 s_hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(vs, 1)));
+
+        __m256 g_lo = _mm256_add_ps(vgain, _mm256_mul_ps(_mm256_add_ps(base, idx_lo), vstep));
+        __m256 g_hi = _mm256_add_ps(vgain, _mm256_mul_ps(_mm256_add_ps(base, idx_hi), vstep));
+
+        __m256i r = _mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(s_lo, g_lo)),
+                                       _mm256_cvtps_epi32(_mm256_mul_ps(s_hi, g_hi)));
+        _mm256_storeu_si256((__m256i*) (dst + i * channels), _mm256_permute4x64_epi64(r, 0xD8));
+    }
+
+    gain_s16_from(dst, src, n, frames, channels, gain, step);
+}
+
+__attribute__((target("avx2")))
+static void s16_to_s32_avx2(int32_t* dst, const int16_t* src, size_t samples) {
+    size_t i, n = samples - samples % 16;
+
+    for (i=0; i < n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (src + i));
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_slli_epi32(lo, 16));
+        _mm256_storeu_si256((__m256i*) (dst + i + 8), _mm256_slli_epi32(hi, 16));
+    }
+
+    s16_to_s32_from(dst, src, n, samples);
+}
+
+__attribute__((target("avx2")))
+static float dot_f32_avx2(const float* a, const float* b, size_t n) {
+    size_t i, m = n - n % 16;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m128 r;
+    float sum;
+
+    for (i=0; i < m; i += 16) {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    r = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+    r = _mm_add_ss(r, _mm_shuffle_ps(r, r, 1));
+    sum = _mm_cvtss_f32(r);
+
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static gboolean avx2_supported() {
+    return __builtin_cpu_supports("avx2");
+}
+#endif /* DSP_X86 */
+
+
+/**********************
+ *** Implementation ***
+ **********************/
+/* From the slowest to the fastest */
+static const dsp_impl g_dsp_impls[] = {
+    { "scalar", scalar_supported, crossfade_s16_scalar, gain_s16_scalar, s16_to_s32_scalar,
+      dot_f32_scalar, biquad_s16_scalar },
+#ifdef DSP_X86
+    /* Wider vectors don't help the biquads with stereo frames: the AVX2
+       implementation uses the SSE2 version */
+    { "sse2",   sse2_supported,   crossfade_s16_sse2,   gain_s16_sse2,   s16_to_s32_sse2,
+      dot_f32_sse2, biquad_s16_sse2 },
+    { "avx2",   avx2_supported,   crossfade_s16_avx2,   gain_s16_avx2,   s16_to_s32_avx2,
+      dot_f32_avx2, biquad_s16_sse2 },
+#endif
+};
+static const dsp_impl* g_dsp = NULL;
+
+static const dsp_impl* dsp_get() {
+    int i;
+
+    if (!g_dsp) {
+        for (i=G_N_ELEMENTS(g_dsp_impls)-1; i >= 0; i--) {
+            if (g_dsp_impls[i].supported()) {
+                g_dsp = &g_dsp_impls[i];
+                break;
+            }
+        }
+        g_debug("Using %s DSP functions", g_dsp->name);
+    }
+    return g_dsp;
+}
+
+const gchar* dsp_impl_name() {
+    return dsp_get()->name;
+}
+
+gboolean dsp_set_impl(const gchar* name) {
+    int i;
+
+    for (i=0; i < G_N_ELEMENTS(g_dsp_impls); i++) {
+        if ((strcmp(g_dsp_impls[i].name, name) == 0) && g_dsp_impls[i].supported()) {
+            g_dsp = &g_dsp_impls[i];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void dsp_crossfade_s16(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                       float gain, float step) {
+    dsp_get()->crossfade_s16(dst, src, frames, channels, gain, step);
+}
+
+void dsp_gain_s16(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                  float gain, float step) {
+    dsp_get()->gain_s16(dst, src, frames, channels, gain, step);
+}
+
+void dsp_s16_to_s32(int32_t* dst, const int16_t* src, size_t samples) {
+    dsp_get()->s16_to_s32(dst, src, samples);
+}
+
+float dsp_dot_f32(const float* a, const float* b, size_t n) {
+    return dsp_get()->dot_f32(a, b, n);
+}
+
+void dsp_biquad_s16(int16_t* frames, size_t num_frames, int channels,
+                    const dsp_biquad* sections, int nb_sections, double* state) {
+    int i;
+
+    dsp_get()->biquad_s16(frames, num_frames, channels, sections, nb_sections, state);
+
+    /* After some silence, the state decays to denormal numbers, which are very
+       slow to work with */
+    for (i=0; i < 2 * nb_sections * channels; i++) {
+        if (fabs(state[i]) < 1e-15)
+            state[i] = 0.;
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <glib.h>
+#include <stdint.h>
+
+/* Sample processing kernels.
+ *
+ * Each kernel has a scalar version and, on x86, SSE2 and AVX2 versions. The
+ * best one supported by the CPU is picked the first time a kernel is used;
+ * dsp_set_impl() forces a given implementation (used by the benchmarks). */
+
+/* Mix the next track into the end of the current one:
+ *   dst[i] = dst[i] * (1 - g) + src[i] * g
+ * where g goes from gain to gain + (frames - 1) * step, one step per frame.
+ * The result is saturated to the 16-bit range. */
+void dsp_crossfade_s16(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                       float gain, float step);
+
+/* Apply a gain (or a gain ramp) to some frames:
+ *   dst[i] = src[i] * g
+ * where g goes from gain to gain + (frames - 1) * step, one step per frame.
+ * The result is saturated to the 16-bit range. */
+void dsp_gain_s16(int16_t* dst, const int16_t* src, size_t frames, int channels,
+                  float gain, float step);
+
+/* Convert 16-bit samples to 32-bit ones (same as SoX's
+   SOX_SIGNED_16BIT_TO_SAMPLE()): dst[i] = src[i] << 16 */
+void dsp_s16_to_s32(int32_t* dst, const int16_t* src, size_t samples);
+
+/* One section of a biquad filter, normalized so that a0 = 1 */
+typedef struct {
+    double b0, b1, b2;
+    double a1, a2;
+} dsp_biquad;
+
+#define DSP_MAX_BIQUADS 16
+
+/* Run frames (in place) through a cascade of at most DSP_MAX_BIQUADS biquad
+ * sections. state holds the two delay elements of each section for each
+ * channel (2 * nb_sections * channels values, all 0 to start with). The result
+ * is saturated to the 16-bit range. */
+void dsp_biquad_s16(int16_t* frames, size_t num_frames, int channels,
+                    const dsp_biquad* sections, int nb_sections, double* state);
+
+/* Dot product of two float vectors (the resampler's filter) */
+float dsp_dot_f32(const float* a, const float* b, size_t n);
+
+const gchar* dsp_impl_name();
+gboolean dsp_set_impl(const gchar* name);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <glib.h>
+#include <libspotify/api.h>
+#include <stdint.h>
+
+/* Filter plugins (libspop_filter_<name>) process the audio on its way to the
+ * audio output plugin. They are listed in the "filters" option and run in
+ * that order, after the software volume and the resampler.
+ *
+ * Each filter works in place on a buffer owned by the output stage: nothing is
+ * copied between two filters. Every frame is processed exactly once, so the
+ * filters can keep some state between two calls.
+ *
+ * filter_open() and filter_process() are called from libspotify's thread (or
+ * from the main thread while crossfading); filter_reset() and filter_close()
+ * are called from the main thread. They are never called concurrently.
+ *
+ * filter_open() and filter_process() are mandatory, the other functions are
+ * optional. */
+
+/* Frames with a new format are about to be processed */
+void filter_open(const sp_audioformat* format);
+
+/* Process some frames in place */
+void filter_process(int16_t* frames, int num_frames);
+
+/* The next frames don't follow the previous ones (seek): forget the past */
+void filter_reset(void);
+
+/* Playback is stopped */
+void filter_close(void);
+
+#endif
@@ -26,7 +26,6 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <glib.h>
-#include <json-glib/json-glib.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,12 +39,36 @@
 #include "config.h"
 #include "config.h"
 #include "interface.h"
+#include "json_writer.h"
+#include "utils.h"
 
 #include "sd-daemon.h"
 
 const char proto_greetings[] = "spop " SPOP_VERSION "\n";
 
-/* Channels and plugins that have to be notified when something changes
+/* Clients can send several commands at once: they are all read in the same
+   buffer, and at most INTERFACE_MAX_COMMANDS of them are run in a row before
+   giving the other clients a chance */
+#define INTERFACE_MAX_COMMANDS 32
+#define INTERFACE_READ_SIZE    4096
+
+/* Stop reading from a client that has that much data waiting to be run, or
+   that sends a line longer than that */
+#define INTERFACE_MAX_INPUT    (64 * 1024)
+
+/* Answers that can't be sent right away wait in an output queue. No more
+   commands are run for a client while its queue is longer than
+   INTERFACE_BUSY_OUTPUT, and a client whose queue gets longer than
+   max_output_queue (from the config) is disconnected. */
+#define INTERFACE_BUSY_OUTPUT  (64 * 1024)
+static gsize g_max_output = 0;
+
+/* All the connected clients, and some statistics about them */
+static GList* g_clients = NULL;
+static gsize g_peak_output = 0;
+static guint64 g_dropped_clients = 0;
+
+/* Clients and plugins that have to be notified when something changes
    ("idle" command) */
 static GList* g_idle_channels = NULL;
 static GList* g_notification_callbacks = NULL;
@@ -59,13 +82,19 @@ command_full_descriptor g_commands[] = {
 
     { "ls",      CT_FUNC, { list_playlists, {CA_NONE}}, "list all your playlists"},
     { "ls",      CT_FUNC, { list_tracks,    {CA_INT, CA_NONE}}, "list the contents of playlist number arg1"},
+    { "ls",      CT_FUNC, { list_tracks_range, {CA_INT, CA_INT, CA_INT}}, "list at most arg3 tracks of playlist number arg1, skipping the first arg2 tracks"},
 
     { "status",  CT_FUNC, { status,  {CA_NONE}}, "display informations about the queue, the current track, etc."},
+    { "stats",   CT_FUNC, { stats,   {CA_NONE}}, "display statistics about the audio output (latencies...)"},
     { "notify",  CT_FUNC, { notify,  {CA_NONE}}, "unlock all the currently idle sessions, just like if something had changed"},
     { "repeat",  CT_FUNC, { repeat,  {CA_NONE}}, "toggle repeat mode"},
     { "shuffle", CT_FUNC, { shuffle, {CA_NONE}}, "toggle shuffle mode"},
+    { "volume",  CT_FUNC, { volume,  {CA_INT, CA_NONE}}, "set the volume to arg1 (from 0 to 100)"},
+    { "output",  CT_FUNC, { get_output, {CA_NONE}}, "display the current audio output"},
+    { "output",  CT_FUNC, { set_output, {CA_STR, CA_NONE}}, "switch to audio output arg1 without stopping playback"},
 
     { "qls",     CT_FUNC, { list_queue,         {CA_NONE}}, "list the contents of the queue"},
+    { "qls",     CT_FUNC, { list_queue_range,   {CA_INT, CA_INT}}, "list at most arg2 tracks of the queue, skipping the first arg1 tracks"},
     { "qclear",  CT_FUNC, { clear_queue,        {CA_NONE}}, "clear the contents of the queue"},
     { "qrm",     CT_FUNC, { remove_queue_item,  {CA_INT, CA_NONE}}, "remove track number arg1 from the queue"},
     { "qrm",     CT_FUNC, { remove_queue_items, {CA_INT, CA_INT}}, "remove tracks arg1 to arg2 from the queue"},
@@ -100,6 +129,7 @@ command_full_descriptor g_commands[] = {
     { "ustar",   CT_FUNC, { uri_star,    {CA_URI, CA_INT}}, "set the \"starred\" status of the given Spotify URI arg1 (playlist, track or album) to arg2 (0 or 1)"},
 
     { "search",  CT_FUNC, { search, {CA_STR, CA_NONE}}, "perform a search with the given query arg1"},
+    { "search",  CT_FUNC, { search_range, {CA_STR, CA_INT, CA_INT}}, "perform a search with the given query arg1, and return at most arg3 results of each kind, skipping the first arg2 ones"},
 
     { "bye",     CT_BYE,  {}, "close the connection to the spop daemon"},
     { "quit",    CT_QUIT, {}, "exit spop"},
@@ -108,6 +138,41 @@ command_full_descriptor g_commands[] = {
     {  NULL, 0, {}}
 };
 
+/* Commands indexed by name and number of arguments, built from g_commands */
+typedef struct {
+    const gchar* name;
+    gint         nb_args;
+} command_key;
+static GHashTable* g_commands_table = NULL;
+
+static guint command_key_hash(gconstpointer key) {
+    const command_key* ck = key;
+    return g_str_hash(ck->name) * 31 + ck->nb_args;
+}
+
+static gboolean command_key_equal(gconstpointer a, gconstpointer b) {
+    const command_key* ca = a;
+    const command_key* cb = b;
+    return (ca->nb_args == cb->nb_args) && (strcmp(ca->name, cb->name) == 0);
+}
+
+static void interface_init_commands() {
+    int i;
+
+    g_commands_table = g_hash_table_new_full(command_key_hash, command_key_equal, g_free, NULL);
+    for (i=0; g_commands[i].name != NULL; i++) {
+        command_key* key = g_new(command_key, 1);
+        key->name = g_commands[i].name;
+        key->nb_args = 0;
+        while ((key->nb_args < MAX_CMD_ARGS) && (g_commands[i].desc.args[key->nb_args] != CA_NONE))
+            key->nb_args += 1;
+
+        if (g_hash_table_contains(g_commands_table, key))
+            g_error("Command %s with %d argument(s) is defined twice", key->name, key->nb_args);
+        g_hash_table_insert(g_commands_table, key, &(g_commands[i]));
+    }
+}
+
 /* Internal helper */
 static void interface_init_chan(int sock) {
     /* Create an IO channel and add it to the main loop */
@@ -123,6 +188,9 @@ void interface_init() {
     /* Try to use systemd socket activation */
     int n, sock;
 
+    g_max_output = (gsize) config_get_int_opt("max_output_queue", 32768) * 1024;
+    interface_init_commands();
+
     n = sd_listen_fds(1);
     if (n < 0)
         g_error("Can't check file descriptors passed by the system manager: %s", g_strerror(errno));
@@ -214,145 +282,330 @@ gboolean interface_event(GIOChannel* source, GIOCondition condition, gpointer da
 
     g_info("[ie:%d] Connection from %s:%s", client, client_hostname, client_port);
 
-    /* Create IO channel for the client, send greetings, and add it to the main loop */
+    /* Create IO channel for the client, add it to the main loop, and send
+       greetings. The main loop must never wait for a client. */
     client_chan = g_io_channel_unix_new(client);
     if (!client_chan)
         g_error("[ie:%d] Can't create IO channel for the client socket.", client);
     g_io_channel_set_close_on_unref(client_chan, TRUE);
+    if (g_io_channel_set_flags(client_chan, G_IO_FLAG_NONBLOCK, NULL) != G_IO_STATUS_NORMAL)
+        g_error("[ie:%d] Can't make the client socket non-blocking.", client);
 
-    if (!interface_write(client_chan, proto_greetings))
-        goto ie_client_clean;
-
-    g_io_add_watch(client_chan, G_IO_IN|G_IO_HUP, interface_client_event, NULL);
+    interface_write(interface_client_new(client_chan), proto_greetings);
 
     return TRUE;
+}
+
+/* Clients management */
+interface_client* interface_client_new(GIOChannel* chan) {
+    interface_client* client = g_new0(interface_client, 1);
+
+    client->chan = chan;
+    client->fd = g_io_channel_unix_get_fd(chan);
+    client->input = g_string_sized_new(INTERFACE_READ_SIZE);
+    client->output = g_string_new(NULL);
+    client->ref_count = 1;
+    interface_client_watch(client, TRUE);
+    g_clients = g_list_prepend(g_clients, client);
+
+    return client;
+}
+
+interface_client* interface_client_ref(interface_client* client) {
+    client->ref_count += 1;
+    return client;
+}
+
+void interface_client_unref(interface_client* client) {
+    client->ref_count -= 1;
+    if (client->ref_count > 0)
+        return;
+
+    g_string_free(client->input, TRUE);
+    g_string_free(client->output, TRUE);
+    g_io_channel_unref(client->chan);
+    g_free(client);
+}
+
+/* Wait (or stop waiting) for data from the client */
+void interface_client_watch(interface_client* client, gboolean watch) {
+    if (watch && !client->watch)
+        client->watch = g_io_add_watch(client->chan, G_IO_IN|G_IO_HUP, interface_client_event, client);
+    else if (!watch && client->watch) {
+        g_source_remove(client->watch);
+        client->watch = 0;
+    }
+}
+
+static gboolean interface_client_resume_cb(gpointer data) {
+    interface_client* client = data;
+
+    client->resume = 0;
+    interface_client_run(client);
+    return FALSE;
+}
+
+/* Wait (or stop waiting) until more data can be sent to the client */
+static void interface_client_watch_output(interface_client* client, gboolean watch) {
+    if (watch && !client->out_watch)
+        client->out_watch = g_io_add_watch(client->chan, G_IO_OUT, interface_client_output_event, client);
+    else if (!watch && client->out_watch) {
+        g_source_remove(client->out_watch);
+        client->out_watch = 0;
+    }
+}
+
+/* Close the connection, dropping anything that was not sent yet. The client is
+   freed once nobody uses it (deferred command, function running one of its
+   commands...). */
+void interface_client_close(interface_client* client) {
+    if (client->closed)
+        return;
+    client->closed = TRUE;
+
+    interface_client_watch(client, FALSE);
+    interface_client_watch_output(client, FALSE);
+    if (client->resume) {
+        g_source_remove(client->resume);
+        client->resume = 0;
+    }
+    g_idle_channels = g_list_remove(g_idle_channels, client);
+    g_clients = g_list_remove(g_clients, client);
+    g_io_channel_shutdown(client->chan, FALSE, NULL);
+    g_info("[ice:%d] Connection closed.", client->fd);
+
+    interface_client_unref(client);
+}
+
+/* Bytes waiting to be sent to the client */
+static gsize interface_client_queued(interface_client* client) {
+    return client->output->len - client->out_pos;
+}
+
+/* Send as much of the output queue as possible. Returns FALSE if the
+   connection was closed. */
+static gboolean interface_client_flush(interface_client* client) {
+    ssize_t n;
+
+    while (interface_client_queued(client) > 0) {
+        n = send(client->fd, client->output->str + client->out_pos, interface_client_queued(client),
+                 MSG_NOSIGNAL);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+                break;
+            g_debug("[iw:%d] Can't write to socket: %s", client->fd, g_strerror(errno));
+            interface_client_close(client);
+            return FALSE;
+        }
+        client->out_pos += n;
+    }
+
+    if (interface_client_queued(client) == 0) {
+        g_string_truncate(client->output, 0);
+        client->out_pos = 0;
+    }
+    else if (client->out_pos > client->output->len / 2) {
+        g_string_erase(client->output, 0, client->out_pos);
+        client->out_pos = 0;
+    }
 
- ie_client_clean:
-    g_io_channel_shutdown(client_chan, TRUE, NULL);
-    g_io_channel_unref(client_chan);
-    g_debug("[ie:%d] Connection closed.", client);
+    if (client->closing && (interface_client_queued(client) == 0)) {
+        /* Everything was sent after a "bye" */
+        interface_client_close(client);
+        return FALSE;
+    }
+    if (client->busy && (interface_client_queued(client) < INTERFACE_BUSY_OUTPUT)) {
+        /* Run the commands that were waiting for the output queue to empty */
+        client->busy = FALSE;
+        if (!client->running && !client->resume)
+            client->resume = g_idle_add(interface_client_resume_cb, client);
+    }
 
+    interface_client_watch_output(client, interface_client_queued(client) > 0);
     return TRUE;
 }
 
-/* Handle communications with the client. */
-gboolean interface_client_event(GIOChannel* source, GIOCondition condition, gpointer data) {
-    GString* buffer = NULL;
-    GError* err = NULL;
-    GIOStatus status;
-    int client;
-    command_result cr = CR_OK;
+/* The client can take more data */
+gboolean interface_client_output_event(GIOChannel* source, GIOCondition condition, gpointer data) {
+    interface_client* client = data;
 
-    client = g_io_channel_unix_get_fd(source);
+    if (!interface_client_flush(client))
+        return FALSE;
 
-    /* Ready for reading? */
-    if (condition & G_IO_IN) {
-        buffer = g_string_sized_new(1024);
-        if (!buffer) {
-            g_warning("[ice:%d] Can't allocate buffer.", client);
-            goto ice_client_clean;
+    return (client->out_watch != 0);
+}
+
+/* Run the complete commands received from the client, in order. Returns FALSE
+   if the connection was closed. */
+gboolean interface_client_run(interface_client* client) {
+    gboolean ret;
+    command_result cr;
+    gchar* line;
+    gchar* eol;
+    int nb = 0;
+
+    /* The client can be closed while running its commands (write error...) */
+    interface_client_ref(client);
+
+    client->running = TRUE;
+    while (!client->deferred && !client->closed && !client->closing && (nb < INTERFACE_MAX_COMMANDS)) {
+        if (interface_client_queued(client) >= INTERFACE_BUSY_OUTPUT) {
+            /* Wait until the client has read the previous answers */
+            client->busy = TRUE;
+            break;
         }
 
-        /* Read exactly one command  */
-        status = g_io_channel_read_line_string(source, buffer, NULL, &err);
-        if (status == G_IO_STATUS_EOF) {
-            g_debug("[ice:%d] Connection reset by peer.", client);
-            goto ice_client_clean;
+        line = client->input->str + client->pos;
+        eol = memchr(line, '\n', client->input->len - client->pos);
+        if (!eol)
+            break;
+        *eol = '\0';
+        client->pos = eol + 1 - client->input->str;
+        nb += 1;
+
+        g_debug("[ice:%d] Received command: %s", client->fd, line);
+        cr = interface_handle_command(client, line);
+
+        if (cr == CR_CLOSE) {
+            /* Close once the answers have been sent */
+            client->closing = TRUE;
+            if (interface_client_queued(client) == 0)
+                interface_client_close(client);
         }
-        else if (status != G_IO_STATUS_NORMAL) {
-            g_debug("[ice:%d] Can't read from IO channel: %s", client, err->message);
-            goto ice_client_clean;
+        else if (cr == CR_IDLE) {
+            /* Add to list of idle channels */
+            if (!g_list_find(g_idle_channels, client))
+                g_idle_channels = g_list_prepend(g_idle_channels, client);
         }
+    }
+    client->running = FALSE;
 
-        buffer->str[buffer->len-1] = '\0';
-        g_debug("[ice:%d] Received command: %s", client, buffer->str);
-        buffer->str[buffer->len-1] = '\n';
+    if (client->closed) {
+        interface_client_unref(client);
+        return FALSE;
+    }
 
-        /* Parse and run the command */
-        cr = interface_handle_command(source, buffer->str);
-        g_string_free(buffer, TRUE);
-        buffer = NULL;
+    /* Forget what was run, without moving the rest every time */
+    if (client->pos >= client->input->len) {
+        g_string_truncate(client->input, 0);
+        client->pos = 0;
+    }
+    else if (client->pos > client->input->len / 2) {
+        g_string_erase(client->input, 0, client->pos);
+        client->pos = 0;
+    }
 
-        /* "idle" command? */
-        if (cr == CR_IDLE) {
-            /* Add to list of idle channels */
-            g_idle_channels = g_list_prepend(g_idle_channels, source);
+    if (client->deferred || client->busy || client->closing) {
+        /* The next commands will be run once the current one is done, or once
+           the client has read its answers: until then, don't read anything */
+        interface_client_watch(client, FALSE);
+    }
+    else if (memchr(client->input->str + client->pos, '\n', client->input->len - client->pos)) {
+        /* More commands are waiting: run them during the next iteration of the
+           main loop, after the other clients */
+        interface_client_watch(client, client->input->len - client->pos < INTERFACE_MAX_INPUT);
+        if (!client->resume)
+            client->resume = g_idle_add(interface_client_resume_cb, client);
+    }
+    else if (client->input->len - client->pos >= INTERFACE_MAX_INPUT) {
+        g_debug("[ice:%d] Command too long.", client->fd);
+        interface_client_close(client);
+    }
+    else
+        interface_client_watch(client, TRUE);
+
+    ret = !client->closed;
+    interface_client_unref(client);
+    return ret;
+}
+
+/* Handle communications with the client. */
+gboolean interface_client_event(GIOChannel* source, GIOCondition condition, gpointer data) {
+    interface_client* client = data;
+    gsize len;
+    ssize_t n;
+
+    /* Ready for reading? */
+    if (condition & G_IO_IN) {
+        /* Append whatever is available to the input buffer */
+        len = client->input->len;
+        g_string_set_size(client->input, len + INTERFACE_READ_SIZE);
+        n = read(client->fd, client->input->str + len, INTERFACE_READ_SIZE);
+        g_string_set_size(client->input, len + MAX(n, 0));
+
+        if (n == 0) {
+            g_debug("[ice:%d] Connection reset by peer.", client->fd);
+            goto ice_client_clean;
+        }
+        else if (n < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN))
+                return TRUE;
+            g_debug("[ice:%d] Can't read from socket: %s", client->fd, g_strerror(errno));
+            goto ice_client_clean;
         }
+
+        /* Parse and run the commands */
+        if (!interface_client_run(client))
+            return FALSE;
     }
 
     /* Received hangup? */
     if (condition & G_IO_HUP) {
-        g_debug("[ice:%d] Connection hung up", client);
+        g_debug("[ice:%d] Connection hung up", client->fd);
         goto ice_client_clean;
     }
 
-    if (cr != CR_CLOSE)
-        return TRUE;
+    return (client->watch != 0);
 
  ice_client_clean:
-    if (buffer)
-        g_string_free(buffer, TRUE);
-    g_idle_channels = g_list_remove(g_idle_channels, source);
-    g_io_channel_shutdown(source, TRUE, NULL);
-    g_io_channel_unref(source);
-    g_info("[ice:%d] Connection closed.", client);
+    interface_client_close(client);
 
     return FALSE;
 }
 
 /* Parse the command and execute it */
-command_result interface_handle_command(GIOChannel* chan, gchar* command){
-    GError* err = NULL;
+command_result interface_handle_command(interface_client* client, gchar* command){
+    gchar* argv[MAX_CMD_ARGS+1];
     gint argc;
-    gchar** argv_;
-    gchar** argv;
-    size_t i;
-
-    /* Parse the command in a shell-like fashion */
-    if (!g_shell_parse_argv(g_strstrip(command), &argc, &argv_, &err)) {
-        g_debug("Command parser error: %s", err->message);
-        interface_write(chan, "{ \"error\": \"invalid command\" }\n");
+    command_key key;
+    command_full_descriptor* cmd_desc;
+
+    /* Parse the command in a shell-like fashion. This is done in place: argv
+       points to the client's input buffer. */
+    argc = split_command(command, argv, MAX_CMD_ARGS+1);
+    if (argc <= 0) {
+        g_debug("Command parser error: %s", (argc < 0) ? "unmatched quote" : "empty command");
+        interface_write(client, "{ \"error\": \"invalid command\" }\n");
         return CR_OK;
     }
-
-    /* Copy argv_ to the stack so it's easier to use... */
-    argv = g_newa(gchar*, argc);
-    for(i=0; i < argc; i++) {
-        argv[i] = g_newa(gchar, strlen(argv_[i]+1));
-        strcpy(argv[i], argv_[i]);
+    if (argc > MAX_CMD_ARGS+1) {
+        interface_write(client, "{ \"error\": \"unknown command\" }\n");
+        return CR_OK;
     }
-    g_strfreev(argv_);
 
     g_debug("Command: [%s] with %d parameter(s)", argv[0], argc-1);
 
     /* Now execute the command */
-    command_full_descriptor* cmd_desc = NULL;
-
-    for (i=0; g_commands[i].name != NULL; i++) {
-        int nb_args = 0;
-        while ((nb_args < MAX_CMD_ARGS) && (g_commands[i].desc.args[nb_args] != CA_NONE))
-            nb_args += 1;
-        if ((strcmp(g_commands[i].name, argv[0]) == 0) && (nb_args == argc-1)) {
-            cmd_desc = &(g_commands[i]);
-            break;
-        }
-    }
+    key.name = argv[0];
+    key.nb_args = argc-1;
+    cmd_desc = g_hash_table_lookup(g_commands_table, &key);
     if (!cmd_desc) {
-        interface_write(chan, "{ \"error\": \"unknown command\" }\n");
+        interface_write(client, "{ \"error\": \"unknown command\" }\n");
         return CR_OK;
     }
 
     /* Handle "normal" and "special" commands separately. */
     switch (cmd_desc->type) {
     case CT_FUNC: {
-        gboolean ret;
-
-        ret = command_run((command_finalize_func) interface_finalize, chan, &(cmd_desc->desc), argc, argv);
-        return (ret ? CR_OK : CR_DEFERED);
+        /* The client must not go away before the command is done */
+        client->deferred = TRUE;
+        command_run((command_finalize_func) interface_finalize, interface_client_ref(client),
+                    &(cmd_desc->desc), argc, argv);
+        return (client->deferred ? CR_DEFERED : CR_OK);
     }
 
     case CT_BYE:
-        interface_write(chan, "Bye bye!\n");
+        interface_write(client, "Bye bye!\n");
         return CR_CLOSE;
 
     case CT_QUIT:
@@ -366,66 +619,109 @@ command_result interface_handle_command(GIOChannel* chan, gchar* command){
     return CR_OK;
 }
 
-gboolean interface_write(GIOChannel* chan, const gchar* str) {
-    GIOStatus status;
-    GError* err = NULL;
-    int client = g_io_channel_unix_get_fd(chan);
-
-    if (str && chan->is_writeable) {
-        status = g_io_channel_write_chars(chan, str, -1, NULL, &err);
-        if (status != G_IO_STATUS_NORMAL) {
-            if (err)
-                g_debug("[iw:%d] Can't write to IO channel (%d)", client, status);
-            else
-                g_debug("[iw:%d] Can't write to IO channel (%d): %s", client, status, err->message);
-            return FALSE;
-        }
-    }
+/* Send the output queue, or as much of it as the client can take right now.
+   Returns FALSE if the client was disconnected. */
+static gboolean interface_client_send(interface_client* client) {
+    gsize queued;
+
+    if (!interface_client_flush(client))
+        return FALSE;
 
-    status = g_io_channel_flush(chan, &err);
-    if (status != G_IO_STATUS_NORMAL) {
-        if (err)
-            g_debug("[iw:%d] Can't flush IO channel (%d)", client, status);
-        else
-            g_debug("[iw:%d] Can't flush IO channel (%d): %s", client, status, err->message);
+    queued = interface_client_queued(client);
+    g_peak_output = MAX(g_peak_output, queued);
+    if ((g_max_output > 0) && (queued > g_max_output)) {
+        g_info("[iw:%d] Client too slow (%" G_GSIZE_FORMAT " bytes waiting), disconnecting it.",
+               client->fd, queued);
+        g_dropped_clients += 1;
+        interface_client_close(client);
         return FALSE;
     }
 
     return TRUE;
 }
 
-void interface_finalize(const gchar* str, GIOChannel* chan) {
-    interface_write(chan, str);
+/* Send str to the client, or queue it if the client can't take it right now.
+   Returns FALSE if the client was disconnected. */
+gboolean interface_write(interface_client* client, const gchar* str) {
+    if (client->closed)
+        return FALSE;
+    if (!str)
+        return TRUE;
+
+    g_string_append(client->output, str);
+    return interface_client_send(client);
 }
 
+/* Same as interface_write(), but when nothing else is waiting to be sent, the
+   contents of str become the output queue instead of being copied to it */
+gboolean interface_write_string(interface_client* client, GString* str) {
+    GString tmp;
+
+    if (client->closed)
+        return FALSE;
+
+    if (interface_client_queued(client) == 0) {
+        tmp = *(client->output);
+        *(client->output) = *str;
+        *str = tmp;
+        client->out_pos = 0;
+    }
+    else
+        g_string_append_len(client->output, str->str, str->len);
+
+    return interface_client_send(client);
+}
+
+void interface_finalize(GString* str, interface_client* client) {
+    client->deferred = FALSE;
+
+    /* Writing can close the client (write error, too much output waiting):
+       then the reference below is the last one */
+    if (!client->closed && interface_write_string(client, str) && !client->closed) {
+        /* Run the commands received in the meantime */
+        if (!client->running && !client->resume)
+            client->resume = g_idle_add(interface_client_resume_cb, client);
+    }
+    interface_client_unref(client);
+}
+
+
+/* Statistics about the clients (stats command) */
+void interface_get_stats(interface_stats* stats) {
+    GList* cur;
+
+    memset(stats, 0, sizeof(interface_stats));
+    for (cur = g_clients; cur; cur = cur->next) {
+        gsize queued = interface_client_queued(cur->data);
+        stats->clients += 1;
+        stats->queued += queued;
+        stats->max_queued = MAX(stats->max_queued, queued);
+    }
+    stats->peak_queued = g_peak_output;
+    stats->dropped = g_dropped_clients;
+}
 
 /* Notify clients (channels or plugins) that are waiting for an update */
 /* TODO: use a command_finalize_func for that too */
 void interface_notify() {
-    GString* str = g_string_sized_new(1024);
-    JsonBuilder* jb = json_builder_new();
-    command_context ctx = { jb, NULL, NULL };
+    GList* idle;
+    GString* str;
+    json_writer* jw = json_writer_new(config_get_bool_opt("pretty_json", FALSE));
+    command_context ctx = { jw, NULL, NULL };
 
-    json_builder_begin_object(jb);
+    json_writer_begin_object(jw);
     status(&ctx);
-    json_builder_end_object(jb);
-
-    JsonGenerator *gen = json_generator_new();
-    g_object_set(gen, "pretty", config_get_bool_opt("pretty_json", FALSE), NULL);
-    json_generator_set_root(gen, json_builder_get_root(jb));
-
-    gchar *tmp = json_generator_to_data(gen, NULL);
-    g_string_assign(str, tmp);
-    g_string_append(str, "\n");
+    json_writer_end_object(jw);
 
-    g_object_unref(gen);
-    g_object_unref(jb);
-    g_free(tmp);
+    str = json_writer_free(jw, FALSE);
+    g_string_append_c(str, '\n');
 
-    /* First notify idle channels */
-    g_list_foreach(g_idle_channels, interface_notify_chan, str);
-    g_list_free(g_idle_channels);
+    /* First notify idle channels (writing to a channel may close it, and remove
+       it from the list) */
+    idle = g_idle_channels;
     g_idle_channels = NULL;
+    g_list_foreach(idle, interface_notify_chan, str);
+    g_list_free(idle);
 
     /* Then call callbacks from plugins */
     g_list_foreach(g_notification_callbacks, interface_notify_callback, str);
@@ -434,10 +730,10 @@ void interface_notify() {
 }
 
 void interface_notify_chan(gpointer data, gpointer user_data) {
-    GIOChannel* chan = data;
+    interface_client* client = data;
     GString* str = user_data;
 
-    interface_write(chan, str->str);
+    interface_write(client, str->str);
 }
 
 void interface_notify_callback(gpointer data, gpointer user_data) {
@@ -29,7 +29,7 @@
 #include <glib.h>
 
 /* Commands management */
-#define MAX_CMD_ARGS 2
+#define MAX_CMD_ARGS 3
 typedef enum { CA_NONE=0, CA_INT, CA_STR, CA_URI } command_arg;
 typedef struct {
     void*       func;
@@ -47,13 +47,57 @@ extern command_full_descriptor g_commands[];
 /* Functions called directly from spop */
 void interface_init();
 
+/* A client connection. Commands are run in the order they were received: while
+   a command is deferred (its result is not known yet), or while the client
+   has not read the previous answers, the next ones wait in the input buffer.
+   Answers the client can't take right away wait in the output queue. */
+typedef struct {
+    GIOChannel* chan;
+    int         fd;
+    gint        ref_count;      /* Connection + deferred command */
+
+    GString*    input;          /* Data received but not run yet... */
+    gsize       pos;            /* ...starting from here */
+    GString*    output;         /* Data not sent yet... */
+    gsize       out_pos;        /* ...starting from here */
+
+    guint       watch;          /* Waiting for data */
+    guint       out_watch;      /* Waiting until more data can be sent */
+    guint       resume;         /* Idle source running the waiting commands */
+    gboolean    running;
+    gboolean    deferred;
+    gboolean    busy;           /* Too much output waiting */
+    gboolean    closing;        /* Close once the output is sent */
+    gboolean    closed;
+} interface_client;
+
 /* Internal functions used to manage the network interface */
 typedef enum { CR_OK=0, CR_CLOSE, CR_DEFERED, CR_IDLE } command_result;
 gboolean interface_event(GIOChannel* source, GIOCondition condition, gpointer data);
 gboolean interface_client_event(GIOChannel* source, GIOCondition condition, gpointer data);
-command_result interface_handle_command(GIOChannel* chan, gchar* command);
-gboolean interface_write(GIOChannel* source, const gchar* str);
-void interface_finalize(const gchar* str, GIOChannel* chan);
+gboolean interface_client_output_event(GIOChannel* source, GIOCondition condition, gpointer data);
+
+interface_client* interface_client_new(GIOChannel* chan);
+interface_client* interface_client_ref(interface_client* client);
+void interface_client_unref(interface_client* client);
+void interface_client_watch(interface_client* client, gboolean watch);
+void interface_client_close(interface_client* client);
+gboolean interface_client_run(interface_client* client);
+
+command_result interface_handle_command(interface_client* client, gchar* command);
+gboolean interface_write(interface_client* client, const gchar* str);
+gboolean interface_write_string(interface_client* client, GString* str);
+void interface_finalize(GString* str, interface_client* client);
+
+/* Statistics about the clients */
+typedef struct {
+    guint   clients;            /* Connected clients */
+    gsize   queued;             /* Bytes waiting to be sent, to all the clients */
+    gsize   max_queued;         /* Longest output queue right now */
+    gsize   peak_queued;        /* Longest output queue ever */
+    guint64 dropped;            /* Clients disconnected for being too slow */
+} interface_stats;
+void interface_get_stats(interface_stats* stats);
 
 /* Notify clients (channels or plugins) that are waiting for an update */
 void interface_notify();
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+
+#include "json_writer.h"
+
+json_writer* json_writer_new(gboolean pretty) {
+    json_writer* jw = g_new0(json_writer, 1);
+
+    jw->str = g_string_sized_new(1024);
+    jw->pretty = pretty;
+    jw->empty = TRUE;
+
+    return jw;
+}
+
+/* Free the writer, and return the JSON text (unless free_str is TRUE) */
+GString* json_writer_free(json_writer* jw, gboolean free_str) {
+    GString* str = jw->str;
+
+    g_free(jw);
+    if (free_str) {
+        g_string_free(str, TRUE);
+        return NULL;
+    }
+    return str;
+}
+
+/* Line break and indentation (pretty-printed output only) */
+static void _json_writer_newline(json_writer* jw, guint depth) {
+    if (jw->pretty && (jw->depth > 0)) {
+        g_string_append_c(jw->str, '\n');
+        while (depth-- > 0)
+            g_string_append_len(jw->str, "  ", 2);
+    }
+}
+
+/* Separate the next value from the previous one */
+static void _json_writer_next(json_writer* jw) {
+    if (jw->member) {
+        /* The separator is already there, before the member name */
+        jw->member = FALSE;
+        return;
+    }
+    if (!jw->empty)
+        g_string_append_c(jw->str, ',');
+    jw->empty = FALSE;
+    _json_writer_newline(jw, jw->depth);
+}
+
+static void _json_writer_begin(json_writer* jw, gchar c) {
+    _json_writer_next(jw);
+    g_string_append_c(jw->str, c);
+    jw->depth += 1;
+    jw->empty = TRUE;
+}
+
+static void _json_writer_end(json_writer* jw, gchar c) {
+    if (!jw->empty)
+        _json_writer_newline(jw, jw->depth - 1);
+    g_string_append_c(jw->str, c);
+    jw->depth -= 1;
+    jw->empty = FALSE;
+}
+
+/* Append a quoted string, escaping only what must be escaped. Runs of
+   characters that don't need escaping are copied at once. */
+static void _json_writer_append_string(json_writer* jw, const gchar* s) {
+    const gchar* run = s;
+    guchar c;
+
+    g_string_append_c(jw->str, '"');
+    for (; (c = *s) != '\0'; s++) {
+        if ((c >= 0x20) && (c != '"') && (c != '\\'))
+            continue;
+
+        g_string_append_len(jw->str, run, s - run);
+        run = s + 1;
+        switch (c) {
+        case '"':  g_string_append_len(jw->str, "\\\"", 2); break;
+        case '\\': g_string_append_len(jw->str, "\\\\", 2); break;
+        case '\b': g_string_append_len(jw->str, "\\b", 2); break;
+        case '\f': g_string_append_len(jw->str, "\\f", 2); break;
+        case '\n': g_string_append_len(jw->str, "\\n", 2); break;
+        case '\r': g_string_append_len(jw->str, "\\r", 2); break;
+        case '\t': g_string_append_len(jw->str, "\\t", 2); break;
+        default:   g_string_append_printf(jw->str, "\\u%04x", c);
+        }
+    }
+    g_string_append_len(jw->str, run, s - run);
+    g_string_append_c(jw->str, '"');
+}
+
+void json_writer_begin_object(json_writer* jw) {
+    _json_writer_begin(jw, '{');
+}
+
+void json_writer_end_object(json_writer* jw) {
+    _json_writer_end(jw, '}');
+}
+
+void json_writer_begin_array(json_writer* jw) {
+    _json_writer_begin(jw, '[');
+}
+
+void json_writer_end_array(json_writer* jw) {
+    _json_writer_end(jw, ']');
+}
+
+void json_writer_set_member_name(json_writer* jw, const gchar* name) {
+    _json_writer_next(jw);
+    _json_writer_append_string(jw, name);
+    if (jw->pretty)
+        g_string_append_len(jw->str, " : ", 3);
+    else
+        g_string_append_c(jw->str, ':');
+    jw->member = TRUE;
+}
+
+void json_writer_add_string_value(json_writer* jw, const gchar* value) {
+    _json_writer_next(jw);
+    if (value)
+        _json_writer_append_string(jw, value);
+    else
+        g_string_append_len(jw->str, "null", 4);
+}
+
+void json_writer_add_int_value(json_writer* jw, gint64 value) {
+    gchar buf[24];
+    gchar* p = buf + sizeof(buf);
+    guint64 u = (value < 0) ? -(guint64) value : (guint64) value;
+
+    /* Much faster than printf, and there are lots of integers to write */
+    do {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    } while (u > 0);
+    if (value < 0)
+        *--p = '-';
+
+    _json_writer_next(jw);
+    g_string_append_len(jw->str, p, buf + sizeof(buf) - p);
+}
+
+void json_writer_add_double_value(json_writer* jw, gdouble value) {
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    _json_writer_next(jw);
+    g_string_append(jw->str, g_ascii_dtostr(buf, sizeof(buf), value));
+}
+
+void json_writer_add_boolean_value(json_writer* jw, gboolean value) {
+    _json_writer_next(jw);
+    if (value)
+        g_string_append_len(jw->str, "true", 4);
+    else
+        g_string_append_len(jw->str, "false", 5);
+}
+
+void json_writer_add_null_value(json_writer* jw) {
+    _json_writer_next(jw);
+    g_string_append_len(jw->str, "null", 4);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <glib.h>
+
+/* Streaming JSON output.
+ *
+ * The API is the same as JsonBuilder's, but the JSON text is written to a
+ * GString as it goes, instead of building a tree of nodes and serializing it
+ * afterwards. The calls must be well nested, and the writer can't check that
+ * member names are unique. */
+typedef struct {
+    GString* str;
+    gboolean pretty;
+    guint    depth;
+    gboolean empty;             /* Nothing in the current object/array yet */
+    gboolean member;            /* A member name was just written */
+} json_writer;
+
+json_writer* json_writer_new(gboolean pretty);
+GString* json_writer_free(json_writer* jw, gboolean free_str);
+
+void json_writer_begin_object(json_writer* jw);
+void json_writer_end_object(json_writer* jw);
+void json_writer_begin_array(json_writer* jw);
+void json_writer_end_array(json_writer* jw);
+void json_writer_set_member_name(json_writer* jw, const gchar* name);
+
+void json_writer_add_string_value(json_writer* jw, const gchar* value);
+void json_writer_add_int_value(json_writer* jw, gint64 value);
+void json_writer_add_double_value(json_writer* jw, gdouble value);
+void json_writer_add_boolean_value(json_writer* jw, gboolean value);
+void json_writer_add_null_value(json_writer* jw);
+
+#endif
@@ -0,0 +1,543 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+#include <libspotify/api.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "spop.h"
+#include "config.h"
+#include "dsp.h"
+#include "output.h"
+#include "plugin.h"
+#include "resample.h"
+#include "utils.h"
+
+/* Duration of a gain ramp from silence to full volume, in ms */
+#define VOLUME_RAMP_MS 30
+
+/* At most this many frames are processed at once: libspotify delivers them
+   again until the plugin accepts them, so there's no point in processing more
+   than the plugin can take */
+#define OUTPUT_MAX_FRAMES 4096
+
+/* How long the main loop keeps trying to give the plugin the processed frames
+   that are still pending at the end of the data (in µs), and how often (in
+   ms) */
+#define OUTPUT_DRAIN_TIMEOUT (G_USEC_PER_SEC)
+#define OUTPUT_DRAIN_POLL    5
+
+static GMutex g_output_mutex;
+
+/* Serializes the calls to the plugin. When both are needed, it is taken after
+   g_output_mutex: giving frames to the plugin and asking for its latency are
+   done with both held. Flushing and closing the plugin are done with only this
+   one held, so a slow plugin doesn't keep g_output_mutex locked for longer than
+   a single call. */
+static GMutex g_plugin_mutex;
+static gint g_volume = 100;
+static gfloat g_gain = 1.f;
+static int16_t* g_scratch = NULL;
+
+/* Fixed output rate (0 to use the rate of each track) */
+static int g_output_rate = 0;
+static resampler* g_resampler = NULL;
+static int g_unsupported_rate = 0;
+
+/* The resampler and the filters keep some state, so they must see each frame
+   exactly once: when one of them is used, all the input frames are accepted at
+   once, and the processed frames (in g_out_format) are kept in g_pending until
+   the plugin takes them. The filters work in place in this buffer. */
+static sp_audioformat g_out_format;
+static int16_t* g_pending = NULL;
+static gsize g_pending_size = 0;        /* In samples */
+static int g_pending_len = 0;           /* In frames */
+static int g_pending_pos = 0;
+
+/* Plugin being switched to (see output_switch_begin()): until the current one
+   has played everything it buffered, no frame is accepted */
+static audio_output* g_next_audio = NULL;
+
+/* End of the data (see output_drain()): the pending frames are given to the
+   plugin from the main loop, then the plugin is drained */
+static gboolean g_drain_requested = FALSE;
+static gint64 g_drain_deadline = 0;
+static guint g_drain_source = 0;
+
+/* Processing time of each stage: volume, resampler, then the filters */
+static GArray* g_stages = NULL;
+#define STAGE_VOLUME   0
+#define STAGE_RESAMPLE 1
+#define STAGE_FILTERS  2
+
+/* "Private" function: the perceived loudness is roughly the cube root of the
+   amplitude */
+static gfloat _output_volume_gain(int volume) {
+    gfloat v = volume / 100.f;
+    return v * v * v;
+}
+
+/* Calls to the plugin, with g_plugin_mutex held */
+static int _output_plugin_deliver(const sp_audioformat* format, const void* frames, int num_frames) {
+    int n;
+
+    g_mutex_lock(&g_plugin_mutex);
+    n = audio_output_deliver(g_audio, format, frames, num_frames);
+    g_mutex_unlock(&g_plugin_mutex);
+    return n;
+}
+
+static int _output_plugin_latency() {
+    int n;
+
+    g_mutex_lock(&g_plugin_mutex);
+    n = audio_output_latency(g_audio);
+    g_mutex_unlock(&g_plugin_mutex);
+    return n;
+}
+
+static void _output_plugin_drain() {
+    g_mutex_lock(&g_plugin_mutex);
+    audio_output_drain(g_audio);
+    g_mutex_unlock(&g_plugin_mutex);
+}
+
+/* Send the resampled frames the plugin didn't take yet. Returns TRUE if there
+   are none left. */
+static gboolean _output_push_pending() {
+    int n;
+
+    if (g_next_audio)
+        return (g_pending_pos >= g_pending_len);
+    if (g_pending_pos < g_pending_len) {
+        n = _output_plugin_deliver(&g_out_format,
+                                   g_pending + g_pending_pos * g_out_format.channels,
+                                   g_pending_len - g_pending_pos);
+        g_pending_pos += n;
+    }
+    return (g_pending_pos >= g_pending_len);
+}
+
+/* Try again to give the pending frames to the plugin, from the main loop */
+static gboolean _output_drain_event(gpointer data);
+static void _output_schedule_drain(gboolean first) {
+    if (g_drain_source)
+        return;
+    if (first)
+        g_drain_source = g_idle_add(_output_drain_event, NULL);
+    else
+        g_drain_source = g_timeout_add(OUTPUT_DRAIN_POLL, _output_drain_event, NULL);
+}
+
+static gboolean _output_drain_event(gpointer data) {
+    gboolean done;
+
+    g_mutex_lock(&g_output_mutex);
+    g_drain_source = 0;
+    if (!g_drain_requested || g_next_audio) {
+        /* Flushed or closed in the meantime, or switching plugins (then
+           output_switch_end() takes over) */
+        g_mutex_unlock(&g_output_mutex);
+        return FALSE;
+    }
+
+    done = _output_push_pending();
+    if (!done && (g_get_monotonic_time() >= g_drain_deadline)) {
+        g_debug("Output: dropping %d processed frames", g_pending_len - g_pending_pos);
+        g_pending_len = g_pending_pos = 0;
+        done = TRUE;
+    }
+    if (done)
+        g_drain_requested = FALSE;
+    else
+        _output_schedule_drain(FALSE);
+    g_mutex_unlock(&g_output_mutex);
+
+    if (done)
+        _output_plugin_drain();
+    return FALSE;
+}
+
+/* Drop everything that was not given to the plugin yet */
+static void _output_reset() {
+    GList* cur;
+
+    if (g_resampler)
+        resampler_reset(g_resampler);
+    for (cur = g_filters; cur; cur = cur->next)
+        audio_filter_reset(cur->data);
+    g_pending_len = g_pending_pos = 0;
+}
+
+static void _output_stage_add(const gchar* name) {
+    output_stage st = { 0 };
+    st.name = name;
+    g_array_append_val(g_stages, st);
+}
+
+/* Account for a call to a stage that started at start (monotonic time) */
+static void _output_stage_done(int stage, gint64 start, int num_frames, int rate) {
+    output_stage* st = &g_array_index(g_stages, output_stage, stage);
+
+    latency_stats_add(&st->time, g_get_monotonic_time() - start);
+    st->frames += num_frames;
+    st->audio_time += (G_USEC_PER_SEC * (gint64) num_frames) / rate;
+}
+
+/* Run the pending frames through the filters */
+static void _output_filter() {
+    GList* cur;
+    int stage = STAGE_FILTERS;
+
+    for (cur = g_filters; cur; cur = cur->next, stage++) {
+        gint64 start = g_get_monotonic_time();
+        audio_filter_process(cur->data, &g_out_format, g_pending, g_pending_len);
+        _output_stage_done(stage, start, g_pending_len, g_out_format.sample_rate);
+    }
+}
+
+/* Make sure there is a resampler for this format if it needs one. Must only be
+   called when nothing is pending. Returns TRUE if the frames have to be
+   resampled. */
+static gboolean _output_setup_resampler(const sp_audioformat* format) {
+    gsize size;
+
+    if ((g_output_rate <= 0) || (format->sample_rate == g_output_rate)) {
+        if (g_resampler) {
+            resampler_free(g_resampler);
+            g_resampler = NULL;
+        }
+        return FALSE;
+    }
+
+    if (g_resampler && (resampler_in_rate(g_resampler) == format->sample_rate)
+        && (resampler_channels(g_resampler) == format->channels))
+        return TRUE;
+
+    resampler_free(g_resampler);
+    g_resampler = resampler_new(format->sample_rate, g_output_rate, format->channels);
+    if (!g_resampler) {
+        if (g_unsupported_rate != format->sample_rate)
+            g_warning("Can't resample from %d Hz to %d Hz, the output will use the track rate",
+                      format->sample_rate, g_output_rate);
+        g_unsupported_rate = format->sample_rate;
+        return FALSE;
+    }
+
+    g_out_format = *format;
+    g_out_format.sample_rate = g_output_rate;
+    size = resampler_max_output(g_resampler, OUTPUT_MAX_FRAMES) * format->channels;
+    if (size > g_pending_size) {
+        g_pending = g_renew(int16_t, g_pending, size);
+        g_pending_size = size;
+    }
+    return TRUE;
+}
+
+void output_init() {
+    GList* cur;
+
+    output_set_volume(config_get_int_opt("volume", 100));
+    g_gain = _output_volume_gain(g_volume);
+    g_scratch = g_new(int16_t, OUTPUT_MAX_FRAMES * 8);
+    g_pending_size = OUTPUT_MAX_FRAMES * 8;
+    g_pending = g_new(int16_t, g_pending_size);
+
+    g_stages = g_array_new(FALSE, FALSE, sizeof(output_stage));
+    _output_stage_add("volume");
+    _output_stage_add("resample");
+    for (cur = g_filters; cur; cur = cur->next)
+        _output_stage_add(((audio_filter*) cur->data)->name);
+
+    g_output_rate = config_get_int_opt("output_rate", 0);
+    if (g_output_rate < 0)
+        g_error("Invalid output rate: %d", g_output_rate);
+    if (g_output_rate > 0)
+        g_debug("Output rate: %d Hz", g_output_rate);
+}
+
+int output_get_volume() {
+    return g_atomic_int_get(&g_volume);
+}
+
+void output_set_volume(int volume) {
+    g_atomic_int_set(&g_volume, CLAMP(volume, 0, 100));
+}
+
+int output_deliver(const sp_audioformat* format, const void* frames, int num_frames) {
+    const int16_t* src = frames;
+    gfloat target, step = 0.f;
+    int channels = format->channels;
+    int ramp = 0, n;
+    gboolean resample, gain;
+    int16_t* dst;
+    gint64 start;
+
+    g_mutex_lock(&g_output_mutex);
+
+    if (g_next_audio) {
+        /* Switching to another plugin: libspotify will deliver these frames
+           again later */
+        g_mutex_unlock(&g_output_mutex);
+        return 0;
+    }
+
+    if (channels > 8) {
+        n = _output_plugin_deliver(format, frames, num_frames);
+        g_mutex_unlock(&g_output_mutex);
+        return n;
+    }
+
+    if (num_frames == 0) {
+        /* Discontinuity */
+        _output_reset();
+        n = _output_plugin_deliver(format, frames, 0);
+        g_mutex_unlock(&g_output_mutex);
+        return n;
+    }
+
+    /* Nothing new is accepted until the plugin took the previous frames */
+    if (!_output_push_pending()) {
+        g_mutex_unlock(&g_output_mutex);
+        return 0;
+    }
+    resample = _output_setup_resampler(format);
+
+    target = _output_volume_gain(g_atomic_int_get(&g_volume));
+    gain = (target != 1.f) || (g_gain != 1.f);
+    if (!gain && !resample && !g_filters) {
+        /* Nothing to do */
+        n = _output_plugin_deliver(format, frames, num_frames);
+        g_mutex_unlock(&g_output_mutex);
+        return n;
+    }
+
+    /* Without the resampler, the frames go straight to g_pending if they have
+       to be filtered */
+    num_frames = MIN(num_frames, OUTPUT_MAX_FRAMES);
+    dst = (g_filters && !resample) ? g_pending : g_scratch;
+
+    if (gain) {
+        start = g_get_monotonic_time();
+        if (g_gain != target) {
+            /* Ramp at a constant speed; the last frame of the ramp is at the
+               target gain */
+            ramp = (int) ceilf(fabsf(target - g_gain) * format->sample_rate * VOLUME_RAMP_MS / 1000.f);
+            ramp = MAX(ramp, 1);
+            step = (target - g_gain) / ramp;
+            dsp_gain_s16(dst, src, MIN(ramp, num_frames), channels, g_gain + step, step);
+        }
+        if (ramp < num_frames)
+            dsp_gain_s16(dst + ramp * channels, src + ramp * channels,
+                         num_frames - ramp, channels, target, 0.f);
+        src = dst;
+        _output_stage_done(STAGE_VOLUME, start, num_frames, format->sample_rate);
+    }
+
+    if (resample) {
+        start = g_get_monotonic_time();
+        g_pending_len = resampler_process(g_resampler, src, num_frames, g_pending);
+        _output_stage_done(STAGE_RESAMPLE, start, num_frames, format->sample_rate);
+    }
+    else if (g_filters) {
+        if (src != g_pending)
+            memcpy(g_pending, src, num_frames * channels * sizeof(int16_t));
+        g_pending_len = num_frames;
+        g_out_format = *format;
+    }
+
+    if (resample || g_filters) {
+        g_pending_pos = 0;
+        _output_filter();
+        _output_push_pending();
+        n = num_frames;
+    }
+    else
+        n = _output_plugin_deliver(format, src, num_frames);
+
+    /* Only the frames accepted by the plugin move the ramp forward */
+    if (n >= ramp)
+        g_gain = target;
+    else if (n > 0)
+        g_gain += n * step;
+
+    g_mutex_unlock(&g_output_mutex);
+    return n;
+}
+
+/* output_flush(), output_close() and the switch functions are only called from
+   the main loop, which is also the only place where g_audio changes. They call
+   the plugin after releasing g_output_mutex, but with g_plugin_mutex held:
+   libspotify's thread may be giving it frames (or asking for its latency) at
+   the same time. */
+void output_flush() {
+    g_mutex_lock(&g_output_mutex);
+    _output_reset();
+    g_drain_requested = FALSE;
+    g_mutex_unlock(&g_output_mutex);
+
+    g_mutex_lock(&g_plugin_mutex);
+    audio_output_flush(g_audio);
+    g_mutex_unlock(&g_plugin_mutex);
+}
+
+/* End of the data: the plugin has to get the processed frames that are still
+   pending first. This is called from libspotify's thread and must not wait for
+   the plugin, so the main loop takes care of that. During a switch, the
+   pending frames are for the next plugin: it is drained once it gets them. */
+void output_drain() {
+    g_mutex_lock(&g_output_mutex);
+    g_drain_requested = TRUE;
+    g_drain_deadline = g_get_monotonic_time() + OUTPUT_DRAIN_TIMEOUT;
+    if (!g_next_audio)
+        _output_schedule_drain(TRUE);
+    g_mutex_unlock(&g_output_mutex);
+}
+
+void output_close() {
+    GList* cur;
+    gboolean drain;
+
+    g_mutex_lock(&g_output_mutex);
+    drain = g_drain_requested && !g_next_audio;
+    if (drain) {
+        /* The main loop had no time to finish the drain: the plugin gets what
+           it can take right away */
+        _output_push_pending();
+    }
+    _output_reset();
+    for (cur = g_filters; cur; cur = cur->next)
+        audio_filter_close(cur->data);
+    g_drain_requested = FALSE;
+    g_mutex_unlock(&g_output_mutex);
+
+    g_mutex_lock(&g_plugin_mutex);
+    if (drain)
+        audio_output_drain(g_audio);
+    audio_output_close(g_audio);
+    g_mutex_unlock(&g_plugin_mutex);
+}
+
+/* Frames (at the rate of the track) delivered but not heard yet */
+int output_latency() {
+    gint64 latency;
+
+    g_mutex_lock(&g_output_mutex);
+    latency = _output_plugin_latency() + (g_pending_len - g_pending_pos);
+    if (g_resampler) {
+        latency = latency * resampler_in_rate(g_resampler) / g_output_rate
+            + resampler_delay(g_resampler);
+    }
+    g_mutex_unlock(&g_output_mutex);
+
+    return (int) latency;
+}
+
+/* Implementation of libspotify's get_audio_buffer_stats callback, whatever the
+   current plugin */
+void output_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    g_mutex_lock(&g_output_mutex);
+    g_mutex_lock(&g_plugin_mutex);
+    if (g_audio->buffer_stats)
+        g_audio->buffer_stats(session, stats);
+    else {
+        stats->samples = audio_output_latency(g_audio);
+        stats->stutter = 0;
+    }
+    g_mutex_unlock(&g_plugin_mutex);
+    g_mutex_unlock(&g_output_mutex);
+}
+
+/* Start switching to another plugin: the current one plays what it buffered,
+   and the frames delivered in the meantime are refused. Returns FALSE if a
+   switch is already in progress. */
+gboolean output_switch_begin(audio_output* next) {
+    g_mutex_lock(&g_output_mutex);
+    if (g_next_audio) {
+        g_mutex_unlock(&g_output_mutex);
+        return FALSE;
+    }
+    g_next_audio = next;
+    g_mutex_unlock(&g_output_mutex);
+
+    _output_plugin_drain();
+
+    g_info("Switching audio output from %s to %s...", g_audio->name, next->name);
+    return TRUE;
+}
+
+/* Frames the current plugin still has to play before the switch can end */
+int output_switch_remaining() {
+    return _output_plugin_latency();
+}
+
+/* Use the next plugin from now on, and close the previous one. If flush is
+   TRUE, what the previous plugin did not play yet is dropped (the caller is
+   expected to seek back), along with the processed frames not played yet. */
+void output_switch_end(gboolean flush) {
+    audio_output prev;
+
+    g_mutex_lock(&g_output_mutex);
+    if (!g_next_audio) {
+        g_mutex_unlock(&g_output_mutex);
+        return;
+    }
+    if (flush) {
+        _output_reset();
+        g_drain_requested = FALSE;
+    }
+
+    prev = *g_audio;
+    *g_audio = *g_next_audio;
+    g_free(g_next_audio);
+    g_next_audio = NULL;
+
+    /* End of track during the switch */
+    if (g_drain_requested) {
+        g_drain_deadline = g_get_monotonic_time() + OUTPUT_DRAIN_TIMEOUT;
+        _output_schedule_drain(TRUE);
+    }
+    g_mutex_unlock(&g_output_mutex);
+
+    g_mutex_lock(&g_plugin_mutex);
+    audio_output_close(&prev);
+    g_mutex_unlock(&g_plugin_mutex);
+    g_info("Audio output switched to %s", g_audio->name);
+    g_free(prev.name);
+}
+
+/* Copy of the statistics of each stage, to be freed with g_array_free() */
+GArray* output_get_stages() {
+    GArray* stages;
+
+    g_mutex_lock(&g_output_mutex);
+    stages = g_array_sized_new(FALSE, FALSE, sizeof(output_stage), g_stages->len);
+    g_array_append_vals(stages, g_stages->data, g_stages->len);
+    g_mutex_unlock(&g_output_mutex);
+
+    return stages;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <glib.h>
+#include <libspotify/api.h>
+
+#include "plugin.h"
+#include "utils.h"
+
+/* Output stage: processing applied to the frames on their way to the audio
+ * plugin, after the crossfade (if any).
+ *
+ * First the software volume: volume changes are applied with a short gain ramp
+ * to avoid clicks; since the gain is applied before the plugin buffer, they
+ * are heard after the output latency. At full volume the frames are passed
+ * through untouched.
+ *
+ * Then, if output_rate is set, every track is resampled to that rate, so that
+ * the plugin never has to reopen the device when the rate changes.
+ *
+ * Finally the filter plugins (see filter.h) process the frames in place.
+ *
+ * The rest of spop should use the output_* functions below instead of the
+ * audio_output_* ones, so that the frames held here are taken into account.
+ *
+ * The audio plugin can be replaced while playing: once output_switch_begin()
+ * was called, no frame is accepted until the current plugin has played what it
+ * buffered (output_switch_remaining() frames), then output_switch_end() makes
+ * the next plugin the current one. */
+
+/* Processing time of a stage */
+typedef struct {
+    const gchar*  name;
+    guint64       frames;       /* Frames processed by the stage */
+    gint64        audio_time;   /* Duration of these frames, in µs */
+    latency_stats time;         /* Processing time of each call */
+} output_stage;
+
+void output_init();
+
+/* Called from libspotify's thread (or from the crossfade) */
+int output_deliver(const sp_audioformat* format, const void* frames, int num_frames);
+void output_drain();
+void output_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats);
+
+/* Called from the main thread */
+void output_flush();
+void output_close();
+int output_latency();
+GArray* output_get_stages();
+gboolean output_switch_begin(audio_output* next);
+int output_switch_remaining();
+void output_switch_end(gboolean flush);
+
+/* Volume, from 0 to 100 */
+int output_get_volume();
+void output_set_volume(int volume);
+
+#endif
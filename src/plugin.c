@@ -25,13 +25,17 @@
 
 #include <glib.h>
 #include <gmodule.h>
+#include <string.h>
 
 #include "spop.h"
 #include "config.h"
 #include "plugin.h"
 
-audio_delivery_func_ptr g_audio_delivery_func = NULL;
-audio_buffer_stats_func_ptr g_audio_buffer_stats_func = NULL;
+static audio_output g_audio_output;
+audio_output* g_audio = &g_audio_output;
+
+/* Filters, in processing order */
+GList* g_filters = NULL;
 
 static GList* g_plugins_close_functions = NULL;
 
@@ -50,16 +54,108 @@ static GModule* plugin_open(char* module_name, char** search_path, gsize size_se
     return g_module_open(module_name, G_MODULE_BIND_LAZY);
 }
 
+/* Load the audio plugin libspop_audio_<name> into out. Returns FALSE (with a
+   warning) if it can't be loaded, in which case out is left untouched. */
+gboolean plugin_audio_load(const gchar* name, audio_output* out) {
+    gchar* module_name;
+    GModule* module;
+    char** search_path;
+    gsize search_path_size;
+    audio_output ao;
+
+    search_path = config_get_string_list("plugins_search_path", &search_path_size);
+    module_name = g_strdup_printf("libspop_audio_%s", name);
+    module = plugin_open(module_name, search_path, search_path_size);
+    g_free(module_name);
+    g_strfreev(search_path);
+
+    if (!module) {
+        g_warning("Can't load %s audio plugin: %s", name, g_module_error());
+        return FALSE;
+    }
+
+    memset(&ao, 0, sizeof(audio_output));
+
+    if (g_module_symbol(module, "audio_write", (void**) &ao.write)) {
+        ao.version = 2;
+        if (!g_module_symbol(module, "audio_open", (void**) &ao.open) ||
+            !g_module_symbol(module, "audio_close", (void**) &ao.close))
+            goto pal_error;
+        g_module_symbol(module, "audio_pause", (void**) &ao.pause);
+        g_module_symbol(module, "audio_resume", (void**) &ao.resume);
+        g_module_symbol(module, "audio_flush", (void**) &ao.flush);
+        g_module_symbol(module, "audio_drain", (void**) &ao.drain);
+        g_module_symbol(module, "audio_latency", (void**) &ao.latency);
+    }
+    else if (g_module_symbol(module, "audio_delivery", (void**) &ao.delivery)) {
+        ao.version = 1;
+    }
+    else
+        goto pal_error;
+
+    if (!g_module_symbol(module, "get_audio_buffer_stats", (void**) &ao.buffer_stats))
+        ao.buffer_stats = NULL;
+
+    ao.name = g_strdup(name);
+    *out = ao;
+
+    g_debug("Audio plugin %s loaded (version %d)", name, out->version);
+    return TRUE;
+
+ pal_error:
+    g_warning("Can't find symbol in %s audio plugin: %s", name, g_module_error());
+    if (!g_module_close(module))
+        g_warning("Can't close %s audio plugin: %s", name, g_module_error());
+    return FALSE;
+}
+
+/* Load the filter plugin libspop_filter_<name>. Returns NULL (with a warning)
+   if it can't be loaded. */
+audio_filter* plugin_filter_load(const gchar* name) {
+    gchar* module_name;
+    GModule* module;
+    char** search_path;
+    gsize search_path_size;
+    audio_filter* f;
+
+    search_path = config_get_string_list("plugins_search_path", &search_path_size);
+    module_name = g_strdup_printf("libspop_filter_%s", name);
+    module = plugin_open(module_name, search_path, search_path_size);
+    g_free(module_name);
+    g_strfreev(search_path);
+
+    if (!module) {
+        g_warning("Can't load %s filter plugin: %s", name, g_module_error());
+        return NULL;
+    }
+
+    f = g_new0(audio_filter, 1);
+    if (!g_module_symbol(module, "filter_open", (void**) &f->open) ||
+        !g_module_symbol(module, "filter_process", (void**) &f->process)) {
+        g_warning("Can't find symbol in %s filter plugin: %s", name, g_module_error());
+        g_free(f);
+        return NULL;
+    }
+    g_module_symbol(module, "filter_reset", (void**) &f->reset);
+    g_module_symbol(module, "filter_close", (void**) &f->close);
+    f->name = g_strdup(name);
+
+    g_debug("Filter plugin %s loaded", name);
+    return f;
+}
+
 void plugins_init() {
     GString* module_name = NULL;
     GModule* module;
 
-    gchar* audio_output;
+    gchar* output_name;
 
     char** search_path;
     gsize search_path_size;
     char** plugins;
     gsize plugins_size;
+    char** filters;
+    gsize filters_size;
     void (*plugin_init)();
     void (*plugin_close)();
 
@@ -72,18 +168,22 @@ void plugins_init() {
     search_path = config_get_string_list("plugins_search_path", &search_path_size);
 
     /* Load audio plugin */
-    audio_output = config_get_string("audio_output");
-    g_string_printf(module_name, "libspop_audio_%s", audio_output);
-
-    module = plugin_open(module_name->str, search_path, search_path_size);
-    if (!module)
-        g_error("Can't load %s audio plugin: %s", audio_output, g_module_error());
+    output_name = config_get_string("audio_output");
+    if (!plugin_audio_load(output_name, g_audio))
+        g_error("Can't use %s as audio output", output_name);
 
-    if (!g_module_symbol(module, "audio_delivery", (void**) &g_audio_delivery_func))
-        g_error("Can't find symbol in audio plugin: %s", g_module_error());
+    /* Load filter plugins */
+    filters = config_get_string_list("filters", &filters_size);
+    for (i=0; i < filters_size; i++) {
+        audio_filter* f;
 
-    if (!g_module_symbol(module, "get_audio_buffer_stats", (void**) &g_audio_buffer_stats_func))
-        g_audio_buffer_stats_func = NULL;
+        g_strstrip(filters[i]);
+        f = plugin_filter_load(filters[i]);
+        if (!f)
+            g_error("Can't use %s as audio filter", filters[i]);
+        g_filters = g_list_append(g_filters, f);
+    }
+    g_strfreev(filters);
 
     /* Now load other plugins */
     plugins = config_get_string_list("plugins", &plugins_size);
@@ -132,3 +232,92 @@ void plugins_close() {
         cur = cur->next;
     }
 }
+
+/* Drive an audio plugin. Version 1 plugins only know how to play frames and how
+   to stop, so everything else is mapped to one of these. */
+int audio_output_deliver(audio_output* out, const sp_audioformat* format, const void* frames, int num_frames) {
+    if (num_frames == 0) {
+        /* Audio discontinuity */
+        audio_output_flush(out);
+        return 0;
+    }
+
+    if ((format->sample_type != out->format.sample_type) ||
+        (format->sample_rate != out->format.sample_rate) ||
+        (format->channels != out->format.channels)) {
+        out->format = *format;
+        if (out->version >= 2)
+            out->open(format);
+    }
+
+    if (out->version >= 2)
+        return out->write(frames, num_frames);
+    else
+        return out->delivery(format, frames, num_frames);
+}
+
+void audio_output_pause(audio_output* out) {
+    if (out->pause)
+        out->pause();
+    else
+        audio_output_flush(out);
+}
+
+void audio_output_resume(audio_output* out) {
+    if (out->resume)
+        out->resume();
+}
+
+void audio_output_flush(audio_output* out) {
+    if (out->flush)
+        out->flush();
+    else
+        audio_output_close(out);
+}
+
+void audio_output_drain(audio_output* out) {
+    if (out->drain)
+        out->drain();
+}
+
+int audio_output_latency(audio_output* out) {
+    if (out->latency)
+        return out->latency();
+    else
+        return 0;
+}
+
+void audio_output_close(audio_output* out) {
+    if (out->version >= 2)
+        out->close();
+    else
+        out->delivery(NULL, NULL, 0);
+
+    /* The next frames will need an audio_open() */
+    out->format.sample_rate = 0;
+}
+
+/* Drive a filter plugin */
+void audio_filter_process(audio_filter* f, const sp_audioformat* format, int16_t* frames, int num_frames) {
+    if ((format->sample_type != f->format.sample_type) ||
+        (format->sample_rate != f->format.sample_rate) ||
+        (format->channels != f->format.channels)) {
+        f->format = *format;
+        f->open(format);
+    }
+
+    f->process(frames, num_frames);
+}
+
+void audio_filter_reset(audio_filter* f) {
+    if (f->reset)
+        f->reset();
+}
+
+void audio_filter_close(audio_filter* f) {
+    if (f->close)
+        f->close();
+
+    /* The next frames will need a filter_open() */
+    f->format.sample_rate = 0;
+}
@@ -26,15 +26,71 @@
 #ifndef PLUGIN_H
 #define PLUGIN_H
 
+#include <glib.h>
 #include <libspotify/api.h>
+#include <stdint.h>
 
 typedef int (*audio_delivery_func_ptr)(const sp_audioformat*, const void*, int);
-extern audio_delivery_func_ptr g_audio_delivery_func;
-
 typedef void (*audio_buffer_stats_func_ptr)(sp_session*, sp_audio_buffer_stats*);
-extern audio_buffer_stats_func_ptr g_audio_buffer_stats_func;
+
+/* A loaded audio plugin (see audio.h for the meaning of each function) */
+typedef struct {
+    gchar* name;
+    int version;
+
+    /* Version 1 */
+    audio_delivery_func_ptr delivery;
+
+    /* Version 2 */
+    void (*open)(const sp_audioformat*);
+    int  (*write)(const void*, int);
+    void (*pause)(void);
+    void (*resume)(void);
+    void (*flush)(void);
+    void (*drain)(void);
+    int  (*latency)(void);
+    void (*close)(void);
+
+    /* Both versions (optional) */
+    audio_buffer_stats_func_ptr buffer_stats;
+
+    /* Format of the frames being written, or sample_rate == 0 if closed */
+    sp_audioformat format;
+} audio_output;
+
+/* A loaded filter plugin (see filter.h) */
+typedef struct {
+    gchar* name;
+
+    void (*open)(const sp_audioformat*);
+    void (*process)(int16_t*, int);
+    void (*reset)(void);
+    void (*close)(void);
+
+    /* Format of the frames being processed, or sample_rate == 0 if closed */
+    sp_audioformat format;
+} audio_filter;
+
+extern audio_output* g_audio;
+extern GList* g_filters;
 
 void plugins_init();
+gboolean plugin_audio_load(const gchar* name, audio_output* out);
+audio_filter* plugin_filter_load(const gchar* name);
+
+/* Functions used to drive an audio plugin, whatever its version */
+int  audio_output_deliver(audio_output* out, const sp_audioformat* format, const void* frames, int num_frames);
+void audio_output_pause(audio_output* out);
+void audio_output_resume(audio_output* out);
+void audio_output_flush(audio_output* out);
+void audio_output_drain(audio_output* out);
+int  audio_output_latency(audio_output* out);
+void audio_output_close(audio_output* out);
+
+/* Functions used to drive a filter plugin */
+void audio_filter_process(audio_filter* f, const sp_audioformat* format, int16_t* frames, int num_frames);
+void audio_filter_reset(audio_filter* f);
+void audio_filter_close(audio_filter* f);
 void plugins_close();
 
 #endif
@@ -45,6 +45,10 @@ static gboolean g_shuffle = FALSE;
 static GQueue g_shuffle_queue = G_QUEUE_INIT;
 static int g_shuffle_first;
 
+/* Prototypes for private functions */
+static int queue_next_index();
+static void queue_prefetch_next();
+
 
 /************************
  *** Queue management ***
@@ -221,6 +225,7 @@ void queue_play(gboolean notif) {
             session_load(track);
             session_play(TRUE);
             g_status = PLAYING;
+            queue_prefetch_next();
             if (notif) queue_notify();
         }
         else g_debug("Nothing to play (empty queue).");
@@ -319,17 +324,27 @@ queue_status queue_get_status(sp_track** current_track, int* current_track_numbe
 }
 
 GArray* queue_tracks() {
+    return queue_tracks_range(0, G_MAXUINT);
+}
+
+/* At most count tracks of the queue, starting from track number offset (from
+   0). The links of the queue are followed, so only the requested tracks are
+   copied. */
+GArray* queue_tracks_range(guint offset, guint count) {
     GArray* tracks;
+    GList* cur;
     sp_track* tr;
-    int i, n;
+    guint n;
 
     n = g_queue_get_length(&g_queue);
-    tracks = g_array_sized_new(FALSE, FALSE, sizeof(sp_track*), n);
+    count = (offset < n) ? MIN(count, n - offset) : 0;
+    tracks = g_array_sized_new(FALSE, FALSE, sizeof(sp_track*), count);
     if (!tracks)
-        g_error("Can't allocate array of %d tracks.", n);
+        g_error("Can't allocate array of %u tracks.", count);
 
-    for (i=0; i < n; i++) {
-        tr = g_queue_peek_nth(&g_queue, i);
+    cur = (count > 0) ? g_queue_peek_nth_link(&g_queue, offset) : NULL;
+    for (; cur && (tracks->len < count); cur = cur->next) {
+        tr = cur->data;
         g_array_append_val(tracks, tr);
     }
 
@@ -348,19 +363,13 @@ void queue_notify() {
 /***************************
  *** Move into the queue ***
  ***************************/
-void queue_next(gboolean notif) {
+/* "Private" function: index of the track that queue_next() will switch to (-1
+   if playback will stop). The only side effect is picking the first shuffle
+   track, if needed. */
+static int queue_next_index() {
     int n, p;
     int len = g_queue_get_length(&g_queue);
 
-    g_debug("Switching to next track (current track: %d).", g_current_track);
-
-    if (g_repeat && len == 1) {
-        /* Easy case: replay the same track */
-        queue_seek(0);
-        if (notif) queue_notify();
-        return;
-    }
-
     if (g_shuffle) {
         /* Possible cases: g_repeat, g_current_track == -1, g_shuffle_first == -1 */
         if (g_current_track == -1) {
@@ -397,6 +406,37 @@ void queue_next(gboolean notif) {
             n %= len;
     }
 
+    return n;
+}
+
+/* "Private" function: let libspotify start downloading the track that will
+   be played after the current one */
+static void queue_prefetch_next() {
+    int n;
+    int len = g_queue_get_length(&g_queue);
+
+    if ((g_current_track < 0) || (len < 2))
+        return;
+
+    n = queue_next_index();
+    if ((n >= 0) && (n < len) && (n != g_current_track))
+        session_prefetch(g_queue_peek_nth(&g_queue, n));
+}
+
+void queue_next(gboolean notif) {
+    int n;
+    int len = g_queue_get_length(&g_queue);
+
+    g_debug("Switching to next track (current track: %d).", g_current_track);
+
+    if (g_repeat && len == 1) {
+        /* Easy case: replay the same track */
+        queue_seek(0);
+        if (notif) queue_notify();
+        return;
+    }
+
+    n = queue_next_index();
     queue_goto(FALSE, n, FALSE);
     if (notif) queue_notify();
 }
@@ -498,6 +538,7 @@ void queue_goto(gboolean notif, int idx, gboolean reset_shuffle_first) {
                 g_error("Can't peek track.");
             session_load(track);
             g_status = PAUSED;
+            queue_prefetch_next();
         }
         else
             queue_play(FALSE);
@@ -50,6 +50,7 @@ void queue_seek(guint pos);
 /* Information about the queue */
 queue_status queue_get_status(sp_track** current_track, int* current_track_number, int* total_tracks);
 GArray* queue_tracks();
+GArray* queue_tracks_range(guint offset, guint count);
 
 /* Notify clients that something changed */
 void queue_notify();
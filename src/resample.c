@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "resample.h"
+
+/* Filter length, in input frames. With the Kaiser window below, this gives
+   about 90 dB of stop-band attenuation, with a flat pass band up to ~18 kHz
+   and the stop band starting near the Nyquist frequency at 44.1 kHz. */
+#define RESAMPLE_TAPS 64
+#define RESAMPLE_BETA 9.f
+
+/* Cutoff frequency, relative to the lowest of the two Nyquist frequencies */
+#define RESAMPLE_CUTOFF 0.91f
+
+/* The filter has one phase per output position between two input frames:
+   ratios that can't be reduced to less than that are not supported */
+#define RESAMPLE_MAX_PHASES 1024
+
+/* Input frames are converted to float this many at a time */
+#define RESAMPLE_BLOCK 1024
+
+struct resampler {
+    int in_rate;
+    int out_rate;
+    int channels;
+
+    guint up;                   /* out_rate / gcd */
+    guint down;                 /* in_rate / gcd */
+    float* coefs;               /* up phases of RESAMPLE_TAPS coefficients */
+
+    /* Per channel: the last RESAMPLE_TAPS - 1 input frames, followed by the
+       block being processed */
+    float* hist[RESAMPLER_MAX_CHANNELS];
+    size_t hist_len;
+
+    /* Next output frame: its newest input frame in hist, and its phase */
+    size_t pos;
+    guint phase;
+};
+
+/* "Private" functions */
+static guint _resample_gcd(guint a, guint b) {
+    while (b != 0) {
+        guint t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Modified Bessel function of the first kind, order 0 */
+static double _resample_i0(double x) {
+    double sum = 1., term = 1.;
+    int k;
+
+    for (k=1; k < 50; k++) {
+        term *= (x / (2. * k)) * (x / (2. * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+/* Compute the prototype filter at up times the input rate, then split it in
+   up phases. Phase p, tap j is h[p + j * up], applied to the input frame j
+   frames before the newest one; it is stored in reverse order so that the
+   filter is a plain dot product with the history. */
+static void _resample_make_filter(resampler* rs) {
+    guint n = rs->up * RESAMPLE_TAPS;
+    double fc = 0.5 * RESAMPLE_CUTOFF / MAX(rs->up, rs->down);
+    double center = (n - 1) / 2.;
+    double norm = _resample_i0(RESAMPLE_BETA);
+    double* h = g_new(double, n);
+    double sum = 0.;
+    guint k, p, j;
+
+    for (k=0; k < n; k++) {
+        double t = k - center;
+        double x = 2. * t / (n - 1);
+        double sinc = (t == 0.) ? 1. : sin(2. * G_PI * fc * t) / (2. * G_PI * fc * t);
+        h[k] = 2. * fc * sinc * _resample_i0(RESAMPLE_BETA * sqrt(MAX(0., 1. - x * x))) / norm;
+        sum += h[k];
+    }
+
+    /* Unity gain: each output frame uses one tap out of up */
+    rs->coefs = g_new(float, n);
+    for (p=0; p < rs->up; p++)
+        for (j=0; j < RESAMPLE_TAPS; j++)
+            rs->coefs[p * RESAMPLE_TAPS + (RESAMPLE_TAPS - 1 - j)] = (float) (h[p + j * rs->up] * rs->up / sum);
+
+    g_free(h);
+}
+
+static inline int16_t _resample_sat16(float v) {
+    long r = lrintf(v);
+    if (r > G_MAXINT16) return G_MAXINT16;
+    if (r < G_MININT16) return G_MININT16;
+    return (int16_t) r;
+}
+
+/* "Public" functions */
+resampler* resampler_new(int in_rate, int out_rate, int channels) {
+    resampler* rs;
+    guint gcd;
+    int c;
+
+    if ((in_rate <= 0) || (out_rate <= 0) || (channels <= 0) || (channels > RESAMPLER_MAX_CHANNELS))
+        return NULL;
+
+    gcd = _resample_gcd(in_rate, out_rate);
+    if (out_rate / gcd > RESAMPLE_MAX_PHASES)
+        return NULL;
+
+    rs = g_new0(resampler, 1);
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->channels = channels;
+    rs->up = out_rate / gcd;
+    rs->down = in_rate / gcd;
+    _resample_make_filter(rs);
+
+    for (c=0; c < channels; c++)
+        rs->hist[c] = g_new(float, RESAMPLE_TAPS - 1 + RESAMPLE_BLOCK);
+    resampler_reset(rs);
+
+    g_debug("Resampling from %d Hz to %d Hz (%u/%u, %d taps)", in_rate, out_rate,
+            rs->up, rs->down, RESAMPLE_TAPS);
+
+    return rs;
+}
+
+void resampler_free(resampler* rs) {
+    int c;
+
+    if (!rs)
+        return;
+    for (c=0; c < rs->channels; c++)
+        g_free(rs->hist[c]);
+    g_free(rs->coefs);
+    g_free(rs);
+}
+
+void resampler_reset(resampler* rs) {
+    int c;
+
+    for (c=0; c < rs->channels; c++)
+        memset(rs->hist[c], 0, (RESAMPLE_TAPS - 1) * sizeof(float));
+    rs->hist_len = RESAMPLE_TAPS - 1;
+    rs->pos = RESAMPLE_TAPS - 1;
+    rs->phase = 0;
+}
+
+size_t resampler_process(resampler* rs, const int16_t* in, size_t in_frames, int16_t* out) {
+    size_t out_frames = 0;
+    size_t i, n, keep = RESAMPLE_TAPS - 1;
+    int c, channels = rs->channels;
+
+    while (in_frames > 0) {
+        n = MIN(in_frames, RESAMPLE_BLOCK);
+
+        /* De-interleave the new frames after the history */
+        for (i=0; i < n; i++)
+            for (c=0; c < channels; c++)
+                rs->hist[c][rs->hist_len + i] = in[i * channels + c];
+        rs->hist_len += n;
+
+        while (rs->pos < rs->hist_len) {
+            const float* h = rs->coefs + rs->phase * RESAMPLE_TAPS;
+            size_t first = rs->pos + 1 - RESAMPLE_TAPS;
+
+            for (c=0; c < channels; c++)
+                out[out_frames * channels + c] =
+                    _resample_sat16(dsp_dot_f32(h, rs->hist[c] + first, RESAMPLE_TAPS));
+            out_frames += 1;
+
+            rs->phase += rs->down;
+            rs->pos += rs->phase / rs->up;
+            rs->phase %= rs->up;
+        }
+
+        /* Keep what the next output frames need */
+        for (c=0; c < channels; c++)
+            memmove(rs->hist[c], rs->hist[c] + rs->hist_len - keep, keep * sizeof(float));
+        rs->pos -= rs->hist_len - keep;
+        rs->hist_len = keep;
+
+        in += n * channels;
+        in_frames -= n;
+    }
+
+    return out_frames;
+}
+
+size_t resampler_max_output(resampler* rs, size_t in_frames) {
+    return (size_t) (((guint64) in_frames * rs->up + rs->down - 1) / rs->down) + 1;
+}
+
+int resampler_in_rate(resampler* rs) {
+    return rs->in_rate;
+}
+
+int resampler_channels(resampler* rs) {
+    return rs->channels;
+}
+
+int resampler_delay(resampler* rs) {
+    return RESAMPLE_TAPS / 2;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <glib.h>
+#include <stdint.h>
+
+/* Polyphase resampler for 16-bit interleaved frames.
+ *
+ * The ratio between the rates is reduced to up/down (e.g. 160/147 from 44.1 to
+ * 48 kHz), and each output frame is computed with one of the up phases of a
+ * windowed-sinc low-pass filter. The filter state is kept between calls, so a
+ * stream can be fed in chunks of any size without any discontinuity. */
+
+#define RESAMPLER_MAX_CHANNELS 8
+
+typedef struct resampler resampler;
+
+/* Returns NULL if the ratio between the rates is not supported */
+resampler* resampler_new(int in_rate, int out_rate, int channels);
+void resampler_free(resampler* rs);
+
+/* Forget the past input (after a seek) */
+void resampler_reset(resampler* rs);
+
+/* Resample in_frames frames to out, which must have room for
+   resampler_max_output(rs, in_frames) frames. All the input frames are used;
+   returns the number of output frames. */
+size_t resampler_process(resampler* rs, const int16_t* in, size_t in_frames, int16_t* out);
+size_t resampler_max_output(resampler* rs, size_t in_frames);
+
+/* Information about the resampler */
+int resampler_in_rate(resampler* rs);
+int resampler_channels(resampler* rs);
+int resampler_delay(resampler* rs);     /* In input frames */
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "ringbuf.h"
+
+ringbuf* ringbuf_new(gsize min_size) {
+    ringbuf* rb;
+    guint size = 4096;
+
+    if (min_size > (G_MAXUINT / 2) + 1)
+        g_error("Ring buffer size too large: %zu", min_size);
+    while (size < min_size)
+        size <<= 1;
+
+    rb = g_new0(ringbuf, 1);
+    rb->data = g_malloc(size);
+    rb->size = size;
+    rb->mask = size - 1;
+    g_mutex_init(&rb->mutex);
+    g_cond_init(&rb->cond);
+
+    return rb;
+}
+
+void ringbuf_free(ringbuf* rb) {
+    g_mutex_clear(&rb->mutex);
+    g_cond_clear(&rb->cond);
+    g_free(rb->data);
+    g_free(rb);
+}
+
+/* Position the consumer will read from next, taking a pending flush into
+ * account */
+static guint _ringbuf_read_pos(ringbuf* rb) {
+    if (g_atomic_int_get(&rb->flush))
+        return (guint) g_atomic_int_get(&rb->flush_to);
+    return (guint) g_atomic_int_get(&rb->head);
+}
+
+gsize ringbuf_fill(ringbuf* rb) {
+    guint tail = (guint) g_atomic_int_get(&rb->tail);
+    return tail - _ringbuf_read_pos(rb);
+}
+
+gsize ringbuf_space(ringbuf* rb) {
+    guint head = (guint) g_atomic_int_get(&rb->head);
+    guint tail = (guint) g_atomic_int_get(&rb->tail);
+    return rb->size - (tail - head);
+}
+
+guint ringbuf_wakeups(ringbuf* rb) {
+    return (guint) g_atomic_int_get(&rb->wakeups);
+}
+
+/* Wake the consumer up, but only if it is actually sleeping (and only once) */
+static void _ringbuf_signal(ringbuf* rb) {
+    if (g_atomic_int_compare_and_exchange(&rb->waiting, 1, 0)) {
+        g_mutex_lock(&rb->mutex);
+        g_atomic_int_inc(&rb->wakeups);
+        g_cond_signal(&rb->cond);
+        g_mutex_unlock(&rb->mutex);
+    }
+}
+
+/* Discard everything that has been written so far. The consumer does the
+ * actual work the next time it looks at the buffer, since it is the only one
+ * allowed to move the head. */
+void ringbuf_flush(ringbuf* rb) {
+    g_atomic_int_set(&rb->flush_to, g_atomic_int_get(&rb->tail));
+    g_atomic_int_set(&rb->flush, 1);
+}
+
+/* Make ringbuf_wait() return even if there is no new data */
+void ringbuf_wake(ringbuf* rb) {
+    g_mutex_lock(&rb->mutex);
+    g_atomic_int_set(&rb->kicked, 1);
+    g_cond_signal(&rb->cond);
+    g_mutex_unlock(&rb->mutex);
+}
+
+/* Copy as much data as possible to the buffer, never blocks. Returns the number
+ * of bytes actually written. */
+gsize ringbuf_write(ringbuf* rb, const void* data, gsize len) {
+    guint head = (guint) g_atomic_int_get(&rb->head);
+    guint tail = (guint) g_atomic_int_get(&rb->tail);
+    gsize space = rb->size - (tail - head);
+    gsize off, first;
+
+    if (len > space)
+        len = space;
+    if (len == 0)
+        return 0;
+
+    off = tail & rb->mask;
+    first = MIN(len, rb->size - off);
+    memcpy(rb->data + off, data, first);
+    if (first < len)
+        memcpy(rb->data, ((const guint8*) data) + first, len - first);
+
+    /* Publish the new data, then wake the consumer if it's starved */
+    g_atomic_int_set(&rb->tail, (gint) (tail + len));
+    _ringbuf_signal(rb);
+
+    return len;
+}
+
+/* Apply a pending flush request */
+static void _ringbuf_apply_flush(ringbuf* rb) {
+    if (g_atomic_int_compare_and_exchange(&rb->flush, 1, 0))
+        g_atomic_int_set(&rb->head, g_atomic_int_get(&rb->flush_to));
+}
+
+/* Get a pointer to the largest contiguous readable region. The data stays in
+ * the buffer until ringbuf_consume() is called. */
+gsize ringbuf_peek(ringbuf* rb, gpointer* ptr) {
+    guint head, tail;
+    gsize off;
+
+    _ringbuf_apply_flush(rb);
+    head = (guint) g_atomic_int_get(&rb->head);
+    tail = (guint) g_atomic_int_get(&rb->tail);
+
+    off = head & rb->mask;
+    *ptr = rb->data + off;
+    return MIN(tail - head, rb->size - off);
+}
+
+void ringbuf_consume(ringbuf* rb, gsize len) {
+    guint head = (guint) g_atomic_int_get(&rb->head);
+    g_atomic_int_set(&rb->head, (gint) (head + len));
+}
+
+/* Copy up to len bytes out of the buffer, across the wrap-around point if
+ * needed. Returns the number of bytes actually read. */
+gsize ringbuf_read(ringbuf* rb, void* data, gsize len) {
+    gsize done = 0;
+
+    while (done < len) {
+        gpointer ptr;
+        gsize avail = ringbuf_peek(rb, &ptr);
+        if (avail == 0)
+            break;
+        avail = MIN(avail, len - done);
+        memcpy(((guint8*) data) + done, ptr, avail);
+        ringbuf_consume(rb, avail);
+        done += avail;
+    }
+    return done;
+}
+
+/* Sleep until there is something to read, ringbuf_wake() is called, or
+ * end_time (monotonic time, -1 for no timeout) is reached. Returns FALSE on
+ * timeout. */
+gboolean ringbuf_wait(ringbuf* rb, gint64 end_time) {
+    gboolean ret = TRUE;
+
+    g_mutex_lock(&rb->mutex);
+
+    while (TRUE) {
+        /* Announce that we're going to sleep *before* checking the fill level:
+           this way the producer can't miss us */
+        g_atomic_int_set(&rb->waiting, 1);
+        if ((ringbuf_fill(rb) > 0) || g_atomic_int_get(&rb->kicked))
+            break;
+
+        if (end_time < 0)
+            g_cond_wait(&rb->cond, &rb->mutex);
+        else if (!g_cond_wait_until(&rb->cond, &rb->mutex, end_time)) {
+            ret = (ringbuf_fill(rb) > 0);
+            break;
+        }
+    }
+
+    g_atomic_int_set(&rb->waiting, 0);
+    g_atomic_int_set(&rb->kicked, 0);
+    g_mutex_unlock(&rb->mutex);
+
+    return ret;
+}
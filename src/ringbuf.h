@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 The spop contributors
+ *
+ * This file is part of spop.
+ *
+ * spop is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * spop is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * spop. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7
+ *
+ * If you modify this Program, or any covered work, by linking or combining it
+ * with libspotify (or a modified version of that library), containing parts
+ * covered by the terms of the Libspotify Terms of Use, the licensors of this
+ * Program grant you additional permission to convey the resulting work.
+ */
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <glib.h>
+
+/* Single-producer/single-consumer ring buffer.
+ *
+ * The producer only moves the tail, the consumer only moves the head, so the
+ * data path does not need any lock. Both positions are free-running counters:
+ * the fill level is always (tail - head), even after they wrap around. The
+ * mutex and condition are only used to put a starved consumer to sleep, and the
+ * producer only touches them when the consumer said it was waiting. */
+typedef struct {
+    guint8* data;
+    guint   size;               /* Always a power of two */
+    guint   mask;
+
+    volatile gint head;         /* Read position, owned by the consumer */
+    volatile gint tail;         /* Write position, owned by the producer */
+
+    volatile gint flush;        /* Flush requested by the producer... */
+    volatile gint flush_to;     /* ...up to this position */
+
+    volatile gint waiting;      /* Consumer is (about to be) sleeping */
+    volatile gint kicked;       /* Consumer was woken up without new data */
+    volatile gint wakeups;      /* Number of times the consumer was woken up */
+
+    GMutex mutex;
+    GCond  cond;
+} ringbuf;
+
+ringbuf* ringbuf_new(gsize min_size);
+void ringbuf_free(ringbuf* rb);
+
+/* Can be called from any thread */
+gsize ringbuf_fill(ringbuf* rb);
+gsize ringbuf_space(ringbuf* rb);
+guint ringbuf_wakeups(ringbuf* rb);
+void ringbuf_flush(ringbuf* rb);
+void ringbuf_wake(ringbuf* rb);
+
+/* Producer side */
+gsize ringbuf_write(ringbuf* rb, const void* data, gsize len);
+
+/* Consumer side */
+gsize ringbuf_peek(ringbuf* rb, gpointer* ptr);
+void ringbuf_consume(ringbuf* rb, gsize len);
+gsize ringbuf_read(ringbuf* rb, void* data, gsize len);
+gboolean ringbuf_wait(ringbuf* rb, gint64 end_time);
+
+#endif
@@ -35,9 +35,12 @@
 
 #include "spop.h"
 #include "config.h"
+#include "crossfade.h"
+#include "output.h"
 #include "plugin.h"
 #include "queue.h"
 #include "spotify.h"
+#include "utils.h"
 
 /************************
  *** Global variables ***
@@ -47,10 +50,55 @@ static sp_playlist* g_starred_playlist = NULL;
 
 static sp_session* g_session = NULL;
 
-static guint g_audio_time = 0;
-static unsigned int g_audio_samples = 0;
+/* Position in the current track: g_audio_time is the position (in µs) when the
+   sample rate last changed, and g_audio_samples the number of frames delivered
+   at g_audio_rate since then */
+static gint64 g_audio_time = 0;
+static guint64 g_audio_samples = 0;
 static unsigned int g_audio_rate = 44100;
 
+/* Clock used to smooth the played position (see session_played_time()) */
+#define CLOCK_MAX_ERROR  (250 * G_TIME_SPAN_MILLISECOND)
+#define CLOCK_MAX_DRIFT  0.005
+#define CLOCK_POS_GAIN   8
+#define CLOCK_SPEED_GAIN 0.1
+static gboolean g_playing = FALSE;
+static gint64 g_clock_pos = 0;
+static gint64 g_clock_time = -1;
+static gdouble g_clock_speed = 1.0;
+
+/* Seek and resume latencies: time between a seek (or resume) and the moment
+   something can be heard again */
+#define AUDIBLE_POLL    5
+#define AUDIBLE_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+static gboolean g_paused = FALSE;
+static gint64 g_audible_pos = 0;
+static gint64 g_audible_start = -1;
+static latency_stats* g_audible_stats = NULL;
+static latency_stats g_seek_latency;
+static latency_stats g_resume_latency;
+
+/* Gapless playback: keep the audio output open when switching to the next
+   track, and measure how long the output is starved during the switch */
+static gboolean g_gapless = FALSE;
+static gboolean g_transition = FALSE;
+static gint64 g_transition_deadline = -1;
+static gint g_transition_gap = -1;
+
+/* End of the queue after a gapless or crossfade transition: the output is only
+   closed once it has played what it buffered */
+#define OUTPUT_CLOSE_POLL    10
+#define OUTPUT_CLOSE_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+static gint64 g_close_deadline = -1;
+
+/* Switch to another audio output: wait until the current one has played what
+   it buffered, or give up after a while and seek back instead */
+#define OUTPUT_SWITCH_POLL    10
+#define OUTPUT_SWITCH_TIMEOUT (5 * G_TIME_SPAN_SECOND)
+static gint64 g_switch_deadline = -1;
+static session_output_cb g_switch_cb = NULL;
+static gpointer g_switch_data = NULL;
+
 /* Session load/unload callbacks */
 static GList* g_session_callbacks = NULL;
 typedef struct {
@@ -85,7 +133,7 @@ static sp_session_callbacks g_sp_session_callbacks = {
     NULL, /* userinfo_updated */
     NULL, /* start_playback */
     NULL, /* stop_playback */
-    NULL, /* get_audio_buffer_stats */
+    &cb_get_audio_buffer_stats,
     NULL, /* offline_status_updated */
     NULL, /* offline_error */
     NULL, /* credentials_blob_updated */
@@ -128,8 +176,6 @@ void session_init() {
     }
 
     /* libspotify session config */
-    if (g_audio_buffer_stats_func)
-        g_sp_session_callbacks.get_audio_buffer_stats = g_audio_buffer_stats_func;
     proxy = config_get_string_opt("proxy", NULL);
     proxy_username = config_get_string_opt("proxy_username", NULL);
     proxy_password = config_get_string_opt("proxy_password", NULL);
@@ -182,6 +228,11 @@ void session_init() {
     g_debug("%s volume normalization.", normalize_volume ? "Enabling" : "Disabling");
     sp_session_set_volume_normalization(g_session, normalize_volume);
 
+    g_gapless = config_get_bool_opt("gapless", FALSE);
+    g_debug("%s gapless playback.", g_gapless ? "Enabling" : "Disabling");
+    output_init();
+    crossfade_init();
+
     g_debug("Session created.");
 }
 
@@ -259,12 +310,28 @@ int playlist_get_offline_download_completed(sp_playlist* pl) {
 /**********************
  * Session management *
  **********************/
+/* Delivered position minus what is still buffered by the crossfade and by the
+   audio output */
+static gint64 _session_audible_time() {
+    gint64 latency, pos;
+
+    latency = output_latency();
+    if (crossfade_enabled())
+        latency += crossfade_latency();
+    pos = session_delivered_time() - (G_USEC_PER_SEC * latency) / g_audio_rate;
+
+    return MAX(pos, 0);
+}
+
 void session_load(sp_track* track) {
     sp_error error;
     session_callback_data scbd;
 
     g_debug("Loading track.");
 
+    /* Playing again: keep the output open */
+    g_close_deadline = -1;
+
     error = sp_session_player_load(g_session, track);
     if (error != SP_ERROR_OK)
         g_error("Failed to load track: %s", sp_error_message(error));
@@ -290,39 +357,184 @@ void session_unload() {
 
     /* Then really unload */
     sp_session_player_play(g_session, FALSE);
-    g_audio_delivery_func(NULL, NULL, 0);
+    if (!g_transition) {
+        crossfade_flush();
+        output_close();
+    }
     sp_session_player_unload(g_session);
     cb_notify_main_thread(NULL);
     g_audio_samples = 0;
     g_audio_time = 0;
+    g_playing = FALSE;
+    g_paused = FALSE;
+    g_clock_time = -1;
+}
+
+/* Measure the time until the played position gets past pos */
+static void _session_measure_audible(latency_stats* stats, gint64 pos) {
+    if (g_audible_start < 0)
+        g_timeout_add(AUDIBLE_POLL, session_audible_event, NULL);
+    g_audible_stats = stats;
+    g_audible_pos = pos;
+    g_audible_start = g_get_monotonic_time();
 }
 
 void session_play(gboolean play) {
     sp_session_player_play(g_session, play);
+    g_playing = play;
 
-    if (!play)
-        /* Force pause in the audio plugin */
-        g_audio_delivery_func(NULL, NULL, 0);
+    if (play) {
+        audio_output_resume(g_audio);
+        if (g_paused)
+            _session_measure_audible(&g_resume_latency, _session_audible_time());
+    }
+    else
+        audio_output_pause(g_audio);
+    g_paused = !play;
 
     cb_notify_main_thread(NULL);
 }
 
 void session_seek(guint pos) {
     sp_session_player_seek(g_session, pos);
-    g_audio_time = pos;
+    if (!g_transition) {
+        /* Drop what was buffered before the seek, but keep the output open */
+        crossfade_flush();
+        output_flush();
+    }
+    g_audio_time = pos * G_TIME_SPAN_MILLISECOND;
     g_audio_samples = 0;
+    g_clock_time = -1;
+
+    if (!g_transition)
+        _session_measure_audible(&g_seek_latency, g_audio_time);
 
     cb_notify_main_thread(NULL);
 
     queue_notify();
 }
 
+void session_prefetch(sp_track* track) {
+    sp_error error;
+
+    /* Only useful if the next track starts right after the current one */
+    if (!g_gapless && !crossfade_enabled())
+        return;
+
+    g_debug("Prefetching next track.");
+    error = sp_session_player_prefetch(g_session, track);
+    if (error != SP_ERROR_OK)
+        g_info("Failed to prefetch track: %s", sp_error_message(error));
+}
+
+/* Make the next audio plugin the current one. If flush is TRUE, what the
+   previous one did not play is lost, so seek back to what was last heard. */
+static void _session_switch_output_end(gboolean flush) {
+    gint64 pos = _session_audible_time();
+    session_output_cb cb = g_switch_cb;
+
+    output_switch_end(flush);
+    if (flush && (g_playing || g_paused))
+        session_seek(pos / G_TIME_SPAN_MILLISECOND);
+
+    g_switch_deadline = -1;
+    g_switch_cb = NULL;
+    if (cb)
+        cb(g_switch_data);
+}
+
+/* Replace the audio plugin with libspop_audio_<name>, without stopping
+   playback. The callback is called once the new plugin is in use (possibly
+   before this function returns). Returns FALSE if the plugin can't be loaded
+   or if a switch is already in progress. */
+gboolean session_switch_output(const gchar* name, session_output_cb callback, gpointer data) {
+    audio_output* next;
+
+    if (g_switch_deadline >= 0)
+        return FALSE;
+
+    next = g_new(audio_output, 1);
+    if (!plugin_audio_load(name, next)) {
+        g_free(next);
+        return FALSE;
+    }
+    if (!output_switch_begin(next)) {
+        g_free(next->name);
+        g_free(next);
+        return FALSE;
+    }
+
+    g_switch_cb = callback;
+    g_switch_data = data;
+    g_switch_deadline = g_get_monotonic_time() + OUTPUT_SWITCH_TIMEOUT;
+
+    if (g_playing)
+        g_timeout_add(OUTPUT_SWITCH_POLL, session_switch_output_event, NULL);
+    else {
+        /* Nothing is being played: no need to wait */
+        _session_switch_output_end(TRUE);
+    }
+    return TRUE;
+}
+
+/* Duration (in ms) of the silence heard during the last gapless transition, or
+   -1 if unknown */
+int session_transition_gap() {
+    return g_atomic_int_get(&g_transition_gap);
+}
+
+/* Position (in µs) of the last frame delivered to the audio output */
+gint64 session_delivered_time() {
+    return g_audio_time + (gint64) ((G_USEC_PER_SEC * g_audio_samples) / g_audio_rate);
+}
+
+/* Position (in µs) of what can be heard right now (see _session_audible_time()).
+
+   The latency reported by the plugins moves in steps (each delivery, each chunk
+   played by the device), and the clock of the device drifts from the system
+   clock. So the measured position is followed by a clock that runs at the
+   estimated speed of the device, and that never goes backwards while playing.
+   It is only reset on large errors (seek, underrun...).
+
+   Must be called from the main thread. */
+gint64 session_played_time() {
+    gint64 measured, now, elapsed, predicted, err;
+
+    measured = _session_audible_time();
+    now = g_get_monotonic_time();
+    if (g_playing && (g_clock_time >= 0)) {
+        elapsed = now - g_clock_time;
+        if (elapsed <= 0)
+            return g_clock_pos;
+
+        predicted = g_clock_pos + (gint64) (elapsed * g_clock_speed);
+        err = measured - predicted;
+        if (ABS(err) < CLOCK_MAX_ERROR) {
+            g_clock_speed += (CLOCK_SPEED_GAIN * err) / elapsed;
+            g_clock_speed = CLAMP(g_clock_speed, 1 - CLOCK_MAX_DRIFT, 1 + CLOCK_MAX_DRIFT);
+            g_clock_pos = MAX(g_clock_pos, predicted + err / CLOCK_POS_GAIN);
+            g_clock_time = now;
+            return g_clock_pos;
+        }
+    }
+
+    g_clock_pos = measured;
+    g_clock_time = now;
+    return measured;
+}
+
+/* Statistics about the time needed to hear the new position after a seek, and
+   to hear something again after a pause */
+const latency_stats* session_seek_latency() {
+    return &g_seek_latency;
+}
+const latency_stats* session_resume_latency() {
+    return &g_resume_latency;
+}
+
+/* Played position, in ms */
 guint session_play_time() {
-    /* If there are more that 4,294,967 samples, (1000 * g_audio_samples) will
-     * overflow a 32 bit integer. So let's do some floating-point math
-     * instead. */
-    gfloat time = g_audio_time + (1000. * g_audio_samples) / g_audio_rate;
-    return (guint) time;
+    return session_played_time() / G_TIME_SPAN_MILLISECOND;
 }
 
 void session_get_offline_sync_status(sp_offline_sync_status* status, gboolean* sync_in_progress,
@@ -420,6 +632,31 @@ GArray* tracks_get_playlist(sp_playlist* pl) {
     return tracks;
 }
 
+/* At most count tracks of the playlist, starting from track number offset
+   (from 0). Unlike tracks_get_playlist(), the tracks are not referenced: they
+   must be used right away. */
+GArray* tracks_get_playlist_range(sp_playlist* pl, guint offset, guint count) {
+    GArray* tracks;
+    sp_track* tr;
+    guint i, n;
+
+    if (!sp_playlist_is_loaded(pl))
+        return NULL;
+
+    n = sp_playlist_num_tracks(pl);
+    count = (offset < n) ? MIN(count, n - offset) : 0;
+    tracks = g_array_sized_new(FALSE, FALSE, sizeof(sp_track*), count);
+    if (!tracks)
+        g_error("Can't allocate array of %u tracks.", count);
+
+    for (i=offset; i < offset + count; i++) {
+        tr = sp_playlist_track(pl, i);
+        g_array_append_val(tracks, tr);
+    }
+
+    return tracks;
+}
+
 void track_get_data(sp_track* track, gchar** name, gchar** artist, gchar** album, gchar** link,
                     guint* duration, int* popularity, bool* starred) {
     sp_artist** art = NULL;
@@ -651,8 +888,15 @@ sp_artistbrowse* artistbrowse_create(sp_artist* artist, artistbrowse_complete_cb
 
 sp_search* search_create(const gchar* query, search_complete_cb* callback, gpointer userdata) {
     int nb_results = config_get_int_opt("search_results", 100);
+    return search_create_range(query, 0, nb_results, callback, userdata);
+}
+
+/* Search for at most count tracks, albums, artists and playlists, skipping the
+   first offset ones of each kind */
+sp_search* search_create_range(const gchar* query, guint offset, guint count,
+                               search_complete_cb* callback, gpointer userdata) {
     return sp_search_create(g_session, query,
-                            0, nb_results, 0, nb_results, 0, nb_results, 0, nb_results,
+                            offset, count, offset, count, offset, count, offset, count,
                             SP_SEARCH_STANDARD, callback, userdata);
 }
 
@@ -678,10 +922,85 @@ gboolean session_libspotify_event(gpointer data) {
 }
 gboolean session_next_track_event(gpointer data) {
     g_debug("Got next_track event.");
+
+    /* In gapless and crossfade modes, the audio output is not closed when the
+       current track is unloaded: the end of its buffer is still being
+       played */
+    g_transition = g_gapless || crossfade_enabled();
     queue_next(TRUE);
 
+    if (g_transition && (queue_get_status(NULL, NULL, NULL) == STOPPED)) {
+        /* Nothing to crossfade with */
+        if (crossfade_enabled())
+            crossfade_finish();
+
+        /* The output was left open: close it once it has played everything */
+        if (g_close_deadline < 0)
+            g_timeout_add(OUTPUT_CLOSE_POLL, session_close_output_event, NULL);
+        g_close_deadline = g_get_monotonic_time() + OUTPUT_CLOSE_TIMEOUT;
+    }
+    g_transition = FALSE;
+
     return FALSE;
 }
+gboolean session_close_output_event(gpointer data) {
+    gint64 latency;
+
+    if (g_close_deadline < 0)
+        return FALSE;
+
+    latency = output_latency();
+    if (crossfade_enabled())
+        latency += crossfade_latency();
+    if ((latency > 0) && (g_get_monotonic_time() < g_close_deadline))
+        return TRUE;
+
+    g_debug("End of the queue: closing the audio output.");
+    g_close_deadline = -1;
+    crossfade_flush();
+    output_close();
+
+    return FALSE;
+}
+gboolean session_switch_output_event(gpointer data) {
+    if (g_switch_deadline < 0)
+        return FALSE;
+
+    if (output_switch_remaining() == 0)
+        _session_switch_output_end(FALSE);
+    else if (!g_playing || (g_get_monotonic_time() >= g_switch_deadline)) {
+        /* Paused or stuck: don't wait any longer */
+        _session_switch_output_end(TRUE);
+    }
+    else
+        return TRUE;
+
+    return FALSE;
+}
+gboolean session_audible_event(gpointer data) {
+    gint64 elapsed;
+
+    if (g_audible_start < 0)
+        return FALSE;
+
+    /* Only measure while playing */
+    elapsed = g_get_monotonic_time() - g_audible_start;
+    if (!g_playing || (elapsed > AUDIBLE_TIMEOUT)) {
+        g_audible_start = -1;
+        return FALSE;
+    }
+
+    /* Some frames after the expected position have been played */
+    if (_session_audible_time() > g_audible_pos) {
+        latency_stats_add(g_audible_stats, elapsed);
+        g_debug("%s latency: %.1f ms.", (g_audible_stats == &g_seek_latency) ? "Seek" : "Resume",
+                elapsed / 1000.);
+        g_audible_start = -1;
+        return FALSE;
+    }
+
+    return TRUE;
+}
 
 
 /******************************************
@@ -720,13 +1039,26 @@ void cb_notify_main_thread(sp_session* session) {
     g_idle_add_full(G_PRIORITY_DEFAULT, session_libspotify_event, NULL, NULL);
 }
 int cb_music_delivery(sp_session* session, const sp_audioformat* format, const void* frames, int num_frames) {
-    int n = g_audio_delivery_func(format, frames, num_frames);
+    int n;
+
+    if (crossfade_enabled())
+        n = crossfade_deliver(format, frames, num_frames);
+    else
+        n = output_deliver(format, frames, num_frames);
+
+    if ((g_transition_deadline >= 0) && (n > 0)) {
+        /* First frames after a track change: was the output starved? */
+        gint64 late = g_get_monotonic_time() - g_transition_deadline;
+        g_atomic_int_set(&g_transition_gap, (late > 0) ? late / 1000 : 0);
+        g_transition_deadline = -1;
+        g_debug("Gapless transition: %d ms of silence.", session_transition_gap());
+    }
 
     if (format->sample_rate == g_audio_rate) {
         g_audio_samples += n;
     }
     else if (n > 0) {
-        g_audio_time += (1000 * g_audio_samples) / g_audio_rate;
+        g_audio_time += (G_USEC_PER_SEC * g_audio_samples) / g_audio_rate;
         g_audio_samples = n;
         g_audio_rate = format->sample_rate;
     }
@@ -744,8 +1076,28 @@ void cb_log_message(sp_session* session, const char* data) {
 }
 void cb_end_of_track(sp_session* session) {
     g_debug("End of track.");
+
+    if (crossfade_enabled()) {
+        /* Keep the end of the track for the crossfade */
+        crossfade_end_of_track();
+    }
+    else {
+        output_drain();
+
+        if (g_gapless) {
+            /* The output will run out of data once its buffer has been
+               played */
+            gint64 buffered = (G_USEC_PER_SEC * (gint64) output_latency()) / g_audio_rate;
+            g_transition_deadline = g_get_monotonic_time() + buffered;
+        }
+    }
+
     g_idle_add_full(G_PRIORITY_DEFAULT, session_next_track_event, NULL, NULL);
 }
 void cb_streaming_error(sp_session* session, sp_error error) {
     g_warning("Streaming error: %s", sp_error_message(error));
 }
+void cb_get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats) {
+    /* The plugin can change at any time */
+    output_buffer_stats(session, stats);
+}
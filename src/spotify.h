@@ -29,6 +29,8 @@
 #include <glib.h>
 #include <libspotify/api.h>
 
+#include "utils.h"
+
 /* Init functions */
 void session_init();
 void session_login(const char* username, const char* password);
@@ -49,7 +51,15 @@ void session_load(sp_track* track);
 void session_unload();
 void session_play(gboolean play);
 void session_seek(guint pos);
+void session_prefetch(sp_track* track);
 guint session_play_time();
+gint64 session_delivered_time();
+gint64 session_played_time();
+const latency_stats* session_seek_latency();
+const latency_stats* session_resume_latency();
+int session_transition_gap();
+typedef void (*session_output_cb)(gpointer data);
+gboolean session_switch_output(const gchar* name, session_output_cb callback, gpointer data);
 void session_get_offline_sync_status(sp_offline_sync_status* status, gboolean* sync_in_progress,
                                      int* tracks_to_sync, int* num_playlists, int* time_left);
 
@@ -66,6 +76,7 @@ gboolean session_remove_callback(spop_session_callback_ptr func, gpointer user_d
 
 /* Tracks management */
 GArray* tracks_get_playlist(sp_playlist* pl);
+GArray* tracks_get_playlist_range(sp_playlist* pl, guint offset, guint count);
 void track_get_data(sp_track* track, gchar** name, gchar** artist, gchar** album, gchar** link, guint* duration, int* popularity, bool *starred);
 gboolean track_available(sp_track* track);
 void track_set_starred(sp_track** tracks, gboolean starred);
@@ -80,10 +91,14 @@ sp_image* image_id_get_image(const void* img_id);
 sp_albumbrowse* albumbrowse_create(sp_album* album, albumbrowse_complete_cb* callback, gpointer userdata);
 sp_artistbrowse* artistbrowse_create(sp_artist* artist, artistbrowse_complete_cb* callback, gpointer userdata);
 sp_search* search_create(const gchar* query, search_complete_cb* callback, gpointer userdata);
+sp_search* search_create_range(const gchar* query, guint offset, guint count, search_complete_cb* callback, gpointer userdata);
 
 /* Events management */
 gboolean session_libspotify_event(gpointer data);
 gboolean session_next_track_event(gpointer data);
+gboolean session_switch_output_event(gpointer data);
+gboolean session_close_output_event(gpointer data);
+gboolean session_audible_event(gpointer data);
 
 /* Callbacks */
 void cb_logged_in(sp_session* session, sp_error error);
@@ -97,5 +112,6 @@ void cb_play_token_lost(sp_session* session);
 void cb_log_message(sp_session* session, const char* data);
 void cb_end_of_track(sp_session* session);
 void cb_streaming_error(sp_session* session, sp_error error);
+void cb_get_audio_buffer_stats(sp_session* session, sp_audio_buffer_stats* stats);
 
 #endif
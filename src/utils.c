@@ -24,6 +24,7 @@
  */
 
 #include <glib.h>
+#include <string.h>
 
 #include "utils.h"
 
@@ -50,3 +51,88 @@ void g_string_append_line_number(GString* str, int nb, int max_nb) {
     g_snprintf(fs, sizeof(fs), "%%%dd", nb_digits);
     g_string_append_printf(str, fs, nb);
 }
+
+/* Split a command line into words, in place, using the same quoting rules as
+ * g_shell_parse_argv(): words are separated by blanks, 'single quotes' are
+ * taken literally, backslashes escape the next character (only $ ` " \ and
+ * newlines between "double quotes"), and # starts a comment. The words are
+ * stored in words (at most max_words of them, pointing to str).
+ * Returns the total number of words, or -1 if a quote is not closed. */
+gint split_command(gchar* str, gchar** words, gint max_words) {
+    gchar* in = str;
+    gchar* out = str;
+    gint nb = 0;
+
+    while (TRUE) {
+        /* Skip blanks between words */
+        while ((*in == ' ') || (*in == '\t') || (*in == '\n') || (*in == '\r'))
+            in++;
+        if ((*in == '\0') || (*in == '#'))
+            break;
+
+        if (nb < max_words)
+            words[nb] = out;
+        nb += 1;
+
+        /* Copy the word, without the quotes */
+        while ((*in != '\0') && (*in != ' ') && (*in != '\t') && (*in != '\n') && (*in != '\r')) {
+            if (*in == '\'') {
+                in++;
+                while (*in != '\'') {
+                    if (*in == '\0')
+                        return -1;
+                    *out++ = *in++;
+                }
+                in++;
+            }
+            else if (*in == '"') {
+                in++;
+                while (*in != '"') {
+                    if (*in == '\0')
+                        return -1;
+                    if ((in[0] == '\\') && (in[1] == '\n'))
+                        in += 2;
+                    else if ((in[0] == '\\') && (in[1] != '\0') && strchr("$`\"\\", in[1])) {
+                        *out++ = in[1];
+                        in += 2;
+                    }
+                    else
+                        *out++ = *in++;
+                }
+                in++;
+            }
+            else if (*in == '\\') {
+                if (in[1] == '\0')
+                    return -1;
+                if (in[1] != '\n')
+                    *out++ = in[1];
+                in += 2;
+            }
+            else
+                *out++ = *in++;
+        }
+
+        /* The words only get shorter, so the end of the word is never after
+           the separator */
+        if (*in != '\0')
+            in++;
+        *out++ = '\0';
+    }
+
+    return nb;
+}
+
+/* Account for a new latency measurement */
+void latency_stats_add(latency_stats* ls, gint64 value) {
+    if ((ls->count == 0) || (value < ls->min))
+        ls->min = value;
+    if ((ls->count == 0) || (value > ls->max))
+        ls->max = value;
+    ls->last = value;
+    ls->sum += value;
+    ls->count += 1;
+}
+
+gint64 latency_stats_avg(const latency_stats* ls) {
+    return (ls->count > 0) ? ls->sum / ls->count : 0;
+}
@@ -31,5 +31,17 @@
 /* String manipulation */
 void g_string_replace(GString* str, const char* old, const gchar* new);
 void g_string_append_line_number(GString* str, int nb, int max_nb);
+gint split_command(gchar* str, gchar** words, gint max_words);
+
+/* Latency statistics (all values in µs) */
+typedef struct {
+    guint  count;
+    gint64 last;
+    gint64 min;
+    gint64 max;
+    gint64 sum;
+} latency_stats;
+void latency_stats_add(latency_stats* ls, gint64 value);
+gint64 latency_stats_avg(const latency_stats* ls);
 
 #endif